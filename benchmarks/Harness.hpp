@@ -0,0 +1,113 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace margelo::nitro::nitrostate::bench {
+
+/**
+ * Stopwatch - Lets a benchmark exclude its own setup from the timing
+ */
+class Stopwatch {
+public:
+    void start() { begin_ = Clock::now(); }
+    void stop() { elapsed_ += Clock::now() - begin_; }
+    uint64_t nanoseconds() const {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed_).count();
+    }
+
+private:
+    using Clock = std::chrono::steady_clock;
+    Clock::time_point begin_;
+    Clock::duration elapsed_{0};
+};
+
+/**
+ * Deterministic xorshift generator so every run touches the same atoms
+ */
+class Random {
+public:
+    explicit Random(uint64_t seed) : state_(seed ? seed : 0x9e3779b97f4a7c15ULL) {}
+    uint64_t next() {
+        state_ ^= state_ << 13;
+        state_ ^= state_ >> 7;
+        state_ ^= state_ << 17;
+        return state_;
+    }
+    size_t below(size_t bound) { return static_cast<size_t>(next() % bound); }
+
+private:
+    uint64_t state_;
+};
+
+struct Options {
+    std::vector<size_t> sizes{1000, 100000, 1000000};
+    unsigned threads = 4;
+    unsigned repeats = 3;
+    // Operations per measurement for the steady-state benchmarks
+    size_t operations = 1000000;
+    std::string filter;
+    bool csv = false;
+};
+
+/**
+ * Harness - Runs each benchmark `repeats` times and reports the median
+ *
+ * A benchmark body receives a Stopwatch, times the part it cares about and
+ * returns how many operations it performed.
+ */
+class Harness {
+public:
+    using Body = std::function<uint64_t(Stopwatch&)>;
+
+    explicit Harness(Options options) : options_(std::move(options)) {}
+
+    const Options& options() const { return options_; }
+
+    bool selected(const std::string& name) const {
+        return options_.filter.empty() || name.find(options_.filter) != std::string::npos;
+    }
+
+    void run(const std::string& name, size_t atoms, unsigned threads, const Body& body) {
+        if (!selected(name)) return;
+
+        std::vector<double> samples;
+        uint64_t operations = 0;
+        for (unsigned i = 0; i < options_.repeats; ++i) {
+            Stopwatch stopwatch;
+            operations = body(stopwatch);
+            samples.push_back(static_cast<double>(stopwatch.nanoseconds()) / std::max<uint64_t>(operations, 1));
+        }
+        std::sort(samples.begin(), samples.end());
+        report(name, atoms, threads, operations, samples[samples.size() / 2]);
+    }
+
+    void printHeader() const {
+        if (options_.csv) {
+            std::printf("benchmark,atoms,threads,ops,ns_per_op,mops_per_s\n");
+        } else {
+            std::printf("%-28s %10s %8s %12s %12s %12s\n", "benchmark", "atoms", "threads", "ops", "ns/op", "Mops/s");
+        }
+    }
+
+private:
+    void report(const std::string& name, size_t atoms, unsigned threads, uint64_t operations, double nsPerOp) const {
+        // Aggregate throughput across all threads
+        double mops = nsPerOp > 0 ? 1000.0 / nsPerOp : 0;
+        const char* format = options_.csv
+            ? "%s,%zu,%u,%llu,%.1f,%.2f\n"
+            : "%-28s %10zu %8u %12llu %12.1f %12.2f\n";
+        std::printf(format, name.c_str(), atoms, threads,
+            static_cast<unsigned long long>(operations), nsPerOp, mops);
+        std::fflush(stdout);
+    }
+
+    Options options_;
+};
+
+} // namespace margelo::nitro::nitrostate::bench
@@ -0,0 +1,490 @@
+/**
+ * Micro-benchmarks for the native state engine
+ *
+ * Builds cpp/ against the stubs in benchmarks/stub and drives
+ * HybridNitroState directly, the same way the JSI layer does.
+ *
+ * Usage: nitrostate_bench [--sizes 1000,100000] [--threads N] [--repeats N]
+ *                         [--ops N] [--filter name] [--csv] [--quick]
+ */
+#include "HybridNitroState.hpp"
+#include "Harness.hpp"
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace margelo::nitro;
+using namespace margelo::nitro::nitrostate;
+using namespace margelo::nitro::nitrostate::bench;
+
+namespace {
+
+// Computeds are far heavier than atoms, so the recompute benchmark caps
+// how many it creates
+constexpr size_t kMaxComputeds = 100000;
+// Distinct values cycled through by writers so every set is a real change
+constexpr size_t kValuePool = 64;
+
+std::shared_ptr<AnyMap> makeValue(double value) {
+    auto map = AnyMap::make();
+    map->setDouble("value", value);
+    return map;
+}
+
+std::vector<std::shared_ptr<AnyMap>> makeValuePool() {
+    std::vector<std::shared_ptr<AnyMap>> pool;
+    for (size_t i = 0; i < kValuePool; ++i) {
+        pool.push_back(makeValue(static_cast<double>(i)));
+    }
+    return pool;
+}
+
+std::vector<std::string> makeKeys(size_t count) {
+    std::vector<std::string> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        keys.push_back("atom:" + std::to_string(i));
+    }
+    return keys;
+}
+
+/**
+ * A populated state shared by the steady-state benchmarks of one size
+ */
+struct Fixture {
+    explicit Fixture(size_t atoms) : keys(makeKeys(atoms)), values(makeValuePool()) {
+        // Atoms share their initial value so 1M atoms stay cheap
+        auto initial = makeValue(0);
+        handles.reserve(atoms);
+        for (const auto& key : keys) {
+            handles.push_back(state->createAtomHandle(key, initial));
+        }
+    }
+
+    std::shared_ptr<HybridNitroState> state = std::make_shared<HybridNitroState>();
+    std::vector<std::string> keys;
+    std::vector<double> handles;
+    std::vector<std::shared_ptr<AnyMap>> values;
+};
+
+/**
+ * Random atom indices, generated up front so the timed loop only does the work
+ */
+std::vector<uint32_t> makeAccessPattern(size_t atoms, size_t count, uint64_t seed) {
+    Random random(seed);
+    std::vector<uint32_t> pattern(count);
+    for (auto& index : pattern) {
+        index = static_cast<uint32_t>(random.below(atoms));
+    }
+    return pattern;
+}
+
+/**
+ * Run `body(threadIndex)` on `threads` threads that start together
+ */
+template <typename Body>
+void runThreads(unsigned threads, Stopwatch& stopwatch, const Body& body) {
+    std::atomic<unsigned> ready{0};
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+    for (unsigned t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            ready.fetch_add(1);
+            while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+            body(t);
+        });
+    }
+    while (ready.load() < threads) std::this_thread::yield();
+    stopwatch.start();
+    go.store(true, std::memory_order_release);
+    for (auto& worker : workers) worker.join();
+    stopwatch.stop();
+}
+
+void benchCreate(Harness& harness, size_t atoms) {
+    auto keys = makeKeys(atoms);
+    auto initial = makeValue(0);
+    harness.run("create", atoms, 1, [&](Stopwatch& stopwatch) {
+        auto state = std::make_shared<HybridNitroState>();
+        stopwatch.start();
+        for (const auto& key : keys) {
+            state->createAtomHandle(key, initial);
+        }
+        stopwatch.stop();
+        return static_cast<uint64_t>(atoms);
+    });
+}
+
+void benchSingleThreaded(Harness& harness, Fixture& fixture) {
+    size_t atoms = fixture.keys.size();
+    size_t operations = harness.options().operations;
+    auto pattern = makeAccessPattern(atoms, operations, atoms);
+    auto& state = *fixture.state;
+
+    harness.run("get/handle", atoms, 1, [&](Stopwatch& stopwatch) {
+        size_t sink = 0;
+        stopwatch.start();
+        for (auto index : pattern) {
+            sink += state.getAtomValueByHandle(fixture.handles[index]) != nullptr;
+        }
+        stopwatch.stop();
+        if (sink != pattern.size()) throw std::runtime_error("get/handle returned null");
+        return static_cast<uint64_t>(pattern.size());
+    });
+
+    harness.run("get/key", atoms, 1, [&](Stopwatch& stopwatch) {
+        size_t sink = 0;
+        stopwatch.start();
+        for (auto index : pattern) {
+            sink += state.getAtomValue(fixture.keys[index]) != nullptr;
+        }
+        stopwatch.stop();
+        if (sink != pattern.size()) throw std::runtime_error("get/key returned null");
+        return static_cast<uint64_t>(pattern.size());
+    });
+
+    harness.run("set/handle", atoms, 1, [&](Stopwatch& stopwatch) {
+        stopwatch.start();
+        for (size_t i = 0; i < pattern.size(); ++i) {
+            state.setAtomValueByHandle(fixture.handles[pattern[i]], fixture.values[i % kValuePool]);
+        }
+        stopwatch.stop();
+        return static_cast<uint64_t>(pattern.size());
+    });
+
+    harness.run("subscribe+unsubscribe", atoms, 1, [&](Stopwatch& stopwatch) {
+        stopwatch.start();
+        for (auto index : pattern) {
+            auto unsubscribe = state.subscribeAtomByHandle(fixture.handles[index], [] {});
+            unsubscribe();
+        }
+        stopwatch.stop();
+        return static_cast<uint64_t>(pattern.size());
+    });
+
+    harness.run("set+notify", atoms, 1, [&](Stopwatch& stopwatch) {
+        // One subscriber on every atom the pattern touches
+        size_t notified = 0;
+        std::vector<std::function<void()>> unsubscribes;
+        for (size_t i = 0; i < std::min(atoms, pattern.size()); ++i) {
+            unsubscribes.push_back(state.subscribeAtomByHandle(fixture.handles[i], [&notified] { notified++; }));
+        }
+        stopwatch.start();
+        for (size_t i = 0; i < pattern.size(); ++i) {
+            state.setAtomValueByHandle(fixture.handles[pattern[i]], fixture.values[i % kValuePool]);
+        }
+        stopwatch.stop();
+        for (const auto& unsubscribe : unsubscribes) unsubscribe();
+        return static_cast<uint64_t>(pattern.size());
+    });
+}
+
+void benchBatch(Harness& harness, Fixture& fixture) {
+    size_t atoms = fixture.keys.size();
+    auto& state = *fixture.state;
+
+    // Every atom is written 4 times inside one batch and notifies once
+    constexpr size_t kWritesPerAtom = 4;
+    harness.run("batch/flush", atoms, 1, [&](Stopwatch& stopwatch) {
+        size_t notified = 0;
+        std::vector<std::function<void()>> unsubscribes;
+        unsubscribes.reserve(atoms);
+        for (auto handle : fixture.handles) {
+            unsubscribes.push_back(state.subscribeAtomByHandle(handle, [&notified] { notified++; }));
+        }
+
+        stopwatch.start();
+        state.startBatch();
+        for (size_t round = 0; round < kWritesPerAtom; ++round) {
+            for (size_t i = 0; i < atoms; ++i) {
+                state.setAtomValueByHandle(fixture.handles[i], fixture.values[(i + round) % kValuePool]);
+            }
+        }
+        state.endBatch();
+        stopwatch.stop();
+
+        for (const auto& unsubscribe : unsubscribes) unsubscribe();
+        if (notified != atoms) throw std::runtime_error("batch/flush notified an atom more than once");
+        return static_cast<uint64_t>(atoms * kWritesPerAtom);
+    });
+
+    // Hydration: keys and values arrive together, a screen's worth per call
+    constexpr size_t kBulkSize = 500;
+    std::vector<std::vector<std::string>> chunks;
+    for (size_t begin = 0; begin < atoms; begin += kBulkSize) {
+        chunks.emplace_back(fixture.keys.begin() + begin, fixture.keys.begin() + std::min(atoms, begin + kBulkSize));
+    }
+
+    // Each run writes a fresh value so no write is skipped as unchanged
+    size_t run = 0;
+    harness.run("bulk/setMany", atoms, 1, [&](Stopwatch& stopwatch) {
+        size_t notified = 0;
+        std::vector<std::function<void()>> unsubscribes;
+        unsubscribes.reserve(atoms);
+        for (auto handle : fixture.handles) {
+            unsubscribes.push_back(state.subscribeAtomByHandle(handle, [&notified] { notified++; }));
+        }
+        std::vector<std::vector<std::shared_ptr<AnyMap>>> values;
+        for (size_t c = 0; c < chunks.size(); ++c) {
+            values.emplace_back(chunks[c].size(), fixture.values[(run + 1) % kValuePool]);
+        }
+        run++;
+
+        stopwatch.start();
+        for (size_t c = 0; c < chunks.size(); ++c) {
+            state.setMany(chunks[c], values[c]);
+        }
+        stopwatch.stop();
+
+        for (const auto& unsubscribe : unsubscribes) unsubscribe();
+        if (notified != atoms) throw std::runtime_error("bulk/setMany notified the wrong number of atoms");
+        return static_cast<uint64_t>(atoms);
+    });
+
+    harness.run("bulk/getMany", atoms, 1, [&](Stopwatch& stopwatch) {
+        size_t sink = 0;
+        stopwatch.start();
+        for (const auto& chunk : chunks) {
+            sink += state.getMany(chunk).size();
+        }
+        stopwatch.stop();
+        if (sink != atoms) throw std::runtime_error("bulk/getMany returned too few values");
+        return static_cast<uint64_t>(atoms);
+    });
+}
+
+void benchComputed(Harness& harness, Fixture& fixture) {
+    size_t atoms = fixture.keys.size();
+    size_t computeds = std::min(atoms, kMaxComputeds);
+    auto& state = *fixture.state;
+
+    std::vector<std::string> computedKeys;
+    computedKeys.reserve(computeds);
+    for (size_t i = 0; i < computeds; ++i) {
+        computedKeys.push_back("computed:" + std::to_string(i));
+        const auto& source = fixture.keys[i];
+        state.createComputed(computedKeys.back(), {source}, [&state, source](double) {
+            double value = state.getAtomValue(source)->getDouble("value");
+            return Promise<std::shared_ptr<AnyMap>>::resolved(makeValue(value * 2));
+        });
+    }
+
+    auto pattern = makeAccessPattern(computeds, harness.options().operations, computeds);
+    harness.run("computed/recompute", atoms, 1, [&](Stopwatch& stopwatch) {
+        double sink = 0;
+        stopwatch.start();
+        for (size_t i = 0; i < pattern.size(); ++i) {
+            auto index = pattern[i];
+            state.setAtomValueByHandle(fixture.handles[index], fixture.values[i % kValuePool]);
+            sink += state.getComputedValue(computedKeys[index])->getDouble("value");
+        }
+        stopwatch.stop();
+        if (sink < 0) throw std::runtime_error("computed/recompute produced a negative sum");
+        return static_cast<uint64_t>(pattern.size());
+    });
+
+    for (const auto& key : computedKeys) {
+        state.deleteComputed(key);
+    }
+}
+
+void benchNested(Harness& harness, size_t atoms) {
+    // One atom holding an entity cache with as many entries as the run has atoms
+    size_t entries = std::min(atoms, kMaxComputeds);
+    auto state = std::make_shared<HybridNitroState>();
+    auto cache = AnyMap::make();
+    AnyObject users;
+    for (size_t i = 0; i < entries; ++i) {
+        users["user:" + std::to_string(i)] = AnyObject{{"score", 0.0}};
+    }
+    cache->setObject("users", users);
+    state->createAtom("cache", cache);
+
+    size_t operations = std::min<size_t>(harness.options().operations, 100000);
+    auto pattern = makeAccessPattern(entries, operations, entries + 7);
+
+    harness.run("setIn/entity-cache", entries, 1, [&](Stopwatch& stopwatch) {
+        auto wrapped = AnyMap::make();
+        stopwatch.start();
+        for (size_t i = 0; i < pattern.size(); ++i) {
+            wrapped->setDouble("value", static_cast<double>(i));
+            state->setIn("cache", {"users", "user:" + std::to_string(pattern[i]), "score"}, wrapped);
+        }
+        stopwatch.stop();
+        return static_cast<uint64_t>(pattern.size());
+    });
+
+    harness.run("getIn/entity-cache", entries, 1, [&](Stopwatch& stopwatch) {
+        size_t found = 0;
+        stopwatch.start();
+        for (auto index : pattern) {
+            found += state->getIn("cache", {"users", "user:" + std::to_string(index), "score"})->contains("value");
+        }
+        stopwatch.stop();
+        if (found != pattern.size()) throw std::runtime_error("getIn/entity-cache missed an entry");
+        return static_cast<uint64_t>(pattern.size());
+    });
+
+    // Replacing the whole cache makes the next setIn convert it again:
+    // O(entries) per round, paid once however many edits follow
+    size_t rounds = std::min<size_t>(pattern.size(), 100);
+    harness.run("setIn/after-set", entries, 1, [&](Stopwatch& stopwatch) {
+        auto wrapped = AnyMap::make();
+        stopwatch.start();
+        for (size_t i = 0; i < rounds; ++i) {
+            state->setAtomValue("cache", cache);
+            wrapped->setDouble("value", static_cast<double>(i + 1));
+            state->setIn("cache", {"users", "user:" + std::to_string(pattern[i]), "score"}, wrapped);
+        }
+        stopwatch.stop();
+        return static_cast<uint64_t>(rounds);
+    });
+
+    // Arrays are stored plain, so every push copies the list: O(entries)
+    // per call, unlike the O(log n) setIn above
+    auto items = AnyMap::make();
+    items->setArray("value", AnyArray(entries, 0.0));
+    state->createAtom("list", AnyMap::make());
+    state->push("list", {"items"}, items);
+    items->setArray("value", AnyArray{1.0});
+    harness.run("push/long-list", entries, 1, [&](Stopwatch& stopwatch) {
+        stopwatch.start();
+        for (size_t i = 0; i < rounds; ++i) {
+            state->push("list", {"items"}, items);
+        }
+        stopwatch.stop();
+        return static_cast<uint64_t>(rounds);
+    });
+}
+
+void benchContended(Harness& harness, Fixture& fixture) {
+    size_t atoms = fixture.keys.size();
+    unsigned threads = harness.options().threads;
+    size_t perThread = std::max<size_t>(harness.options().operations / threads, 1);
+    auto& state = *fixture.state;
+
+    std::vector<std::vector<uint32_t>> patterns;
+    for (unsigned t = 0; t < threads; ++t) {
+        patterns.push_back(makeAccessPattern(atoms, perThread, atoms * 31 + t + 1));
+    }
+    uint64_t total = static_cast<uint64_t>(perThread) * threads;
+
+    harness.run("contended/get", atoms, threads, [&](Stopwatch& stopwatch) {
+        runThreads(threads, stopwatch, [&](unsigned t) {
+            for (auto index : patterns[t]) {
+                state.getAtomValueByHandle(fixture.handles[index]);
+            }
+        });
+        return total;
+    });
+
+    harness.run("contended/set", atoms, threads, [&](Stopwatch& stopwatch) {
+        runThreads(threads, stopwatch, [&](unsigned t) {
+            const auto& pattern = patterns[t];
+            for (size_t i = 0; i < pattern.size(); ++i) {
+                state.setAtomValueByHandle(fixture.handles[pattern[i]], fixture.values[(i + t) % kValuePool]);
+            }
+        });
+        return total;
+    });
+
+    // One writer per ten operations, like a UI reading far more than it writes
+    harness.run("contended/mixed-90-10", atoms, threads, [&](Stopwatch& stopwatch) {
+        runThreads(threads, stopwatch, [&](unsigned t) {
+            const auto& pattern = patterns[t];
+            for (size_t i = 0; i < pattern.size(); ++i) {
+                double handle = fixture.handles[pattern[i]];
+                if (i % 10 == 0) {
+                    state.setAtomValueByHandle(handle, fixture.values[(i + t) % kValuePool]);
+                } else {
+                    state.getAtomValueByHandle(handle);
+                }
+            }
+        });
+        return total;
+    });
+
+    // Every thread hammers the same atom
+    harness.run("contended/set-hot-atom", atoms, threads, [&](Stopwatch& stopwatch) {
+        double hot = fixture.handles.front();
+        runThreads(threads, stopwatch, [&](unsigned t) {
+            for (size_t i = 0; i < perThread; ++i) {
+                state.setAtomValueByHandle(hot, fixture.values[(i + t) % kValuePool]);
+            }
+        });
+        return total;
+    });
+}
+
+std::vector<size_t> parseSizes(const char* text) {
+    std::vector<size_t> sizes;
+    std::string list(text);
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos) end = list.size();
+        if (end > start) sizes.push_back(std::stoull(list.substr(start, end - start)));
+        start = end + 1;
+    }
+    return sizes;
+}
+
+Options parseOptions(int argc, char** argv) {
+    Options options;
+    unsigned hardware = std::thread::hardware_concurrency();
+    options.threads = hardware > 1 ? hardware : 4;
+
+    for (int i = 1; i < argc; ++i) {
+        auto is = [&](const char* flag) { return std::strcmp(argv[i], flag) == 0; };
+        auto value = [&]() -> const char* {
+            if (i + 1 >= argc) throw std::runtime_error(std::string("Missing value for ") + argv[i]);
+            return argv[++i];
+        };
+
+        if (is("--sizes")) options.sizes = parseSizes(value());
+        else if (is("--threads")) options.threads = std::max(1, std::atoi(value()));
+        else if (is("--repeats")) options.repeats = std::max(1, std::atoi(value()));
+        else if (is("--ops")) options.operations = std::max(1ULL, std::stoull(value()));
+        else if (is("--filter")) options.filter = value();
+        else if (is("--csv")) options.csv = true;
+        else if (is("--quick")) {
+            // Smoke run for ctest: every benchmark once, at the smallest size
+            options.sizes = {1000};
+            options.threads = 2;
+            options.repeats = 1;
+            options.operations = 10000;
+        } else {
+            throw std::runtime_error(std::string("Unknown option ") + argv[i]);
+        }
+    }
+    return options;
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    try {
+        Harness harness(parseOptions(argc, argv));
+        harness.printHeader();
+
+        for (size_t atoms : harness.options().sizes) {
+            benchCreate(harness, atoms);
+
+            Fixture fixture(atoms);
+            benchSingleThreaded(harness, fixture);
+            benchBatch(harness, fixture);
+            benchContended(harness, fixture);
+            benchComputed(harness, fixture);
+            benchNested(harness, atoms);
+        }
+    } catch (const std::exception& error) {
+        std::fprintf(stderr, "nitrostate_bench: %s\n", error.what());
+        return 1;
+    }
+    return 0;
+}
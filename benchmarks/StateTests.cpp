@@ -0,0 +1,1190 @@
+/**
+ * Behaviour tests for the native state engine
+ *
+ * Builds cpp/ against the stubs in benchmarks/stub, like the benchmarks,
+ * and checks the engine through HybridNitroState and its building blocks.
+ *
+ * Usage: nitrostate_tests [name filter]
+ */
+#include "HybridNitroState.hpp"
+#include "CommitClock.hpp"
+#include "ComputedCore.hpp"
+#include "PersistentMap.hpp"
+#include "ValueCodec.hpp"
+#include "ValueEquality.hpp"
+#include "WriteAheadLog.hpp"
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using namespace margelo::nitro;
+using namespace margelo::nitro::nitrostate;
+
+namespace {
+
+struct Failure : std::runtime_error {
+    using std::runtime_error::runtime_error;
+};
+
+void check(bool passed, const char* expression, int line) {
+    if (!passed) {
+        throw Failure("line " + std::to_string(line) + ": " + expression);
+    }
+}
+
+void checkThrows(const std::function<void()>& body, const char* expression, int line) {
+    try {
+        body();
+    } catch (const std::runtime_error&) {
+        return;
+    }
+    throw Failure("line " + std::to_string(line) + ": expected " + expression + " to throw");
+}
+
+#define CHECK(expression) check((expression), #expression, __LINE__)
+#define CHECK_THROWS(expression) checkThrows([&] { expression; }, #expression, __LINE__)
+
+std::shared_ptr<AnyMap> makeValue(double value) {
+    auto map = AnyMap::make();
+    map->setDouble("value", value);
+    return map;
+}
+
+double valueOf(const std::shared_ptr<AnyMap>& map) {
+    return map->getDouble("value");
+}
+
+// Collect until a sweep finds nothing more; a few calls may come back
+// empty-handed while the sweep walks shards that have nothing to reclaim
+void collectAll(HybridNitroState& state) {
+    for (int idle = 0; idle < 64;) {
+        idle = state.collectGarbage(100) > 0 ? 0 : idle + 1;
+    }
+}
+
+/**
+ * Scratch directory removed again when the test ends
+ */
+class TemporaryDirectory {
+public:
+    TemporaryDirectory()
+        : path_(std::filesystem::temp_directory_path() /
+                ("nitrostate_tests_" + std::to_string(::getpid()))) {
+        std::filesystem::remove_all(path_);
+        std::filesystem::create_directories(path_);
+    }
+    ~TemporaryDirectory() {
+        std::error_code ignored;
+        std::filesystem::remove_all(path_, ignored);
+    }
+
+    std::string file(const std::string& name) const { return (path_ / name).string(); }
+
+private:
+    std::filesystem::path path_;
+};
+
+// ----- Equality -----
+
+// Notifications delivered for one write
+int notifications(HybridNitroState& state, const std::string& key, const std::shared_ptr<AnyMap>& value) {
+    int notified = 0;
+    auto unsubscribe = state.subscribeAtom(key, [&] { notified++; });
+    state.setAtomValue(key, value);
+    unsubscribe();
+    return notified;
+}
+
+std::shared_ptr<AnyMap> makeProfile(double age) {
+    auto map = AnyMap::make();
+    map->setString("name", "ann");
+    map->setDouble("age", age);
+    map->setObject("tags", AnyObject{{"admin", true}});
+    return map;
+}
+
+void testEqualitySuppressesNoOpWrites() {
+    HybridNitroState state;
+    state.createAtom("identity", makeValue(1));
+    CHECK(notifications(state, "identity", makeValue(1)) == 1);
+
+    state.createAtom("shallow", makeValue(1));
+    state.setAtomEquality("shallow", EqualityMode::SHALLOW);
+    CHECK(notifications(state, "shallow", makeValue(1)) == 0);
+    CHECK(notifications(state, "shallow", makeValue(2)) == 1);
+    // Nested values are copied across JSI, so they always count as changed
+    CHECK(notifications(state, "shallow", makeProfile(20)) == 1);
+    CHECK(notifications(state, "shallow", makeProfile(20)) == 1);
+
+    for (auto mode : {EqualityMode::DEEP, EqualityMode::HASH}) {
+        auto key = mode == EqualityMode::DEEP ? "deep" : "hash";
+        state.createAtom(key, makeProfile(20));
+        state.setAtomEquality(key, mode);
+        CHECK(notifications(state, key, makeProfile(20)) == 0);
+        CHECK(notifications(state, key, makeProfile(21)) == 1);
+
+        // Numbers compare like Object.is: NaN is itself, -0 is not 0
+        CHECK(notifications(state, key, makeValue(std::nan(""))) == 1);
+        CHECK(notifications(state, key, makeValue(std::nan(""))) == 0);
+        CHECK(notifications(state, key, makeValue(0)) == 1);
+        CHECK(notifications(state, key, makeValue(-0.0)) == 1);
+        CHECK(notifications(state, key, makeValue(-0.0)) == 0);
+    }
+}
+
+// ----- Batching -----
+
+void testBatchDedupesAndFlushesInWriteOrder() {
+    HybridNitroState state;
+    std::vector<std::string> order;
+    std::vector<std::function<void()>> unsubscribes;
+    for (const char* key : {"a", "b", "c"}) {
+        state.createAtom(key, makeValue(0));
+        unsubscribes.push_back(state.subscribeAtom(key, [&order, key] { order.push_back(key); }));
+    }
+    state.createComputed("sum", {}, [&](double) {
+        double sum = valueOf(state.getAtomValue("a")) + valueOf(state.getAtomValue("b"));
+        return Promise<std::shared_ptr<AnyMap>>::resolved(makeValue(sum));
+    });
+    CHECK(valueOf(state.getComputedValue("sum")) == 0);
+    unsubscribes.push_back(state.subscribeComputed("sum", [&] { order.push_back("sum"); }));
+
+    state.startBatch();
+    state.setAtomValue("b", makeValue(1));
+    state.setAtomValue("a", makeValue(1));
+    state.setAtomValue("b", makeValue(2));
+    state.setAtomValue("c", makeValue(1));
+    // A nested batch flushes with the outermost one
+    state.startBatch();
+    state.setAtomValue("a", makeValue(2));
+    state.endBatch();
+    CHECK(order.empty());
+    state.endBatch();
+
+    // Each atom once, in the order first written, then the computed
+    CHECK((order == std::vector<std::string>{"b", "a", "c", "sum"}));
+    CHECK(valueOf(state.getComputedValue("sum")) == 4);
+
+    // Closed: writes are delivered right away again
+    order.clear();
+    state.setAtomValue("c", makeValue(2));
+    CHECK((order == std::vector<std::string>{"c"}));
+    for (const auto& unsubscribe : unsubscribes) {
+        unsubscribe();
+    }
+}
+
+// ----- Versions -----
+
+void testCommitClockCompletesOutOfOrder() {
+    CommitClock clock;
+    uint64_t first = clock.begin();
+    uint64_t second = clock.begin();
+    // The later commit finishes first without waiting; current() holds back
+    clock.complete(second);
+    CHECK(clock.current() == 0);
+    clock.complete(first);
+    CHECK(clock.current() == second);
+
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 8; t++) {
+        writers.emplace_back([&] {
+            for (int i = 0; i < 20000; i++) {
+                clock.complete(clock.begin());
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    CHECK(clock.current() == second + 8 * 20000);
+}
+
+// ----- Compare and Set -----
+
+void testCompareAndSet() {
+    CommitClock clock;
+    auto atom = std::make_shared<AtomCore>("a", makeValue(1));
+    atom->setEqualityMode(EqualityMode::SHALLOW);
+    uint64_t version = atom->commitVersion();
+    CHECK(atom->compareAndSet(version, makeValue(1), clock) == AtomCore::CompareResult::UNCHANGED);
+    CHECK(atom->commitVersion() == version);
+    CHECK(atom->compareAndSet(version, makeValue(2), clock) == AtomCore::CompareResult::WRITTEN);
+    CHECK(atom->compareAndSet(version, makeValue(3), clock) == AtomCore::CompareResult::CONFLICT);
+    CHECK(valueOf(atom->get()) == 2);
+
+    HybridNitroState state;
+    state.createAtom("counter", makeValue(0));
+    double seen = state.getAtomVersion("counter");
+    CHECK(state.compareAndSet("counter", seen, makeValue(1)));
+    CHECK(!state.compareAndSet("counter", seen, makeValue(100)));
+    CHECK(valueOf(state.getAtomValue("counter")) == 1);
+
+    // A write landing while the updater runs makes it run again on that value
+    int calls = 0;
+    auto written = state.updateAtom("counter", [&](const std::shared_ptr<AnyMap>& current) {
+        if (calls++ == 0) state.setAtomValue("counter", makeValue(10));
+        return makeValue(valueOf(current) + 1);
+    });
+    CHECK(calls == 2 && valueOf(written) == 11);
+
+    // Contended increments never lose one
+    std::vector<std::thread> writers;
+    for (int t = 0; t < 4; t++) {
+        writers.emplace_back([&] {
+            for (int i = 0; i < 1000; i++) {
+                state.updateAtom("counter", [](const std::shared_ptr<AnyMap>& current) {
+                    return makeValue(valueOf(current) + 1);
+                });
+            }
+        });
+    }
+    for (auto& writer : writers) {
+        writer.join();
+    }
+    CHECK(valueOf(state.getAtomValue("counter")) == 4011);
+}
+
+// ----- Transactions -----
+
+void testTransactionReadsSnapshot() {
+    HybridNitroState state;
+    state.createAtom("a", makeValue(1));
+    state.createAtom("b", makeValue(1));
+
+    double tx = state.beginTransaction();
+    state.setAtomValue("a", makeValue(2));
+    // Enough writes to trim any history nobody pinned
+    for (int i = 0; i < 20; i++) {
+        state.setAtomValue("a", makeValue(10 + i));
+    }
+    CHECK(valueOf(state.transactionGet(tx, "a")) == 1);
+
+    state.transactionSet(tx, "b", makeValue(5));
+    CHECK(valueOf(state.transactionGet(tx, "b")) == 5);
+    CHECK(valueOf(state.getAtomValue("b")) == 1);
+
+    // It read `a`, which changed after its snapshot
+    CHECK(!state.commitTransaction(tx));
+    CHECK(valueOf(state.getAtomValue("b")) == 1);
+    CHECK_THROWS(state.transactionGet(tx, "a"));
+}
+
+void testTransactionCommitAndAbort() {
+    HybridNitroState state;
+    state.createAtom("a", makeValue(1));
+    state.createAtom("b", makeValue(1));
+    int notified = 0;
+    auto unsubscribe = state.subscribeAtom("b", [&] { notified++; });
+
+    double tx = state.beginTransaction();
+    double a = valueOf(state.transactionGet(tx, "a"));
+    state.transactionSet(tx, "a", makeValue(a + 1));
+    state.transactionSet(tx, "b", makeValue(a + 2));
+    CHECK(state.commitTransaction(tx));
+    CHECK(valueOf(state.getAtomValue("a")) == 2);
+    CHECK(valueOf(state.getAtomValue("b")) == 3);
+    CHECK(notified == 1);
+
+    double aborted = state.beginTransaction();
+    state.transactionSet(aborted, "b", makeValue(100));
+    state.abortTransaction(aborted);
+    CHECK(valueOf(state.getAtomValue("b")) == 3);
+    CHECK_THROWS(state.commitTransaction(aborted));
+    unsubscribe();
+}
+
+void testTransactionWriteConflict() {
+    HybridNitroState state;
+    state.createAtom("a", makeValue(1));
+
+    double first = state.beginTransaction();
+    double second = state.beginTransaction();
+    state.transactionSet(first, "a", makeValue(2));
+    state.transactionSet(second, "a", makeValue(3));
+    CHECK(state.commitTransaction(first));
+    CHECK(!state.commitTransaction(second));
+    CHECK(valueOf(state.getAtomValue("a")) == 2);
+}
+
+void testTransactionWriteToDeletedAtom() {
+    HybridNitroState state;
+    state.createAtom("a", makeValue(1));
+
+    double tx = state.beginTransaction();
+    state.transactionSet(tx, "a", makeValue(2));
+    state.deleteAtom("a");
+    CHECK(!state.commitTransaction(tx));
+    CHECK_THROWS(state.commitTransaction(std::nan("")));
+}
+
+void testBatchBelongsToItsThread() {
+    HybridNitroState state;
+    state.createAtom("a", makeValue(1));
+    state.createAtom("b", makeValue(1));
+    std::atomic<int> notified{0};
+    auto unsubscribe = state.subscribeAtom("b", [&] { notified++; });
+
+    // A batch open on this thread does not hold back writes from another
+    state.startBatch();
+    std::thread([&] {
+        double tx = state.beginTransaction();
+        state.transactionSet(tx, "b", makeValue(2));
+        CHECK(state.commitTransaction(tx));
+    }).join();
+    CHECK(notified == 1);
+
+    state.setAtomValue("b", makeValue(3));
+    CHECK(notified == 1);
+    state.endBatch();
+    CHECK(notified == 2);
+    unsubscribe();
+}
+
+// ----- Snapshots -----
+
+void testSnapshotPinAndPrune() {
+    CommitClock clock;
+    auto atom = std::make_shared<AtomCore>("a", makeValue(1));
+
+    uint64_t pinned = clock.pin();
+    atom->set(makeValue(2), clock);
+    atom->set(makeValue(3), clock);
+    CHECK(valueOf(atom->getAt(pinned)) == 1);
+    CHECK(valueOf(atom->get()) == 3);
+    CHECK(atom->historyLength() > 0);
+
+    clock.unpin(pinned);
+    atom->pruneHistory(clock);
+    CHECK(atom->historyLength() == 0);
+    CHECK(valueOf(atom->getAt(clock.current())) == 3);
+}
+
+void testSnapshotReads() {
+    HybridNitroState state;
+    state.createAtom("a", makeValue(1));
+
+    double snapshot = state.acquireSnapshot();
+    state.setAtomValue("a", makeValue(2));
+    CHECK(valueOf(state.getAtomValueAt(snapshot, "a")) == 1);
+    CHECK(valueOf(state.getAtomValue("a")) == 2);
+
+    state.releaseSnapshot(snapshot);
+    CHECK_THROWS(state.getAtomValueAt(snapshot, "a"));
+    CHECK_THROWS(state.getAtomValueAt(std::nan(""), "a"));
+    CHECK_THROWS(state.releaseSnapshot(-1));
+    CHECK_THROWS(state.getChangedSince(std::numeric_limits<double>::infinity()));
+}
+
+// ----- Persistence -----
+
+void testLogReplaysPastTornTail() {
+    TemporaryDirectory directory;
+    auto path = directory.file("state.bin");
+    {
+        HybridNitroState state;
+        state.openStore(path);
+        state.createAtom("a", makeValue(1));
+        state.persistAtom("a");
+        for (int i = 2; i <= 5; i++) {
+            state.setAtomValue("a", makeValue(i));
+        }
+    }
+
+    // A record cut short by a crash: its header promises more bytes
+    auto log = path + ".wal";
+    auto intact = std::filesystem::file_size(log);
+    size_t records = WriteAheadLog::read(log).size();
+    {
+        std::ofstream out(log, std::ios::binary | std::ios::app);
+        const char torn[] = {0x40, 0x00, 0x00, 0x00, 0x12, 0x34, 0x56, 0x78, 0x01};
+        out.write(torn, sizeof(torn));
+    }
+    CHECK(WriteAheadLog::read(log).size() == records);
+
+    HybridNitroState state;
+    auto keys = state.openStore(path);
+    CHECK(keys.size() == 1 && keys[0] == "a");
+    CHECK(valueOf(state.getAtomValue("a")) == 5);
+    CHECK(std::filesystem::file_size(log) == intact);
+}
+
+void testLogCompaction() {
+    TemporaryDirectory directory;
+    auto path = directory.file("compact.wal");
+    int compactions = 0;
+    WriteAheadLog log(path, 0, [&] {
+        compactions++;
+        // As if the store file now covered every commit up to 5
+        return WriteAheadLog::Compaction{5, 0};
+    });
+
+    log.put("old", 3, makeValue(1));
+    log.remove("gone", 4);
+    log.put("new", 7, makeValue(2));
+    log.sync();
+    CHECK(WriteAheadLog::read(path).size() == 3);
+
+    log.compact();
+    CHECK(compactions == 1);
+    auto records = WriteAheadLog::read(path);
+    CHECK(records.size() == 1);
+    CHECK(records[0].key == "new" && records[0].commit == 7 && records[0].value);
+    CHECK(valueOf(ValueCodec::decodeMap(records[0].value->data, records[0].value->size)) == 2);
+}
+
+// ----- Serialization -----
+
+std::shared_ptr<AnyMap> makeDocument() {
+    auto map = AnyMap::make();
+    map->setString("title", "chat");
+    map->setBoolean("open", true);
+    map->setNull("topic");
+    map->setBigInt("id", int64_t{1} << 40);
+    AnyArray rows;
+    for (int i = 0; i < 50; i++) {
+        AnyObject row;
+        row["author"] = std::string(i % 2 ? "ann" : "bob");
+        row["text"] = "message " + std::to_string(i);
+        row["at"] = static_cast<double>(i) * 0.5;
+        rows.push_back(std::move(row));
+    }
+    map->setArray("rows", rows);
+    return map;
+}
+
+void testCodecRoundTrip() {
+    auto document = makeDocument();
+    ValueCodec::Bytes bytes;
+    ValueCodec::encode(*document, bytes);
+
+    auto decoded = ValueCodec::decodeMap(bytes.data(), bytes.size());
+    CHECK(ValueEquality::deepEqual(AnyValue(document->getMap()), AnyValue(decoded->getMap())));
+    CHECK(decoded->getBigInt("id") == int64_t{1} << 40);
+    CHECK(decoded->isNull("topic"));
+
+    auto text = ValueCodec::decodeIn(bytes.data(), bytes.size(), {"rows", "7", "text"});
+    CHECK(text && std::get<std::string>(*text) == "message 7");
+    CHECK(!ValueCodec::decodeIn(bytes.data(), bytes.size(), {"rows", "50"}));
+}
+
+void testCodecRejectsCorruptInput() {
+    ValueCodec::Bytes bytes;
+    ValueCodec::encode(*makeDocument(), bytes);
+
+    // Every truncation is caught instead of read past the end
+    for (size_t size = 0; size < bytes.size(); size++) {
+        CHECK_THROWS(ValueCodec::decodeMap(bytes.data(), size));
+    }
+    ValueCodec::Bytes trailing = bytes;
+    trailing.push_back(0);
+    CHECK_THROWS(ValueCodec::decodeMap(trailing.data(), trailing.size()));
+
+    const uint8_t garbage[] = {0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0x01};
+    CHECK_THROWS(ValueCodec::decodeMap(garbage, sizeof(garbage)));
+}
+
+void testCodecInternsStrings() {
+    AnyArray rows;
+    for (int i = 0; i < 1000; i++) {
+        rows.push_back(AnyObject{{"author", std::string(i % 2 ? "ann" : "bob")}});
+    }
+    AnyObject object{{"rows", rows}};
+    // Strings too short or too long to intern are written out each time
+    object["a"] = std::string("x");
+    object["long"] = std::string(100, 'y');
+    object["again"] = std::string(100, 'y');
+    ValueCodec::Bytes bytes;
+    ValueCodec::encode(AnyValue(object), bytes);
+
+    // Written out, every row would repeat "author" and its value
+    CHECK(bytes.size() < 1000 * 6 + 300);
+    auto decoded = ValueCodec::decode(bytes.data(), bytes.size());
+    CHECK(ValueEquality::deepEqual(AnyValue(object), decoded));
+}
+
+void testExportImport() {
+    HybridNitroState state;
+    state.createAtom("source", makeDocument());
+    auto exported = state.exportAtom("source");
+
+    state.importAtom("copy", exported);
+    CHECK(ValueEquality::deepEqual(
+        AnyValue(state.getAtomValue("source")->getMap()),
+        AnyValue(state.getAtomValue("copy")->getMap())
+    ));
+
+    // Importing over an existing atom writes and notifies like a set
+    int notified = 0;
+    auto unsubscribe = state.subscribeAtom("copy", [&] { notified++; });
+    ValueCodec::Bytes bytes;
+    ValueCodec::encode(*makeValue(7), bytes);
+    state.importAtom("copy", ArrayBuffer::copy(bytes.data(), bytes.size()));
+    CHECK(valueOf(state.getAtomValue("copy")) == 7);
+    CHECK(notified == 1);
+    unsubscribe();
+
+    bytes.pop_back();
+    CHECK_THROWS(state.importAtom("copy", ArrayBuffer::copy(bytes.data(), bytes.size())));
+    CHECK(valueOf(state.getAtomValue("copy")) == 7);
+}
+
+// ----- Nested Values -----
+
+void testPersistentMapSetInGetIn() {
+    AnyObject object;
+    for (int i = 0; i < 1000; i++) {
+        object["k" + std::to_string(i)] = static_cast<double>(i);
+    }
+    object["list"] = AnyArray{1.0, 2.0};
+    PersistentValue root = PersistentMap::fromObject(object);
+
+    auto updated = PersistentMap::setIn(root, {"k500", "nested"}, AnyValue(1.5));
+    auto nested = PersistentMap::getIn(updated, {"k500", "nested"});
+    CHECK(nested && std::get<double>(*nested) == 1.5);
+    // The original is untouched
+    auto original = PersistentMap::getIn(root, {"k500"});
+    CHECK(original && std::get<double>(*original) == 500);
+    auto other = PersistentMap::getIn(updated, {"k999"});
+    CHECK(other && std::get<double>(*other) == 999);
+    CHECK(!PersistentMap::getIn(updated, {"missing"}));
+    CHECK(!PersistentMap::getIn(updated, {"k1", "below-a-number"}));
+
+    updated = PersistentMap::setIn(updated, {"list", "2"}, AnyValue(3.0));
+    auto list = PersistentMap::getIn(updated, {"list"});
+    CHECK(list && std::get<AnyArray>(*list).size() == 3);
+    CHECK_THROWS(PersistentMap::setIn(updated, {"list", "100000000"}, AnyValue(0.0)));
+    CHECK_THROWS(PersistentMap::setIn(updated, {"list", "x"}, AnyValue(0.0)));
+}
+
+// ----- Path Subscriptions -----
+
+void testPathSubscriptions() {
+    HybridNitroState state;
+    auto user = AnyMap::make();
+    user->setObject("profile", AnyObject{{"name", std::string("ann")}, {"age", 20.0}});
+    user->setDouble("visits", 1);
+    state.createAtom("user", user);
+
+    int name = 0;
+    int age = 0;
+    int profile = 0;
+    auto unsubscribeName = state.subscribePath("user", {"profile", "name"}, [&] { name++; });
+    auto unsubscribeAge = state.subscribePath("user", {"profile", "age"}, [&] { age++; });
+    auto unsubscribeProfile = state.subscribePath("user", {"profile"}, [&] { profile++; });
+
+    state.setIn("user", {"profile", "age"}, makeValue(21));
+    CHECK(name == 0 && age == 1 && profile == 1);
+    state.setIn("user", {"visits"}, makeValue(2));
+    CHECK(name == 0 && age == 1 && profile == 1);
+
+    // A whole new value only reaches the paths whose value differs
+    auto renamed = AnyMap::make();
+    renamed->setObject("profile", AnyObject{{"name", std::string("bob")}, {"age", 21.0}});
+    renamed->setDouble("visits", 3);
+    state.setAtomValue("user", renamed);
+    CHECK(name == 1 && age == 1 && profile == 2);
+
+    unsubscribeName();
+    unsubscribeProfile();
+    state.setIn("user", {"profile", "name"}, makeValue(0));
+    CHECK(name == 1 && profile == 2);
+    unsubscribeAge();
+
+    // The trie is pruned as subscribers leave, so the atom ends up unobserved
+    auto atom = std::make_shared<AtomCore>("a", makeValue(1));
+    auto deep = atom->subscribePath({"x", "y", "z"}, [] {});
+    auto shallow = atom->subscribePath({"x"}, [] {});
+    atom->unsubscribePath(shallow);
+    CHECK(atom->isObserved());
+    atom->unsubscribePath(deep);
+    CHECK(!atom->isObserved());
+}
+
+// ----- Patches -----
+
+void testSetInAfterSet() {
+    HybridNitroState state;
+    auto wrap = [](AnyValue value) {
+        auto map = AnyMap::make();
+        map->setAny("value", std::move(value));
+        return map;
+    };
+    auto leafAt = [&](const std::vector<std::string>& path) {
+        return state.getIn("a", path)->getAny("value");
+    };
+    state.createAtom("a", makeValue(0));
+
+    for (int round = 0; round < 2; round++) {
+        auto value = AnyMap::make();
+        value->setAny("users", AnyObject{
+            {"u1", AnyObject{{"name", std::string("ada")}, {"age", 36.0}}},
+            {"u2", AnyObject{{"name", std::string("bob")}}},
+        });
+        state.setAtomValue("a", value);
+
+        // A no-op edit, then real ones reaching into still-plain objects
+        state.setIn("a", {"users", "u2", "name"}, wrap(std::string("bob")));
+        state.setIn("a", {"users", "u1", "age"}, wrap(37.0));
+        state.setIn("a", {"users", "u3", "name"}, wrap(std::string("cy")));
+
+        CHECK(std::get<double>(leafAt({"users", "u1", "age"})) == 37);
+        CHECK(std::get<std::string>(leafAt({"users", "u1", "name"})) == "ada");
+        CHECK(std::get<std::string>(leafAt({"users", "u3", "name"})) == "cy");
+        auto users = state.getAtomValue("a")->getObject("users");
+        CHECK(users.size() == 3);
+        CHECK(std::get<std::string>(std::get<AnyObject>(users.at("u2")).at("name")) == "bob");
+    }
+}
+
+void testIncrementBigInt() {
+    HybridNitroState state;
+    auto value = AnyMap::make();
+    value->setBigInt("n", std::numeric_limits<int64_t>::max() - 1);
+    state.createAtom("a", value);
+
+    CHECK(state.increment("a", {"n"}, 1) == static_cast<double>(std::numeric_limits<int64_t>::max()));
+    CHECK_THROWS(state.increment("a", {"n"}, 1));
+    CHECK_THROWS(state.increment("a", {"n"}, -0.5));
+    CHECK_THROWS(state.increment("a", {"n"}, std::nan("")));
+    CHECK_THROWS(state.increment("a", {"n"}, -std::numeric_limits<double>::infinity()));
+    CHECK(state.increment("a", {"n"}, -2) == static_cast<double>(std::numeric_limits<int64_t>::max() - 2));
+    CHECK(state.getAtomValue("a")->getBigInt("n") == std::numeric_limits<int64_t>::max() - 2);
+}
+
+void testSplice() {
+    HybridNitroState state;
+    auto wrap = [](AnyArray items) {
+        auto map = AnyMap::make();
+        map->setArray("value", std::move(items));
+        return map;
+    };
+    auto list = [&] {
+        auto leaf = state.getIn("a", {"list"})->getAny("value");
+        return std::get<AnyArray>(leaf);
+    };
+    state.createAtom("a", AnyMap::make());
+
+    CHECK(state.push("a", {"list"}, wrap({1.0, 2.0})) == 2);
+    CHECK(state.push("a", {"list"}, wrap({5.0})) == 3);
+    auto removed = state.splice("a", {"list"}, -2, 1, wrap({3.0, 4.0}))->getArray("value");
+    CHECK(removed.size() == 1 && std::get<double>(removed[0]) == 2);
+    auto items = list();
+    CHECK(items.size() == 4);
+    for (size_t i = 0; i < items.size(); i++) {
+        CHECK(std::get<double>(items[i]) == static_cast<double>(i == 0 ? 1 : i + 2));
+    }
+
+    // Nothing removed or inserted is not a write
+    auto version = state.getAtomVersion("a");
+    state.splice("a", {"list"}, 1, 0, wrap({}));
+    CHECK(state.getAtomVersion("a") == version);
+
+    auto object = AnyMap::make();
+    object->setAny("value", 1.0);
+    state.setIn("a", {"object", "x"}, object);
+    CHECK_THROWS(state.push("a", {"object"}, wrap({1.0})));
+    CHECK_THROWS(state.push("a", {"object", "x"}, wrap({1.0})));
+}
+
+// ----- Families -----
+
+void testFamilyEvictionKeepsPinnedMembers() {
+    HybridNitroState state;
+    state.createFamily("user", makeValue(0));
+    state.setFamilyBudget("user", 2, 0);
+
+    double retained = state.familyGet("user", "retained");
+    CHECK(state.retainAtom(retained));
+    double observed = state.familyGet("user", "observed");
+    auto unsubscribe = state.subscribeAtomByHandle(observed, [] {});
+    for (int i = 0; i < 10; i++) {
+        state.familyGet("user", "idle" + std::to_string(i));
+    }
+    CHECK(state.hasAtom("user:retained"));
+    CHECK(state.hasAtom("user:observed"));
+    CHECK(!state.hasAtom("user:idle0"));
+    CHECK(state.hasAtom("user:idle9"));
+
+    // Evictable again once nothing holds them
+    state.releaseAtom(retained);
+    unsubscribe();
+    state.familyGet("user", "late0");
+    state.familyGet("user", "late1");
+    CHECK(!state.hasAtom("user:retained"));
+    CHECK(!state.hasAtom("user:observed"));
+}
+
+// ----- Lifetime -----
+
+void testGarbageCollection() {
+    HybridNitroState state;
+    double released = state.createAtomHandle("released", makeValue(1));
+    double held = state.createAtomHandle("held", makeValue(1));
+    double observed = state.createAtomHandle("observed", makeValue(1));
+    state.createAtom("unmanaged", makeValue(1));
+    double read = state.createAtomHandle("read", makeValue(1));
+
+    for (double handle : {released, held, observed, read}) {
+        CHECK(state.retainAtom(handle));
+    }
+    state.releaseAtom(released);
+    state.releaseAtom(observed);
+    state.releaseAtom(read);
+    auto unsubscribe = state.subscribeAtomByHandle(observed, [] {});
+    state.createComputed("sum", {"read"}, [](double) {
+        return Promise<std::shared_ptr<AnyMap>>::resolved(makeValue(0));
+    });
+    CHECK(state.retainComputed("sum"));
+
+    collectAll(state);
+    CHECK(!state.hasAtom("released"));
+    CHECK(!state.retainAtom(released));
+    CHECK(state.hasAtom("held"));
+    CHECK(state.hasAtom("observed"));
+    CHECK(state.hasAtom("unmanaged"));
+    CHECK(state.hasAtom("read"));
+
+    // Dropping the computed frees the atom only it was reading
+    state.releaseComputed("sum");
+    collectAll(state);
+    CHECK_THROWS(state.getComputedValue("sum"));
+    CHECK(!state.hasAtom("read"));
+    CHECK(state.hasAtom("observed"));
+    unsubscribe();
+}
+
+void testGarbageCollectionWithoutTime() {
+    HybridNitroState state;
+    std::vector<double> handles;
+    for (int i = 0; i < 500; i++) {
+        double handle = state.createAtomHandle("a" + std::to_string(i), makeValue(i));
+        CHECK(state.retainAtom(handle));
+        state.releaseAtom(handle);
+        handles.push_back(handle);
+    }
+
+    // An empty slice still sweeps a little, so enough calls reach every shard
+    for (int call = 0; call < 1000; call++) {
+        state.collectGarbage(0);
+    }
+    for (double handle : handles) {
+        CHECK(!state.retainAtom(handle));
+    }
+}
+
+// ----- Bulk Operations -----
+
+void testGetManySetMany() {
+    HybridNitroState state;
+    std::vector<std::string> keys;
+    for (int i = 0; i < 40; i++) {
+        keys.push_back("k" + std::to_string(i));
+        state.createAtom(keys.back(), makeValue(i));
+    }
+    auto values = state.getMany(keys);
+    CHECK(values.size() == keys.size());
+    CHECK(valueOf(values[0]) == 0 && valueOf(values[39]) == 39);
+    CHECK_THROWS(state.getMany({"k0", "missing"}));
+
+    int notified = 0;
+    auto unsubscribe = state.subscribeAtom("k1", [&] { notified++; });
+    state.setMany({"k1", "k2", "k1"}, {makeValue(10), makeValue(20), makeValue(11)});
+    // One batch: k1 is delivered once, with its last value in place
+    CHECK(notified == 1);
+    CHECK(valueOf(state.getAtomValue("k1")) == 11 && valueOf(state.getAtomValue("k2")) == 20);
+
+    // Every key is resolved before anything is written
+    CHECK_THROWS(state.setMany({"k1", "missing"}, {makeValue(0), makeValue(0)}));
+    CHECK_THROWS(state.setMany({"k1"}, {}));
+    CHECK(valueOf(state.getAtomValue("k1")) == 11);
+    // The batch was closed, so the next write is delivered right away
+    state.setAtomValue("k1", makeValue(12));
+    CHECK(notified == 2);
+    unsubscribe();
+}
+
+// ----- Computeds -----
+
+std::shared_ptr<ComputedCore> makeComputed(const std::string& key, std::function<double()> compute) {
+    return std::make_shared<ComputedCore>(key, [compute = std::move(compute)](ComputedCore::RunId) {
+        return Promise<std::shared_ptr<AnyMap>>::resolved(makeValue(compute()));
+    });
+}
+
+double read(AtomCore& atom) {
+    ComputedCore::track(atom);
+    return valueOf(atom.get());
+}
+
+double read(ComputedCore& computed) {
+    ComputedCore::track(computed);
+    return valueOf(computed.get());
+}
+
+void testDiamondDeepensDownstream() {
+    CommitClock clock;
+    auto source = std::make_shared<AtomCore>("source", makeValue(1));
+    auto deep = std::make_shared<AtomCore>("deep", makeValue(0));
+
+    // bottom reads left and right, which both read source; left can be
+    // switched to read it through `middle` instead
+    auto middle = makeComputed("middle", [&] { return read(*source) * 10; });
+    auto left = makeComputed("left", [&] {
+        return read(*deep) != 0 ? read(*middle) : read(*source);
+    });
+    auto right = makeComputed("right", [&] { return read(*source) + 1; });
+    int bottomRuns = 0;
+    auto bottom = makeComputed("bottom", [&] {
+        bottomRuns++;
+        return read(*left) + read(*right);
+    });
+
+    CHECK(valueOf(bottom->get()) == 3);
+    CHECK(left->height() == 1 && bottom->height() == 2);
+
+    deep->set(makeValue(1), clock);
+    ComputedCore::invalidate(deep->dependents());
+    CHECK(valueOf(bottom->get()) == 12);
+    // left got deeper; bottom has to stay below it
+    CHECK(left->height() == 2);
+    CHECK(bottom->height() == 3);
+
+    // A write to the shared source reaches bottom once, after both sides
+    source->set(makeValue(2), clock);
+    auto invalidated = ComputedCore::invalidate(source->dependents());
+    CHECK(invalidated.size() == 4 && invalidated.back() == bottom);
+    bottomRuns = 0;
+    CHECK(valueOf(bottom->get()) == 23);
+    CHECK(bottomRuns == 1);
+}
+
+void testComputedRejectsCycles() {
+    auto source = std::make_shared<AtomCore>("source", makeValue(1));
+    bool loop = false;
+    std::shared_ptr<ComputedCore> upper;
+    auto lower = makeComputed("lower", [&] { return loop ? read(*upper) : read(*source); });
+    upper = makeComputed("upper", [&] { return read(*lower) + 1; });
+    CHECK(valueOf(upper->get()) == 2);
+    CHECK_THROWS(lower->addDependency(upper));
+
+    // lower starts reading upper, which already reads lower
+    loop = true;
+    lower->markDirty();
+    upper->markDirty();
+    CHECK_THROWS(upper->get());
+    CHECK(lower->height() == 1 && upper->height() == 2);
+    loop = false;
+    CHECK(valueOf(upper->get()) == 2);
+
+    // An untracked read of itself fails instead of waiting on its own lock
+    std::shared_ptr<ComputedCore> self;
+    self = makeComputed("self", [&] { return valueOf(self->get()); });
+    CHECK_THROWS(self->get());
+}
+
+void testAsyncComputedResolves() {
+    HybridNitroState state;
+    state.createAtom("a", makeValue(1));
+    // Runs stay pending until the test settles them
+    std::vector<std::pair<std::shared_ptr<Promise<std::shared_ptr<AnyMap>>>, double>> runs;
+    state.createAsyncComputed("double", {}, [&](double) {
+        auto promise = Promise<std::shared_ptr<AnyMap>>::create();
+        runs.emplace_back(promise, valueOf(state.getAtomValue("a")) * 2);
+        return promise;
+    }, makeValue(-1));
+    int notified = 0;
+    auto unsubscribe = state.subscribeComputed("double", [&] { notified++; });
+
+    // The placeholder is served while the first run is pending, and
+    // reading again does not start another
+    CHECK(valueOf(state.getComputedValue("double")) == -1);
+    CHECK(state.isComputedPending("double"));
+    CHECK(valueOf(state.getComputedValue("double")) == -1);
+    CHECK(runs.size() == 1);
+    runs[0].first->resolve(makeValue(runs[0].second));
+    CHECK(!state.isComputedPending("double"));
+    CHECK(notified == 1);
+    CHECK(valueOf(state.getComputedValue("double")) == 2);
+
+    // A change keeps serving the last value until the recompute lands
+    state.setAtomValue("a", makeValue(5));
+    CHECK(valueOf(state.getComputedValue("double")) == 2);
+    CHECK(runs.size() == 2);
+
+    // A failed run keeps the last value and retries on the next read
+    runs[1].first->reject(std::make_exception_ptr(std::runtime_error("offline")));
+    CHECK(!state.isComputedPending("double"));
+    CHECK(valueOf(state.getComputedValue("double")) == 2);
+    CHECK(runs.size() == 3);
+    runs[2].first->resolve(makeValue(runs[2].second));
+    CHECK(valueOf(state.getComputedValue("double")) == 10);
+    unsubscribe();
+}
+
+/**
+ * Runs posted callbacks one at a time on its own thread, the way Nitro
+ * calls JS functions on the JS thread
+ */
+class JsThread {
+public:
+    JsThread() : thread_([this] { loop(); }) {}
+    ~JsThread() {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        thread_.join();
+    }
+
+    void post(std::function<void()> job) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            jobs_.push_back(std::move(job));
+        }
+        wake_.notify_one();
+    }
+
+private:
+    void loop() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            wake_.wait(lock, [this] { return stopping_ || !jobs_.empty(); });
+            if (jobs_.empty()) return;
+            auto job = std::move(jobs_.front());
+            jobs_.pop_front();
+            lock.unlock();
+            job();
+            lock.lock();
+        }
+    }
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::deque<std::function<void()>> jobs_;
+    bool stopping_ = false;
+    std::thread thread_;
+};
+
+// Wait for an async computed's value to land
+void settle(HybridNitroState& state, const std::string& key) {
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (state.isComputedPending(key)) {
+        if (std::chrono::steady_clock::now() > deadline) throw Failure(key + " never settled");
+        std::this_thread::yield();
+    }
+}
+
+void testComputedTracksReportedReads() {
+    HybridNitroState state;
+    JsThread js;
+    state.createAtom("flag", makeValue(0));
+    state.createAtom("a", makeValue(1));
+    state.createAtom("b", makeValue(10));
+
+    // Called off the reading thread and resolved later, so only the reads
+    // reported with the run id can be seen
+    std::atomic<int> runs{0};
+    std::atomic<double> lastRun{0};
+    auto compute = [&](const std::string& key) {
+        return [&, key](double run) {
+            runs++;
+            lastRun = run;
+            auto promise = Promise<std::shared_ptr<AnyMap>>::create();
+            js.post([&, key, run, promise] {
+                auto get = [&](const std::string& source) {
+                    state.trackRead(key, run, source);
+                    return valueOf(state.getAtomValue(source));
+                };
+                promise->resolve(makeValue(get("flag") != 0 ? get("b") : get("a")));
+            });
+            return promise;
+        };
+    };
+
+    state.createComputed("blocking", {}, compute("blocking"));
+    CHECK(valueOf(state.getComputedValue("blocking")) == 1);
+    state.setAtomValue("a", makeValue(2));
+    CHECK(valueOf(state.getComputedValue("blocking")) == 2);
+
+    // Switching branches drops `a` once the run's value lands
+    state.setAtomValue("flag", makeValue(1));
+    CHECK(valueOf(state.getComputedValue("blocking")) == 10);
+    runs = 0;
+    state.setAtomValue("a", makeValue(3));
+    CHECK(valueOf(state.getComputedValue("blocking")) == 10);
+    CHECK(runs == 0);
+
+    // A read reported after the run finished is ignored
+    state.trackRead("blocking", lastRun, "a");
+    state.setAtomValue("a", makeValue(4));
+    CHECK(valueOf(state.getComputedValue("blocking")) == 10);
+    CHECK(runs == 0);
+    state.setAtomValue("b", makeValue(20));
+    CHECK(valueOf(state.getComputedValue("blocking")) == 20);
+    CHECK(runs == 1);
+
+    CHECK_THROWS(state.trackRead("blocking", -1, "a"));
+    CHECK_THROWS(state.trackRead("blocking", 0.5, "a"));
+    CHECK_THROWS(state.trackRead("blocking", lastRun, "missing"));
+
+    state.setAtomValue("flag", makeValue(0));
+    state.createAsyncComputed("async", {}, compute("async"), makeValue(-1));
+    CHECK(valueOf(state.getComputedValue("async")) == -1);
+    settle(state, "async");
+    CHECK(valueOf(state.getComputedValue("async")) == 4);
+    state.setAtomValue("a", makeValue(5));
+    CHECK(valueOf(state.getComputedValue("async")) == 4);
+    settle(state, "async");
+    CHECK(valueOf(state.getComputedValue("async")) == 5);
+}
+
+// ----- Selectors -----
+
+AnyObject op(const std::string& name, AnyObject fields = {}) {
+    fields["op"] = name;
+    return fields;
+}
+
+AnyObject get(const std::string& source, AnyArray path) {
+    return op("get", {{"source", source}, {"path", std::move(path)}});
+}
+
+void testSelectorEvaluation() {
+    HybridNitroState state;
+    auto user = AnyMap::make();
+    user->setString("name", "ann");
+    user->setDouble("age", 20);
+    state.createAtom("user", user);
+    auto inbox = AnyMap::make();
+    AnyArray messages;
+    for (bool read : {false, true, false}) {
+        messages.push_back(AnyObject{{"read", read}});
+    }
+    inbox->setArray("messages", messages);
+    state.createAtom("inbox", inbox);
+
+    auto spec = AnyMap::make();
+    spec->setObject("name", get("user", {std::string("name")}));
+    spec->setObject("adult", op("ge", {{"args", AnyArray{get("user", {std::string("age")}), op("const", {{"value", 18.0}})}}}));
+    spec->setObject("unread", op("length", {{"of", op("filter", {
+        {"of", get("inbox", {std::string("messages")})},
+        {"path", AnyArray{std::string("read")}},
+        {"equals", op("const", {{"value", false}})},
+    })}}));
+    spec->setObject("missing", get("user", {std::string("email")}));
+    state.createSelector("profile", spec);
+
+    auto profile = state.getComputedValue("profile");
+    CHECK(profile->getString("name") == "ann");
+    CHECK(profile->getBoolean("adult"));
+    CHECK(profile->getDouble("unread") == 2);
+    CHECK(profile->isNull("missing"));
+
+    state.setIn("user", {"age"}, makeValue(10));
+    CHECK(!state.getComputedValue("profile")->getBoolean("adult"));
+
+    auto unknown = AnyMap::make();
+    unknown->setObject("x", op("pow"));
+    CHECK_THROWS(state.createSelector("bad", unknown));
+    auto orphan = AnyMap::make();
+    orphan->setObject("x", get("nobody", {}));
+    CHECK_THROWS(state.createSelector("orphan", orphan));
+}
+
+// ----- Scheduling -----
+
+void testSchedulerStoppedFromItsTimer() {
+    std::atomic<bool> stopped{false};
+    {
+        HybridNitroState state;
+        state.createAtom("a", makeValue(1));
+        auto unsubscribe = state.subscribeAtom("a", [&] {
+            // Called on the timer thread
+            state.stopScheduler();
+            stopped = true;
+        });
+        state.startScheduler(1);
+        state.setAtomValue("a", makeValue(2));
+        while (!stopped) {
+            std::this_thread::yield();
+        }
+        unsubscribe();
+    }
+    // The state joined the timer thread on the way out instead of leaving
+    // it running against freed memory
+    CHECK(stopped);
+}
+
+struct Test {
+    const char* name;
+    void (*run)();
+};
+
+const Test kTests[] = {
+    {"equality/no-op-writes", testEqualitySuppressesNoOpWrites},
+    {"batch/dedupe-and-order", testBatchDedupesAndFlushesInWriteOrder},
+    {"clock/out-of-order", testCommitClockCompletesOutOfOrder},
+    {"cas/results-and-retries", testCompareAndSet},
+    {"transaction/reads-snapshot", testTransactionReadsSnapshot},
+    {"transaction/commit-and-abort", testTransactionCommitAndAbort},
+    {"transaction/write-conflict", testTransactionWriteConflict},
+    {"transaction/write-to-deleted-atom", testTransactionWriteToDeletedAtom},
+    {"batch/per-thread", testBatchBelongsToItsThread},
+    {"snapshot/pin-and-prune", testSnapshotPinAndPrune},
+    {"snapshot/reads", testSnapshotReads},
+    {"wal/torn-tail", testLogReplaysPastTornTail},
+    {"wal/compaction", testLogCompaction},
+    {"codec/round-trip", testCodecRoundTrip},
+    {"codec/corrupt-input", testCodecRejectsCorruptInput},
+    {"codec/interning", testCodecInternsStrings},
+    {"codec/export-import", testExportImport},
+    {"hamt/set-in-get-in", testPersistentMapSetInGetIn},
+    {"path/subscriptions", testPathSubscriptions},
+    {"patch/set-in-after-set", testSetInAfterSet},
+    {"patch/increment-bigint", testIncrementBigInt},
+    {"patch/splice", testSplice},
+    {"family/eviction-keeps-pinned", testFamilyEvictionKeepsPinnedMembers},
+    {"gc/sweep", testGarbageCollection},
+    {"gc/zero-slice", testGarbageCollectionWithoutTime},
+    {"bulk/get-many-set-many", testGetManySetMany},
+    {"computed/diamond-deepens", testDiamondDeepensDownstream},
+    {"computed/cycles", testComputedRejectsCycles},
+    {"computed/async-resolves", testAsyncComputedResolves},
+    {"computed/reported-reads", testComputedTracksReportedReads},
+    {"selector/evaluation", testSelectorEvaluation},
+    {"scheduler/stopped-from-timer", testSchedulerStoppedFromItsTimer},
+};
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string filter = argc > 1 ? argv[1] : "";
+    int failed = 0;
+    for (const auto& test : kTests) {
+        if (std::string(test.name).find(filter) == std::string::npos) continue;
+        try {
+            test.run();
+            std::printf("ok    %s\n", test.name);
+        } catch (const std::exception& error) {
+            std::printf("FAIL  %s: %s\n", test.name, error.what());
+            failed++;
+        }
+    }
+    return failed == 0 ? 0 : 1;
+}
@@ -0,0 +1,14 @@
+// Mirrors the EqualityMode enum Nitrogen generates from
+// src/specs/NitroState.nitro.ts. Only used by the Linux benchmark build.
+#pragma once
+
+namespace margelo::nitro::nitrostate {
+
+enum class EqualityMode {
+    IDENTITY,
+    SHALLOW,
+    DEEP,
+    HASH,
+};
+
+} // namespace margelo::nitro::nitrostate
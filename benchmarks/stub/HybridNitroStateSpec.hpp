@@ -0,0 +1,124 @@
+// Hand-written mirror of the HybridNitroStateSpec that Nitrogen generates
+// from src/specs/NitroState.nitro.ts. Keep it in sync with the spec; the
+// benchmark build fails to compile when an override is missing here.
+#pragma once
+
+#include <NitroModules/AnyMap.hpp>
+#include <NitroModules/ArrayBuffer.hpp>
+#include <NitroModules/HybridObject.hpp>
+#include <NitroModules/Promise.hpp>
+#include <functional>
+#include <memory>
+#include <string>
+#include <vector>
+#include "EqualityMode.hpp"
+
+namespace margelo::nitro::nitrostate {
+
+using namespace margelo::nitro;
+
+class HybridNitroStateSpec : public virtual HybridObject {
+public:
+    static constexpr auto TAG = "NitroState";
+
+    HybridNitroStateSpec() : HybridObject(TAG) {}
+    ~HybridNitroStateSpec() override = default;
+
+    using ComputeFn = std::function<std::shared_ptr<Promise<std::shared_ptr<AnyMap>>>(double /* run */)>;
+
+    // Atom Operations
+    virtual void createAtom(const std::string& key, const std::shared_ptr<AnyMap>& initialValue) = 0;
+    virtual double createAtomHandle(const std::string& key, const std::shared_ptr<AnyMap>& initialValue) = 0;
+    virtual double getAtomHandle(const std::string& key) = 0;
+    virtual std::shared_ptr<AnyMap> getAtomValue(const std::string& key) = 0;
+    virtual void setAtomValue(const std::string& key, const std::shared_ptr<AnyMap>& value) = 0;
+    virtual std::function<void()> subscribeAtom(const std::string& key, const std::function<void()>& callback) = 0;
+    virtual void deleteAtom(const std::string& key) = 0;
+    virtual void setAtomEquality(const std::string& key, EqualityMode mode) = 0;
+
+    // Bulk Operations
+    virtual std::vector<std::shared_ptr<AnyMap>> getMany(const std::vector<std::string>& keys) = 0;
+    virtual void setMany(const std::vector<std::string>& keys, const std::vector<std::shared_ptr<AnyMap>>& values) = 0;
+
+    // Handle-based Atom Operations
+    virtual std::shared_ptr<AnyMap> getAtomValueByHandle(double handle) = 0;
+    virtual void setAtomValueByHandle(double handle, const std::shared_ptr<AnyMap>& value) = 0;
+    virtual std::function<void()> subscribeAtomByHandle(double handle, const std::function<void()>& callback) = 0;
+
+    // Nested Values
+    virtual void setIn(const std::string& key, const std::vector<std::string>& path, const std::shared_ptr<AnyMap>& value) = 0;
+    virtual std::shared_ptr<AnyMap> getIn(const std::string& key, const std::vector<std::string>& path) = 0;
+    virtual std::function<void()> subscribePath(const std::string& key, const std::vector<std::string>& path, const std::function<void()>& callback) = 0;
+
+    // Patches
+    virtual void mergeAtom(const std::string& key, const std::shared_ptr<AnyMap>& partial) = 0;
+    virtual double increment(const std::string& key, const std::vector<std::string>& path, double delta) = 0;
+    virtual double push(const std::string& key, const std::vector<std::string>& path, const std::shared_ptr<AnyMap>& items) = 0;
+    virtual std::shared_ptr<AnyMap> splice(const std::string& key, const std::vector<std::string>& path, double start, double deleteCount, const std::shared_ptr<AnyMap>& items) = 0;
+
+    // Versions
+    virtual bool compareAndSet(const std::string& key, double expectedVersion, const std::shared_ptr<AnyMap>& value) = 0;
+    virtual bool compareAndSetByHandle(double handle, double expectedVersion, const std::shared_ptr<AnyMap>& value) = 0;
+    virtual double getAtomVersion(const std::string& key) = 0;
+    virtual double getAtomVersionByHandle(double handle) = 0;
+    virtual double getCommitVersion() = 0;
+    virtual std::vector<std::string> getChangedSince(double version) = 0;
+
+    // Computed Operations
+    virtual void createComputed(const std::string& key, const std::vector<std::string>& dependencies, const ComputeFn& compute) = 0;
+    virtual void createAsyncComputed(const std::string& key, const std::vector<std::string>& dependencies, const ComputeFn& compute, const std::shared_ptr<AnyMap>& placeholder) = 0;
+    virtual void createSelector(const std::string& key, const std::shared_ptr<AnyMap>& spec) = 0;
+    virtual void trackRead(const std::string& computed, double run, const std::string& key) = 0;
+    virtual std::shared_ptr<AnyMap> getComputedValue(const std::string& key) = 0;
+    virtual bool isComputedPending(const std::string& key) = 0;
+    virtual std::function<void()> subscribeComputed(const std::string& key, const std::function<void()>& callback) = 0;
+    virtual void deleteComputed(const std::string& key) = 0;
+
+    // Batch Operations
+    virtual void startBatch() = 0;
+    virtual void endBatch() = 0;
+
+    // Persistence
+    virtual std::vector<std::string> openStore(const std::string& path) = 0;
+    virtual void persistAtom(const std::string& key) = 0;
+    virtual void saveStore() = 0;
+
+    // Families
+    virtual void createFamily(const std::string& name, const std::shared_ptr<AnyMap>& defaultValue) = 0;
+    virtual double familyGet(const std::string& name, const std::string& param) = 0;
+    virtual void setFamilyBudget(const std::string& name, double maxMembers, double maxBytes) = 0;
+
+    // Serialization
+    virtual std::shared_ptr<ArrayBuffer> exportAtom(const std::string& key) = 0;
+    virtual void importAtom(const std::string& key, const std::shared_ptr<ArrayBuffer>& data) = 0;
+
+    // Lifetime
+    virtual bool retainAtom(double handle) = 0;
+    virtual void releaseAtom(double handle) = 0;
+    virtual bool retainComputed(const std::string& key) = 0;
+    virtual void releaseComputed(const std::string& key) = 0;
+    virtual double collectGarbage(double sliceMs) = 0;
+
+    // Snapshots
+    virtual double acquireSnapshot() = 0;
+    virtual std::shared_ptr<AnyMap> getAtomValueAt(double snapshot, const std::string& key) = 0;
+    virtual void releaseSnapshot(double snapshot) = 0;
+
+    // Transactions
+    virtual double beginTransaction() = 0;
+    virtual std::shared_ptr<AnyMap> transactionGet(double transaction, const std::string& key) = 0;
+    virtual void transactionSet(double transaction, const std::string& key, const std::shared_ptr<AnyMap>& value) = 0;
+    virtual bool commitTransaction(double transaction) = 0;
+    virtual void abortTransaction(double transaction) = 0;
+
+    // Scheduling
+    virtual void startScheduler(double intervalMs) = 0;
+    virtual void stopScheduler() = 0;
+    virtual void flush() = 0;
+
+    // Utility
+    virtual bool hasAtom(const std::string& key) = 0;
+    virtual std::vector<std::string> getAtomKeys() = 0;
+};
+
+} // namespace margelo::nitro::nitrostate
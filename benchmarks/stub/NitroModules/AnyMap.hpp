@@ -0,0 +1,82 @@
+// Minimal stand-in for react-native-nitro-modules' AnyMap, covering the
+// subset used by cpp/. Only used by the Linux benchmark build.
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <variant>
+#include <vector>
+
+namespace margelo::nitro {
+
+struct NullType {};
+inline bool operator==(NullType, NullType) { return true; }
+
+struct AnyValue;
+using AnyArray = std::vector<AnyValue>;
+using AnyObject = std::unordered_map<std::string, AnyValue>;
+using VariantType = std::variant<NullType, bool, double, int64_t, std::string, AnyArray, AnyObject>;
+
+struct AnyValue : VariantType {
+    using VariantType::variant;
+    AnyValue(const VariantType& value) : VariantType(value) {}
+    AnyValue(VariantType&& value) : VariantType(std::move(value)) {}
+};
+
+class AnyMap final {
+public:
+    AnyMap() = default;
+    explicit AnyMap(size_t size) { map_.reserve(size); }
+
+    static std::shared_ptr<AnyMap> make() { return std::make_shared<AnyMap>(); }
+    static std::shared_ptr<AnyMap> make(size_t size) { return std::make_shared<AnyMap>(size); }
+
+    bool contains(const std::string& key) const { return map_.count(key) > 0; }
+    void remove(const std::string& key) { map_.erase(key); }
+    void clear() noexcept { map_.clear(); }
+    std::vector<std::string> getAllKeys() const {
+        std::vector<std::string> keys;
+        keys.reserve(map_.size());
+        for (const auto& [key, _] : map_) keys.push_back(key);
+        return keys;
+    }
+
+    bool isNull(const std::string& key) const { return std::holds_alternative<NullType>(map_.at(key)); }
+    bool isDouble(const std::string& key) const { return std::holds_alternative<double>(map_.at(key)); }
+    bool isBoolean(const std::string& key) const { return std::holds_alternative<bool>(map_.at(key)); }
+    bool isBigInt(const std::string& key) const { return std::holds_alternative<int64_t>(map_.at(key)); }
+    bool isString(const std::string& key) const { return std::holds_alternative<std::string>(map_.at(key)); }
+    bool isArray(const std::string& key) const { return std::holds_alternative<AnyArray>(map_.at(key)); }
+    bool isObject(const std::string& key) const { return std::holds_alternative<AnyObject>(map_.at(key)); }
+
+    double getDouble(const std::string& key) const { return std::get<double>(map_.at(key)); }
+    bool getBoolean(const std::string& key) const { return std::get<bool>(map_.at(key)); }
+    int64_t getBigInt(const std::string& key) const { return std::get<int64_t>(map_.at(key)); }
+    std::string getString(const std::string& key) const { return std::get<std::string>(map_.at(key)); }
+    AnyArray getArray(const std::string& key) const { return std::get<AnyArray>(map_.at(key)); }
+    AnyObject getObject(const std::string& key) const { return std::get<AnyObject>(map_.at(key)); }
+    AnyValue getAny(const std::string& key) const { return map_.at(key); }
+
+    void setNull(const std::string& key) { map_[key] = NullType(); }
+    void setDouble(const std::string& key, double value) { map_[key] = value; }
+    void setBoolean(const std::string& key, bool value) { map_[key] = value; }
+    void setBigInt(const std::string& key, int64_t value) { map_[key] = value; }
+    void setString(const std::string& key, const std::string& value) { map_[key] = value; }
+    void setArray(const std::string& key, const AnyArray& value) { map_[key] = value; }
+    void setObject(const std::string& key, const AnyObject& value) { map_[key] = value; }
+    void setAny(const std::string& key, const AnyValue& value) { map_[key] = value; }
+
+    std::unordered_map<std::string, AnyValue>& getMap() { return map_; }
+    const std::unordered_map<std::string, AnyValue>& getMap() const { return map_; }
+
+    void merge(const std::shared_ptr<AnyMap>& other) {
+        for (const auto& [key, value] : other->map_) map_[key] = value;
+    }
+
+private:
+    std::unordered_map<std::string, AnyValue> map_;
+};
+
+} // namespace margelo::nitro
@@ -0,0 +1,31 @@
+// Minimal stand-in for react-native-nitro-modules' ArrayBuffer, covering
+// the subset used by cpp/. Only used by the Linux benchmark build.
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace margelo::nitro {
+
+class ArrayBuffer final {
+public:
+    static std::shared_ptr<ArrayBuffer> move(std::vector<uint8_t>&& data) {
+        return std::shared_ptr<ArrayBuffer>(new ArrayBuffer(std::move(data)));
+    }
+
+    static std::shared_ptr<ArrayBuffer> copy(const uint8_t* data, size_t size) {
+        return move(std::vector<uint8_t>(data, data + size));
+    }
+
+    uint8_t* data() { return data_.data(); }
+    size_t size() const { return data_.size(); }
+
+private:
+    explicit ArrayBuffer(std::vector<uint8_t>&& data) : data_(std::move(data)) {}
+
+    std::vector<uint8_t> data_;
+};
+
+} // namespace margelo::nitro
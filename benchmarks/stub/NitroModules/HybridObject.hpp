@@ -0,0 +1,18 @@
+// Minimal stand-in for react-native-nitro-modules' HybridObject.
+// Only used by the Linux benchmark build.
+#pragma once
+
+#include <memory>
+
+namespace margelo::nitro {
+
+class HybridObject : public std::enable_shared_from_this<HybridObject> {
+public:
+    explicit HybridObject(const char* name) : name_(name) {}
+    virtual ~HybridObject() = default;
+
+protected:
+    const char* name_;
+};
+
+} // namespace margelo::nitro
@@ -0,0 +1,109 @@
+// Minimal stand-in for react-native-nitro-modules' Promise<T>, covering
+// the subset used by cpp/. Only used by the Linux benchmark build.
+#pragma once
+
+#include <exception>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+namespace margelo::nitro {
+
+template <typename T>
+class Promise final {
+public:
+    using OnResolvedFunc = std::function<void(const T&)>;
+    using OnRejectedFunc = std::function<void(const std::exception_ptr&)>;
+
+    static std::shared_ptr<Promise> create() { return std::shared_ptr<Promise>(new Promise()); }
+
+    static std::shared_ptr<Promise> resolved(T&& value) {
+        auto promise = create();
+        promise->resolve(std::move(value));
+        return promise;
+    }
+
+    static std::shared_ptr<Promise> rejected(const std::exception_ptr& error) {
+        auto promise = create();
+        promise->reject(error);
+        return promise;
+    }
+
+    void resolve(const T& value) {
+        std::vector<OnResolvedFunc> listeners;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            result_ = value;
+            listeners = resolvedListeners_;
+        }
+        for (const auto& listener : listeners) listener(value);
+    }
+
+    void reject(const std::exception_ptr& error) {
+        std::vector<OnRejectedFunc> listeners;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            error_ = error;
+            listeners = rejectedListeners_;
+        }
+        for (const auto& listener : listeners) listener(error);
+    }
+
+    void addOnResolvedListener(OnResolvedFunc listener) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (result_) {
+            auto value = *result_;
+            lock.unlock();
+            listener(value);
+        } else {
+            resolvedListeners_.push_back(std::move(listener));
+        }
+    }
+
+    void addOnRejectedListener(OnRejectedFunc listener) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (error_) {
+            auto error = error_;
+            lock.unlock();
+            listener(error);
+        } else {
+            rejectedListeners_.push_back(std::move(listener));
+        }
+    }
+
+    std::future<T> await() {
+        auto promise = std::make_shared<std::promise<T>>();
+        addOnResolvedListener([promise](const T& value) { promise->set_value(value); });
+        addOnRejectedListener([promise](const std::exception_ptr& error) { promise->set_exception(error); });
+        return promise->get_future();
+    }
+
+    bool isResolved() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return result_.has_value();
+    }
+
+    bool isRejected() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return error_ != nullptr;
+    }
+
+    bool isPending() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return !result_ && !error_;
+    }
+
+private:
+    Promise() = default;
+
+    std::mutex mutex_;
+    std::optional<T> result_;
+    std::exception_ptr error_;
+    std::vector<OnResolvedFunc> resolvedListeners_;
+    std::vector<OnRejectedFunc> rejectedListeners_;
+};
+
+} // namespace margelo::nitro
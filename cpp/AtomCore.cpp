@@ -1,35 +1,444 @@
 #include "AtomCore.hpp"
+#include "EpochManager.hpp"
+#include "ValueCodec.hpp"
+#include "ValueEquality.hpp"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
 
-namespace nitrostate {
+namespace margelo::nitro::nitrostate {
 
-AtomCore::AtomCore(jsi::Runtime& rt, const jsi::Value& initialValue)
-    : value_(std::make_shared<jsi::Value>(rt, initialValue)) {}
+namespace {
 
-jsi::Value AtomCore::get(jsi::Runtime& rt) const {
-    std::lock_guard<std::mutex> lock(mutex_);
-    if (value_) {
-        // Deep copy the value for safe return
-        if (value_->isUndefined()) return jsi::Value::undefined();
-        if (value_->isNull()) return jsi::Value::null();
-        if (value_->isBool()) return jsi::Value(value_->getBool());
-        if (value_->isNumber()) return jsi::Value(value_->getNumber());
-        if (value_->isString()) return jsi::Value(rt, value_->getString(rt));
-        if (value_->isObject()) {
-            // For objects/arrays, we need to return the same reference
-            return jsi::Value(rt, value_->getObject(rt));
+// Rough heap usage of a value: node sizes plus string storage
+size_t approximateSize(const AnyValue& value);
+
+size_t approximateSize(const AnyObject& object) {
+    // Hash nodes carry a key, a value and a couple of pointers
+    size_t size = object.bucket_count() * sizeof(void*);
+    for (const auto& [key, value] : object) {
+        size += 2 * sizeof(void*) + sizeof(std::string) + key.capacity() + approximateSize(value);
+    }
+    return size;
+}
+
+size_t approximateSize(const AnyValue& value) {
+    size_t size = sizeof(AnyValue);
+    if (const auto* string = std::get_if<std::string>(&value)) {
+        size += string->capacity();
+    } else if (const auto* array = std::get_if<AnyArray>(&value)) {
+        size += (array->capacity() - array->size()) * sizeof(AnyValue);
+        for (const auto& item : *array) {
+            size += approximateSize(item);
         }
+    } else if (const auto* object = std::get_if<AnyObject>(&value)) {
+        size += approximateSize(*object);
+    }
+    return size;
+}
+
+} // namespace
+
+AtomCore::AtomCore(std::string key, const std::shared_ptr<AnyMap>& initialValue)
+    : key_(std::move(key)), value_(new Value(initialValue)) {}
+
+AtomCore::AtomCore(std::string key, StoredValue storedValue)
+    : key_(std::move(key)), value_(new Value(std::move(storedValue))) {}
+
+AtomCore::~AtomCore() {
+    // The last owner only goes away once no reader can reach this atom
+    const Value* value = value_.load(std::memory_order_relaxed);
+    while (value != nullptr) {
+        const Value* older = value->previous.load(std::memory_order_relaxed);
+        delete value;
+        value = older;
+    }
+}
+
+std::shared_ptr<AnyMap> AtomCore::get() const {
+    EpochManager::Guard guard;
+    return value_.load(std::memory_order_acquire)->materialize();
+}
+
+const std::shared_ptr<AnyMap>& AtomCore::Value::materialize() const {
+    if (tree) {
+        std::call_once(materialized, [this] {
+            auto plain = AnyMap::make(tree->size());
+            plain->getMap() = tree->toObject();
+            map = std::move(plain);
+        });
+    } else if (stored) {
+        std::call_once(materialized, [this] {
+            map = ValueCodec::decodeMap(stored->data, stored->size);
+            decoded.store(true, std::memory_order_release);
+        });
     }
-    return jsi::Value::undefined();
+    return map;
+}
+
+const AtomCore::Value* AtomCore::publishLocked(Value* next, uint64_t commit, const CommitClock& clock) {
+    next->commit = commit;
+    const Value* previous = value_.load(std::memory_order_relaxed);
+    const Value* retired = previous;
+    if (clock.hasPins()) {
+        // A snapshot may read the superseded value; keep it reachable
+        next->previous.store(previous, std::memory_order_relaxed);
+        historyLength_.fetch_add(1, std::memory_order_relaxed);
+        retired = nullptr;
+    } else {
+        historyLength_.store(0, std::memory_order_relaxed);
+    }
+
+    value_.store(next, std::memory_order_release);
+    version_.fetch_add(1, std::memory_order_release);
+    commitVersion_.store(commit, std::memory_order_release);
+    dirty_.store(true, std::memory_order_release);
+    return retired;
 }
 
-void AtomCore::set(jsi::Runtime& rt, const jsi::Value& value) {
+void AtomCore::retireChain(const Value* value) {
+    while (value != nullptr) {
+        const Value* older = value->previous.load(std::memory_order_relaxed);
+        EpochManager::instance().retire(value);
+        value = older;
+    }
+}
+
+const AtomCore::Value* AtomCore::valueAt(uint64_t version) const {
+    const Value* value = value_.load(std::memory_order_acquire);
+    while (value != nullptr && value->commit > version) {
+        value = value->previous.load(std::memory_order_acquire);
+    }
+    return value;
+}
+
+std::shared_ptr<AnyMap> AtomCore::getAt(uint64_t version) const {
+    EpochManager::Guard guard;
+    const Value* value = valueAt(version);
+    return value != nullptr ? value->materialize() : nullptr;
+}
+
+std::optional<StoredValue> AtomCore::storedAt(uint64_t version) const {
+    EpochManager::Guard guard;
+    const Value* value = valueAt(version);
+    if (value == nullptr) return std::nullopt;
+    return value->stored;
+}
+
+void AtomCore::pruneHistory(const CommitClock& clock) {
+    std::vector<const Value*> dropped;
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        value_ = std::make_shared<jsi::Value>(rt, value);
-        dirty_ = true;
+        // Read under the lock: a snapshot pinned from here on sees the
+        // current value, which is always kept
+        auto pins = clock.pinnedVersions();
+        auto pin = pins.rbegin();
+
+        // Keep the current value plus, for every pin, the newest value at
+        // or before it. Chains and pins are both walked newest first.
+        const Value* kept = value_.load(std::memory_order_relaxed);
+        const Value* older = kept->previous.load(std::memory_order_relaxed);
+        size_t length = 0;
+        while (older != nullptr) {
+            const Value* next = older->previous.load(std::memory_order_relaxed);
+            while (pin != pins.rend() && *pin >= kept->commit) ++pin;
+            if (pin != pins.rend() && older->commit <= *pin) {
+                kept->previous.store(older, std::memory_order_release);
+                kept = older;
+                ++length;
+            } else {
+                dropped.push_back(older);
+            }
+            older = next;
+        }
+        kept->previous.store(nullptr, std::memory_order_release);
+        historyLength_.store(length, std::memory_order_relaxed);
+    }
+    // Unlinked, but readers may still be walking through them
+    for (const Value* value : dropped) {
+        EpochManager::instance().retire(value);
     }
-    // Notify outside lock to prevent deadlocks
-    notify();
+}
+
+void AtomCore::trimHistory(const CommitClock& clock) {
+    if (historyLength() > kHistoryLimit) {
+        pruneHistory(clock);
+    }
+}
+
+bool AtomCore::acceptsLocked(const std::shared_ptr<AnyMap>& value) {
+    const Value* currentValue = value_.load(std::memory_order_relaxed);
+
+    if (equalityMode_ == EqualityMode::HASH) {
+        const auto& current = currentValue->materialize();
+        if (!fingerprintValid_) {
+            fingerprint_ = current ? ValueEquality::fingerprint(*current) : 0;
+        }
+        uint64_t fingerprint = value ? ValueEquality::fingerprint(*value) : 0;
+        if (current && value && fingerprint == fingerprint_) {
+            return false;
+        }
+        fingerprint_ = fingerprint;
+        fingerprintValid_ = true;
+    } else if (equalityMode_ != EqualityMode::IDENTITY &&
+               ValueEquality::equals(equalityMode_, currentValue->materialize(), value)) {
+        return false;
+    }
+    return true;
+}
+
+void AtomCore::commitLocked(const std::shared_ptr<AnyMap>& value, uint64_t commit, CommitClock& clock) {
+    if (footprintTotal_ != nullptr) {
+        resizeFootprintLocked(footprint_, value ? sizeof(AnyMap) + approximateSize(value->getMap()) : 0);
+    }
+    retireChain(publishLocked(new Value(value), commit, clock));
+}
+
+bool AtomCore::setLocked(
+    const std::shared_ptr<AnyMap>& value,
+    CommitClock& clock,
+    const Value*& previous,
+    uint64_t& commit
+) {
+    if (!acceptsLocked(value)) {
+        return false;
+    }
+    if (footprintTotal_ != nullptr) {
+        // A whole new value; measuring it costs no more than building it did
+        resizeFootprintLocked(footprint_, value ? sizeof(AnyMap) + approximateSize(value->getMap()) : 0);
+    }
+    commit = clock.begin();
+    previous = publishLocked(new Value(value), commit, clock);
+    return true;
+}
+
+bool AtomCore::set(const std::shared_ptr<AnyMap>& value, CommitClock& clock) {
+    const Value* previous;
+    uint64_t commit;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!setLocked(value, clock, previous, commit)) {
+            return false;
+        }
+    }
+    clock.complete(commit);
+    retireChain(previous);
+    trimHistory(clock);
+    return true;
+}
+
+AtomCore::CompareResult AtomCore::compareAndSet(
+    uint64_t expectedVersion,
+    const std::shared_ptr<AnyMap>& value,
+    CommitClock& clock
+) {
+    const Value* previous;
+    uint64_t commit;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (commitVersion_.load(std::memory_order_relaxed) != expectedVersion) {
+            return CompareResult::CONFLICT;
+        }
+        if (!setLocked(value, clock, previous, commit)) {
+            return CompareResult::UNCHANGED;
+        }
+    }
+    clock.complete(commit);
+    retireChain(previous);
+    trimHistory(clock);
+    return CompareResult::WRITTEN;
+}
+
+bool AtomCore::modify(const Edit& edit, CommitClock& clock) {
+    const Value* previous;
+    uint64_t commit;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        const Value* currentValue = value_.load(std::memory_order_relaxed);
+
+        PersistentMap root;
+        if (currentValue->tree) {
+            root = *currentValue->tree;
+        } else {
+            if (!currentValue->converted) {
+                const auto& map = currentValue->materialize();
+                currentValue->converted = map ? PersistentMap::fromObject(map->getMap()) : PersistentMap();
+            }
+            root = *currentValue->converted;
+        }
+
+        if (!edit(root)) {
+            return false;
+        }
+
+        auto* next = new Value(std::move(root));
+        commit = clock.begin();
+        previous = publishLocked(next, commit, clock);
+        fingerprintValid_ = false;
+    }
+    clock.complete(commit);
+    retireChain(previous);
+    trimHistory(clock);
+    return true;
+}
+
+bool AtomCore::changesLocked(const PersistentMap& root, const std::vector<std::string>& path, const AnyValue& value) const {
+    // Only the touched path is compared, so every mode but identity
+    // compares structurally here
+    if (equalityMode_ == EqualityMode::IDENTITY) return true;
+    auto existing = PersistentMap::getIn(root, path);
+    return !existing || !ValueEquality::deepEqual(*existing, value);
+}
+
+bool AtomCore::setIn(const std::vector<std::string>& path, const AnyValue& value, CommitClock& clock) {
+    if (path.empty() && !std::holds_alternative<AnyObject>(value)) {
+        throw std::runtime_error("Atom '" + key_ + "': setIn with an empty path needs an object value");
+    }
+
+    return modify([&](PersistentMap& root) {
+        if (!changesLocked(root, path, value)) return false;
+        replaceFootprintLocked(root, path, value);
+        root = std::get<PersistentMap>(PersistentMap::setIn(root, path, value));
+        return true;
+    }, clock);
+}
+
+bool AtomCore::merge(const AnyMap& partial, CommitClock& clock) {
+    return modify([&](PersistentMap& root) {
+        bool changed = false;
+        for (const auto& [key, value] : partial.getMap()) {
+            if (!changesLocked(root, {key}, value)) continue;
+            replaceFootprintLocked(root, {key}, value);
+            root = root.set(key, PersistentMap::fromAny(value));
+            changed = true;
+        }
+        return changed;
+    }, clock);
+}
+
+bool AtomCore::increment(const std::vector<std::string>& path, double delta, CommitClock& clock, double& result) {
+    if (path.empty()) {
+        throw std::runtime_error("Atom '" + key_ + "': increment needs a path to a number");
+    }
+
+    return modify([&](PersistentMap& root) {
+        auto current = PersistentMap::getIn(root, path);
+        if (current && delta == 0) {
+            if (const auto* number = std::get_if<double>(&*current)) {
+                result = *number;
+                return false;
+            }
+        }
+
+        if (!current || std::holds_alternative<NullType>(*current)) {
+            result = delta;
+            if (footprintTotal_ != nullptr) {
+                resizeFootprintLocked(current ? approximateSize(*current) : 0, approximateSize(AnyValue(result)));
+            }
+            root = std::get<PersistentMap>(PersistentMap::setIn(root, path, AnyValue(result)));
+        } else if (const auto* number = std::get_if<double>(&*current)) {
+            result = *number + delta;
+            root = std::get<PersistentMap>(PersistentMap::setIn(root, path, AnyValue(result)));
+        } else if (const auto* bigint = std::get_if<int64_t>(&*current)) {
+            // -2^63 is exact as a double, 2^63 is already out of range
+            if (std::trunc(delta) != delta || delta < -9223372036854775808.0 || delta >= 9223372036854775808.0) {
+                throw std::runtime_error("Atom '" + key_ + "': a bigint can only be incremented by an integer");
+            }
+            int64_t sum;
+            if (__builtin_add_overflow(*bigint, static_cast<int64_t>(delta), &sum)) {
+                throw std::runtime_error("Atom '" + key_ + "': increment overflows the bigint");
+            }
+            result = static_cast<double>(sum);
+            root = std::get<PersistentMap>(PersistentMap::setIn(root, path, AnyValue(sum)));
+        } else {
+            throw std::runtime_error("Atom '" + key_ + "': increment target is not a number");
+        }
+        return true;
+    }, clock);
+}
+
+bool AtomCore::splice(
+    const std::vector<std::string>& path,
+    double start,
+    double deleteCount,
+    const AnyArray& items,
+    CommitClock& clock,
+    AnyArray& removed,
+    size_t& length
+) {
+    if (path.empty()) {
+        throw std::runtime_error("Atom '" + key_ + "': splice needs a path to an array");
+    }
+
+    return modify([&](PersistentMap& root) {
+        static const AnyArray kEmpty;
+        const AnyArray* existing = &kEmpty;
+        if (const auto* current = PersistentMap::findPlainIn(root, path)) {
+            if (!std::holds_alternative<NullType>(*current)) {
+                existing = std::get_if<AnyArray>(current);
+            }
+        } else if (PersistentMap::getIn(root, path)) {
+            existing = nullptr; // An object edited through setIn()
+        }
+        if (existing == nullptr) {
+            throw std::runtime_error("Atom '" + key_ + "': splice target is not an array");
+        }
+
+        // Same clamping as Array.prototype.splice
+        auto toInteger = [](double n) { return std::isnan(n) ? 0.0 : std::trunc(n); };
+        start = toInteger(start);
+        deleteCount = toInteger(deleteCount);
+        auto size = static_cast<double>(existing->size());
+        double from = start < 0 ? std::max(size + start, 0.0) : std::min(start, size);
+        double count = std::min(std::max(deleteCount, 0.0), size - from);
+        auto first = existing->begin() + static_cast<ptrdiff_t>(from);
+        auto last = first + static_cast<ptrdiff_t>(count);
+
+        removed.assign(first, last);
+        length = existing->size() - removed.size() + items.size();
+        if (removed.empty() && items.empty()) return false;
+
+        // The one O(length) copy, built in place; older versions keep the original
+        AnyArray array;
+        array.reserve(length);
+        array.insert(array.end(), existing->begin(), first);
+        array.insert(array.end(), items.begin(), items.end());
+        array.insert(array.end(), last, existing->end());
+
+        if (footprintTotal_ != nullptr) {
+            // Only the items that went and came change; the rest is shared
+            size_t before = 0;
+            size_t after = 0;
+            for (const auto& item : removed) before += approximateSize(item);
+            for (const auto& item : items) after += approximateSize(item);
+            resizeFootprintLocked(before, after);
+        }
+        root = std::get<PersistentMap>(PersistentMap::setIn(root, path, std::move(array)));
+        return true;
+    }, clock);
+}
+
+std::optional<AnyValue> AtomCore::getIn(const std::vector<std::string>& path) const {
+    EpochManager::Guard guard;
+    const Value* current = value_.load(std::memory_order_acquire);
+    if (current->tree) {
+        return PersistentMap::getIn(*current->tree, path);
+    }
+    if (current->stored && !current->decoded.load(std::memory_order_acquire)) {
+        // Not read whole yet: decode just the requested part
+        return ValueCodec::decodeIn(current->stored->data, current->stored->size, path);
+    }
+    const auto& map = current->materialize();
+    if (!map) {
+        return std::nullopt;
+    }
+    return PersistentMap::getIn(*map, path);
+}
+
+void AtomCore::setEqualityMode(EqualityMode mode) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    equalityMode_ = mode;
+    fingerprintValid_ = false;
 }
 
 AtomCore::SubscriberId AtomCore::subscribe(Callback callback) {
@@ -48,22 +457,142 @@ void AtomCore::unsubscribe(SubscriberId id) {
     );
 }
 
+AtomCore::SubscriberId AtomCore::subscribePath(const std::vector<std::string>& path, Callback callback) {
+    std::lock_guard<std::mutex> lock(pathsMutex_);
+    if (paths_.empty()) {
+        // Start diffing from the current value
+        EpochManager::Guard guard;
+        notifiedValue_ = snapshot();
+    }
+    return paths_.subscribe(path, std::move(callback));
+}
+
+void AtomCore::unsubscribePath(SubscriberId id) {
+    std::lock_guard<std::mutex> lock(pathsMutex_);
+    paths_.unsubscribe(id);
+    if (paths_.empty()) {
+        // Don't keep an old value alive for nobody
+        notifiedValue_ = {};
+    }
+}
+
+PathSubscriptions::Snapshot AtomCore::snapshot() const {
+    const Value* current = value_.load(std::memory_order_acquire);
+    if (current->tree) {
+        // `map` may be materializing concurrently; the tree is all we need
+        return {nullptr, current->tree};
+    }
+    return {current->materialize(), std::nullopt};
+}
+
+void AtomCore::addDependent(const std::shared_ptr<ComputedCore>& computed) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Drop computeds that were deleted since
+    dependents_.erase(
+        std::remove_if(dependents_.begin(), dependents_.end(),
+            [](const auto& dependent) { return dependent.expired(); }),
+        dependents_.end()
+    );
+    for (const auto& dependent : dependents_) {
+        if (!dependent.owner_before(computed) && !computed.owner_before(dependent)) return;
+    }
+    dependents_.push_back(computed);
+}
+
+void AtomCore::removeDependent(const ComputedCore* computed) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dependents_.erase(
+        std::remove_if(dependents_.begin(), dependents_.end(),
+            [computed](const auto& dependent) {
+                auto live = dependent.lock();
+                return !live || live.get() == computed;
+            }),
+        dependents_.end()
+    );
+}
+
+std::vector<std::shared_ptr<ComputedCore>> AtomCore::dependents() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::shared_ptr<ComputedCore>> result;
+    result.reserve(dependents_.size());
+    for (const auto& dependent : dependents_) {
+        if (auto computed = dependent.lock()) {
+            result.push_back(std::move(computed));
+        }
+    }
+    return result;
+}
+
+bool AtomCore::isObserved() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!subscribers_.empty()) return true;
+        for (const auto& dependent : dependents_) {
+            if (!dependent.expired()) return true;
+        }
+    }
+    std::lock_guard<std::mutex> lock(pathsMutex_);
+    return !paths_.empty();
+}
+
+void AtomCore::trackFootprint(std::atomic<size_t>* total) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    EpochManager::Guard guard;
+    const auto& value = value_.load(std::memory_order_relaxed)->materialize();
+    footprint_ = value ? sizeof(AnyMap) + approximateSize(value->getMap()) : 0;
+    footprintTotal_ = total;
+    total->fetch_add(footprint_, std::memory_order_relaxed);
+}
+
+void AtomCore::untrackFootprint() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (footprintTotal_ != nullptr) {
+        footprintTotal_->fetch_sub(footprint_, std::memory_order_relaxed);
+        footprintTotal_ = nullptr;
+    }
+}
+
+void AtomCore::resizeFootprintLocked(size_t before, size_t after) {
+    // Unsigned wrap-around turns shrinking into a subtraction
+    footprint_ += after - before;
+    footprintTotal_->fetch_add(after - before, std::memory_order_relaxed);
+}
+
+void AtomCore::replaceFootprintLocked(const PersistentMap& root, const std::vector<std::string>& path, const AnyValue& value) {
+    if (footprintTotal_ == nullptr) return;
+    auto existing = PersistentMap::getIn(root, path);
+    resizeFootprintLocked(existing ? approximateSize(*existing) : 0, approximateSize(value));
+}
+
 void AtomCore::notify() {
     std::vector<Callback> callbacksCopy;
     {
         std::lock_guard<std::mutex> lock(mutex_);
-        if (!dirty_) return;
-        
+        if (!dirty_.exchange(false, std::memory_order_acq_rel)) return;
+
         callbacksCopy.reserve(subscribers_.size());
         for (const auto& [_, callback] : subscribers_) {
             callbacksCopy.push_back(callback);
         }
     }
-    
+
+    {
+        std::lock_guard<std::mutex> lock(pathsMutex_);
+        if (!paths_.empty()) {
+            PathSubscriptions::Snapshot current;
+            {
+                EpochManager::Guard guard;
+                current = snapshot();
+            }
+            paths_.collectChanged(notifiedValue_, current, callbacksCopy);
+            notifiedValue_ = std::move(current);
+        }
+    }
+
     // Call subscribers outside lock
     for (const auto& callback : callbacksCopy) {
         callback();
     }
 }
 
-} // namespace nitrostate
+} // namespace margelo::nitro::nitrostate
@@ -1,44 +1,193 @@
 #pragma once
 
+#include <NitroModules/AnyMap.hpp>
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <vector>
 #include <mutex>
 #include <memory>
-#include <jsi/jsi.h>
+#include <optional>
+#include <string>
+#include "AtomStore.hpp"
+#include "CommitClock.hpp"
+#include "EqualityMode.hpp"
+#include "PathSubscriptions.hpp"
+#include "PersistentMap.hpp"
+#include "RefCount.hpp"
 
-namespace nitrostate {
+namespace margelo::nitro::nitrostate {
 
-using namespace facebook;
+using namespace margelo::nitro;
+
+class ComputedCore;
 
 /**
  * AtomCore - The fundamental reactive primitive
- * 
- * Stores a JSI value and notifies subscribers when it changes.
- * Thread-safe for concurrent access.
+ *
+ * Stores an AnyMap value and notifies subscribers when it changes.
+ * Thread-safe for concurrent access; reads are lock-free.
  */
-class AtomCore {
+class AtomCore : public std::enable_shared_from_this<AtomCore> {
 public:
     using SubscriberId = size_t;
     using Callback = std::function<void()>;
 
-    explicit AtomCore(jsi::Runtime& rt, const jsi::Value& initialValue);
-    ~AtomCore() = default;
+    enum class CompareResult {
+        // Another write landed since the expected version
+        CONFLICT,
+        // Version matched, but the equality policy judged the write a no-op
+        UNCHANGED,
+        WRITTEN,
+    };
+
+    AtomCore(std::string key, const std::shared_ptr<AnyMap>& initialValue);
 
-    // Non-copyable, movable
+    /**
+     * Create an atom whose initial value is decoded on first read
+     */
+    AtomCore(std::string key, StoredValue storedValue);
+    ~AtomCore();
+
+    // Non-copyable, non-movable (readers hold raw pointers)
     AtomCore(const AtomCore&) = delete;
     AtomCore& operator=(const AtomCore&) = delete;
-    AtomCore(AtomCore&&) = default;
-    AtomCore& operator=(AtomCore&&) = default;
 
     /**
-     * Get the current value
+     * Key the atom was registered under (debugging / getAtomKeys)
+     */
+    const std::string& key() const { return key_; }
+
+    /**
+     * Get the current value without locking
+     */
+    std::shared_ptr<AnyMap> get() const;
+
+    /**
+     * Publish a new value, stamp it with the next commit version from
+     * `clock` and mark the atom dirty.
+     * Does not notify; callers decide whether to notify now or batch.
+     * @return false if the equality policy judged the write a no-op
+     */
+    bool set(const std::shared_ptr<AnyMap>& value, CommitClock& clock);
+
+    /**
+     * set() only if the last write is still `expectedVersion`
+     * (a commitVersion() read before computing `value`)
+     */
+    CompareResult compareAndSet(uint64_t expectedVersion, const std::shared_ptr<AnyMap>& value, CommitClock& clock);
+
+    /**
+     * Multi-atom commits: hold the write lock of every atom involved, check
+     * each new value with acceptsLocked(), then publish them all under one
+     * commit version with commitLocked()
+     */
+    std::unique_lock<std::mutex> lockWrites() { return std::unique_lock<std::mutex>(mutex_); }
+
+    /**
+     * Whether the equality policy treats `value` as a change.
+     * A true result must be followed by commitLocked(value, ...).
+     */
+    bool acceptsLocked(const std::shared_ptr<AnyMap>& value);
+
+    void commitLocked(const std::shared_ptr<AnyMap>& value, uint64_t commit, CommitClock& clock);
+
+    /**
+     * Value as of commit `version`, i.e. the last one written at or before
+     * it. Older values are only kept while a snapshot is pinned to them.
+     * @return nullptr if no such value is kept
+     */
+    std::shared_ptr<AnyMap> getAt(uint64_t version) const;
+
+    /**
+     * The stored encoding of the value as of commit `version`, if the atom
+     * still holds the value it was loaded with then
+     */
+    std::optional<StoredValue> storedAt(uint64_t version) const;
+
+    /**
+     * Whether the atom is written to the persistent store
+     */
+    bool isPersisted() const { return persisted_.load(std::memory_order_acquire); }
+    void setPersisted(bool persisted) { persisted_.store(persisted, std::memory_order_release); }
+
+    /**
+     * Number of superseded values kept for snapshots
+     */
+    size_t historyLength() const { return historyLength_.load(std::memory_order_relaxed); }
+
+    /**
+     * Drop superseded values that no pinned snapshot can see
+     */
+    void pruneHistory(const CommitClock& clock);
+
+    /**
+     * pruneHistory() once enough superseded values have piled up.
+     * Call after the commit completed, without holding the write lock.
+     */
+    void trimHistory(const CommitClock& clock);
+
+    /**
+     * Write `value` at `path` inside the current value. The first edit after
+     * set() converts the top level into a PersistentMap once, and each
+     * nested object when a write first reaches it; from then on each write
+     * copies only the O(log n) nodes along the path. get() of an edited
+     * value still builds a full AnyMap once per version (the plain form JS
+     * receives); getIn() reads a part without it.
+     * @return false if the equality policy judged the write a no-op
+     */
+    bool setIn(const std::vector<std::string>& path, const AnyValue& value, CommitClock& clock);
+
+    /**
+     * Shallow-merge `partial` into the top level of the value
+     * @return false if no key changed
+     */
+    bool merge(const AnyMap& partial, CommitClock& clock);
+
+    /**
+     * Add `delta` to the number at `path`; a missing number counts as 0
+     * @param result Receives the new number
+     * @return false if nothing changed
+     */
+    bool increment(const std::vector<std::string>& path, double delta, CommitClock& clock, double& result);
+
+    /**
+     * Array.prototype.splice on the array at `path`; a missing array counts
+     * as empty. push is a splice at the end. Arrays are stored plain, so
+     * each call copies the array once: O(length), not O(log n) like setIn().
+     * @param removed Receives the removed items
+     * @param length Receives the new array length
+     * @return false if nothing changed
      */
-    jsi::Value get(jsi::Runtime& rt) const;
+    bool splice(
+        const std::vector<std::string>& path,
+        double start,
+        double deleteCount,
+        const AnyArray& items,
+        CommitClock& clock,
+        AnyArray& removed,
+        size_t& length
+    );
 
     /**
-     * Set a new value and notify subscribers
+     * Read the value at `path` without materializing the whole atom
      */
-    void set(jsi::Runtime& rt, const jsi::Value& value);
+    std::optional<AnyValue> getIn(const std::vector<std::string>& path) const;
+
+    /**
+     * Choose how set() decides whether a value actually changed
+     */
+    void setEqualityMode(EqualityMode mode);
+
+    /**
+     * Number of writes applied to this atom
+     */
+    uint64_t version() const { return version_.load(std::memory_order_acquire); }
+
+    /**
+     * Commit version of the last write, 0 if never written
+     */
+    uint64_t commitVersion() const { return commitVersion_.load(std::memory_order_acquire); }
 
     /**
      * Subscribe to value changes
@@ -52,26 +201,161 @@ public:
     void unsubscribe(SubscriberId id);
 
     /**
-     * Notify all subscribers (called after batch ends)
+     * Subscribe to changes of the value at `path` only. Fires when that
+     * value (or anything beneath it) differs from the last notification.
+     * @return Subscriber ID for unsubscribePath
+     */
+    SubscriberId subscribePath(const std::vector<std::string>& path, Callback callback);
+
+    /**
+     * Unsubscribe a path subscriber
+     */
+    void unsubscribePath(SubscriberId id);
+
+    /**
+     * Register a computed that reads this atom
+     */
+    void addDependent(const std::shared_ptr<ComputedCore>& computed);
+
+    /**
+     * Unregister a computed that stopped reading this atom
+     */
+    void removeDependent(const ComputedCore* computed);
+
+    /**
+     * Live computeds that read this atom
+     */
+    std::vector<std::shared_ptr<ComputedCore>> dependents() const;
+
+    /**
+     * Whether anything still observes the atom: subscribers, path
+     * subscribers or live computeds
+     */
+    bool isObserved();
+
+    /**
+     * Count the approximate memory held by the value into `total`, and
+     * keep it counted as writes change it. Writes adjust the count by the
+     * size of what they replace, never by re-measuring the whole value.
+     * `total` must outlive the atom or untrackFootprint().
+     */
+    void trackFootprint(std::atomic<size_t>* total);
+
+    /**
+     * Stop counting into the total passed to trackFootprint()
+     */
+    void untrackFootprint();
+
+    /**
+     * References held from JS; the collector reclaims the atom once they
+     * are gone and nothing observes it
+     */
+    RefCount& refs() { return refs_; }
+
+    /**
+     * Notify all subscribers if the atom is dirty, then mark it clean.
+     * Path subscribers are only called if their path changed.
      */
     void notify();
 
     /**
      * Check if value has changed (for batch optimization)
      */
-    bool isDirty() const { return dirty_; }
+    bool isDirty() const { return dirty_.load(std::memory_order_acquire); }
 
     /**
      * Mark as clean after notification
      */
-    void markClean() { dirty_ = false; }
+    void markClean() { dirty_.store(false, std::memory_order_release); }
 
 private:
-    std::shared_ptr<jsi::Value> value_;
+    // Immutable published value, reclaimed through EpochManager. Holds
+    // either a plain map or a persistent tree; a tree is turned into a map
+    // once, on the first get()
+    struct Value {
+        explicit Value(std::shared_ptr<AnyMap> map) : map(std::move(map)) {}
+        explicit Value(PersistentMap tree) : tree(std::move(tree)) {}
+        explicit Value(StoredValue stored) : stored(std::move(stored)) {}
+
+        const std::shared_ptr<AnyMap>& materialize() const;
+
+        mutable std::shared_ptr<AnyMap> map;
+        std::optional<PersistentMap> tree;
+        // `map` converted by modify(); only touched under the write lock
+        mutable std::optional<PersistentMap> converted;
+        // Still-encoded value from the store; decoded into `map` on demand
+        std::optional<StoredValue> stored;
+        mutable std::once_flag materialized;
+        // Set once `map` holds the decoded stored value
+        mutable std::atomic<bool> decoded{false};
+        // Commit that wrote this value
+        uint64_t commit = 0;
+        // Value it superseded, kept while a snapshot may read it
+        mutable std::atomic<const Value*> previous{nullptr};
+    };
+
+    // Superseded values kept before trimHistory() prunes
+    static constexpr size_t kHistoryLimit = 8;
+
+    // Must be called with mutex_ held; returns the values to retire (if any)
+    const Value* publishLocked(Value* next, uint64_t commit, const CommitClock& clock);
+
+    // Must be called inside an EpochManager::Guard
+    const Value* valueAt(uint64_t version) const;
+
+    // Retire a value and everything it still links to
+    static void retireChain(const Value* value);
+
+    // Body of set(); must be called with mutex_ held
+    bool setLocked(const std::shared_ptr<AnyMap>& value, CommitClock& clock, const Value*& previous, uint64_t& commit);
+
+    /**
+     * Apply `edit` to the value as a persistent tree and publish the result
+     * as one commit, all under the write lock. A plain value is converted
+     * into a tree once and cached on it, so edits that turn out to be
+     * no-ops don't repeat the work. `edit` returns false to leave the atom
+     * as is.
+     */
+    using Edit = std::function<bool(PersistentMap& root)>;
+    bool modify(const Edit& edit, CommitClock& clock);
+
+    // Whether writing `value` at `path` is a change under the equality mode
+    bool changesLocked(const PersistentMap& root, const std::vector<std::string>& path, const AnyValue& value) const;
+
+    // Account for a part of the value of `before` bytes becoming `after`
+    // bytes; must be called with mutex_ held
+    void resizeFootprintLocked(size_t before, size_t after);
+    // Same, for the value at `path` in `root` being replaced by `value`
+    void replaceFootprintLocked(const PersistentMap& root, const std::vector<std::string>& path, const AnyValue& value);
+
+    // Must be called inside an EpochManager::Guard
+    PathSubscriptions::Snapshot snapshot() const;
+
+    std::string key_;
+    std::atomic<const Value*> value_;
+    std::atomic<uint64_t> version_{0};
+    std::atomic<uint64_t> commitVersion_{0};
+    std::atomic<size_t> historyLength_{0};
+    std::atomic<bool> persisted_{false};
+    // Approximate bytes held by the value, counted into footprintTotal_.
+    // Both guarded by mutex_
+    size_t footprint_ = 0;
+    std::atomic<size_t>* footprintTotal_ = nullptr;
+    RefCount refs_;
+    EqualityMode equalityMode_ = EqualityMode::IDENTITY;
+    // Fingerprint of the current value, maintained in HASH mode only.
+    // setIn() leaves it stale rather than hashing the whole tree
+    uint64_t fingerprint_ = 0;
+    bool fingerprintValid_ = false;
     std::vector<std::pair<SubscriberId, Callback>> subscribers_;
+    std::vector<std::weak_ptr<ComputedCore>> dependents_;
     mutable std::mutex mutex_;
     SubscriberId nextId_ = 0;
-    bool dirty_ = false;
+    // Path subscribers and the value they were last notified about
+    PathSubscriptions paths_;
+    PathSubscriptions::Snapshot notifiedValue_;
+    std::mutex pathsMutex_;
+    std::atomic<bool> dirty_{false};
 };
 
-} // namespace nitrostate
+} // namespace margelo::nitro::nitrostate
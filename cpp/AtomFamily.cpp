@@ -0,0 +1,163 @@
+#include "AtomFamily.hpp"
+#include <utility>
+
+namespace margelo::nitro::nitrostate {
+
+namespace {
+
+constexpr size_t kInitialBuckets = 16;
+
+// Members evict() may refuse before it gives up until the next call
+constexpr size_t kMaxSkipped = 32;
+
+} // namespace
+
+AtomFamily::AtomFamily() : buckets_(kInitialBuckets, 0) {}
+
+size_t AtomFamily::probe(const std::string& param, size_t hash) const {
+    size_t mask = buckets_.size() - 1;
+    size_t bucket = hash & mask;
+    while (buckets_[bucket] != 0) {
+        const auto& member = members_[buckets_[bucket] - 1];
+        if (member.hash == hash && member.param == param) break;
+        bucket = (bucket + 1) & mask;
+    }
+    return bucket;
+}
+
+std::optional<AtomFamily::Handle> AtomFamily::find(const std::string& param) {
+    size_t bucket = probe(param, std::hash<std::string>{}(param));
+    if (buckets_[bucket] == 0) return std::nullopt;
+
+    uint32_t index = buckets_[bucket] - 1;
+    if (newest_ != index) {
+        unlink(index);
+        link(index);
+    }
+    return members_[index].handle;
+}
+
+void AtomFamily::insert(const std::string& param, Handle handle) {
+    // Keep the load factor at or below 1/2 so probe runs stay short
+    if ((count_ + 1) * 2 > buckets_.size()) {
+        grow();
+    }
+
+    uint32_t index;
+    if (!free_.empty()) {
+        index = free_.back();
+        free_.pop_back();
+    } else {
+        index = static_cast<uint32_t>(members_.size());
+        members_.emplace_back();
+    }
+    auto& member = members_[index];
+    member.param = param;
+    member.hash = std::hash<std::string>{}(param);
+    member.handle = handle;
+
+    buckets_[probe(param, member.hash)] = index + 1;
+    link(index);
+    count_++;
+}
+
+void AtomFamily::erase(const std::string& param) {
+    size_t bucket = probe(param, std::hash<std::string>{}(param));
+    if (buckets_[bucket] != 0) {
+        remove(bucket);
+    }
+}
+
+size_t AtomFamily::evict(
+    const std::function<bool()>& overBudget,
+    const std::function<bool(const std::string& param, Handle handle)>& evict
+) {
+    size_t removed = 0;
+    size_t skipped = 0;
+    // Each member is offered at most once: refused ones become the newest
+    size_t candidates = count_;
+    while (candidates-- > 0 && skipped < kMaxSkipped && overBudget()) {
+        uint32_t index = oldest_;
+        const auto& member = members_[index];
+        if (evict(member.param, member.handle)) {
+            remove(probe(member.param, member.hash));
+            removed++;
+        } else {
+            // Out of the way of the next eviction, which would only skip it
+            // again; it is in use anyway
+            unlink(index);
+            link(index);
+            skipped++;
+        }
+    }
+    return removed;
+}
+
+void AtomFamily::grow() {
+    std::vector<uint32_t> old(buckets_.size() * 2, 0);
+    std::swap(old, buckets_);
+    size_t mask = buckets_.size() - 1;
+    for (uint32_t entry : old) {
+        if (entry == 0) continue;
+        size_t bucket = members_[entry - 1].hash & mask;
+        while (buckets_[bucket] != 0) {
+            bucket = (bucket + 1) & mask;
+        }
+        buckets_[bucket] = entry;
+    }
+}
+
+void AtomFamily::remove(size_t bucket) {
+    uint32_t index = buckets_[bucket] - 1;
+    unlink(index);
+    members_[index].param.clear();
+    members_[index].param.shrink_to_fit();
+    free_.push_back(index);
+    count_--;
+
+    // Backward-shift: pull later entries of the probe run into the hole,
+    // unless that would move them in front of their home bucket
+    size_t mask = buckets_.size() - 1;
+    size_t hole = bucket;
+    size_t next = (hole + 1) & mask;
+    while (buckets_[next] != 0) {
+        size_t home = members_[buckets_[next] - 1].hash & mask;
+        if (((next - home) & mask) >= ((next - hole) & mask)) {
+            buckets_[hole] = buckets_[next];
+            hole = next;
+        }
+        next = (next + 1) & mask;
+    }
+    buckets_[hole] = 0;
+}
+
+void AtomFamily::link(uint32_t index) {
+    auto& member = members_[index];
+    member.newer = kNone;
+    member.older = newest_;
+    if (newest_ != kNone) {
+        members_[newest_].newer = index;
+    }
+    newest_ = index;
+    if (oldest_ == kNone) {
+        oldest_ = index;
+    }
+}
+
+void AtomFamily::unlink(uint32_t index) {
+    auto& member = members_[index];
+    if (member.newer != kNone) {
+        members_[member.newer].older = member.older;
+    } else {
+        newest_ = member.older;
+    }
+    if (member.older != kNone) {
+        members_[member.older].newer = member.newer;
+    } else {
+        oldest_ = member.newer;
+    }
+    member.newer = kNone;
+    member.older = kNone;
+}
+
+} // namespace margelo::nitro::nitrostate
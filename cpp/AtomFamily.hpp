@@ -0,0 +1,81 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace margelo::nitro::nitrostate {
+
+/**
+ * AtomFamily - Index of the atoms a family created, one per parameter
+ *
+ * Parameters are looked up in an open-addressing table (linear probing with
+ * backward-shift deletion, so erasing leaves no tombstones). Members are
+ * also kept in least-recently-used order, so the family can evict idle
+ * ones once it outgrows its budget.
+ * Not thread-safe; HybridNitroState guards each family with a mutex.
+ */
+class AtomFamily {
+public:
+    using Handle = uint32_t;
+
+    AtomFamily();
+
+    /**
+     * Handle of the member for `param`, which becomes the most recently used
+     */
+    std::optional<Handle> find(const std::string& param);
+
+    /**
+     * Add a member as the most recently used. `param` must not be present.
+     */
+    void insert(const std::string& param, Handle handle);
+
+    void erase(const std::string& param);
+
+    size_t size() const { return count_; }
+
+    /**
+     * Offer members to `evict`, least recently used first, for as long as
+     * `overBudget` holds. Members it accepts are removed; members it refuses
+     * become the most recently used, and a call stops after a few refusals,
+     * so members that stay pinned never make eviction scan the family.
+     * @return Number of members removed
+     */
+    size_t evict(
+        const std::function<bool()>& overBudget,
+        const std::function<bool(const std::string& param, Handle handle)>& evict
+    );
+
+private:
+    static constexpr uint32_t kNone = UINT32_MAX;
+
+    struct Member {
+        std::string param;
+        size_t hash = 0;
+        Handle handle = 0;
+        // Neighbours in recency order, by member index
+        uint32_t newer = kNone;
+        uint32_t older = kNone;
+    };
+
+    // Bucket holding `param`, or the empty bucket it would go into
+    size_t probe(const std::string& param, size_t hash) const;
+    void grow();
+    void remove(size_t bucket);
+    void link(uint32_t index);
+    void unlink(uint32_t index);
+
+    // Member index + 1 per bucket, 0 if empty; the size is a power of two
+    std::vector<uint32_t> buckets_;
+    std::vector<Member> members_;
+    std::vector<uint32_t> free_;
+    size_t count_ = 0;
+    uint32_t newest_ = kNone;
+    uint32_t oldest_ = kNone;
+};
+
+} // namespace margelo::nitro::nitrostate
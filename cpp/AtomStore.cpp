@@ -0,0 +1,169 @@
+#include "AtomStore.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace margelo::nitro::nitrostate {
+
+namespace {
+
+constexpr char kMagic[4] = {'N', 'S', 'S', 'T'};
+constexpr uint32_t kFormatVersion = 1;
+constexpr size_t kCountOffset = sizeof(kMagic) + sizeof(uint32_t);
+constexpr size_t kCommitOffset = kCountOffset + sizeof(uint32_t);
+constexpr size_t kHeaderSize = kCommitOffset + sizeof(uint64_t);
+
+// Both iOS and Android run little-endian, so the header is copied as is
+void writeU32(uint8_t* out, uint32_t value) {
+    std::memcpy(out, &value, sizeof(value));
+}
+
+uint32_t readU32(const uint8_t* data) {
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+uint64_t readU64(const uint8_t* data) {
+    uint64_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+[[noreturn]] void fail(const std::string& message, const std::string& path) {
+    throw std::runtime_error(message + " '" + path + "': " + std::strerror(errno));
+}
+
+} // namespace
+
+// ----- Builder -----
+
+AtomStore::Builder::Builder(uint64_t commit) : bytes_(kHeaderSize) {
+    std::memcpy(bytes_.data(), kMagic, sizeof(kMagic));
+    writeU32(bytes_.data() + sizeof(kMagic), kFormatVersion);
+    std::memcpy(bytes_.data() + kCommitOffset, &commit, sizeof(commit));
+}
+
+void AtomStore::Builder::add(const std::string& key, const uint8_t* data, size_t size) {
+    ValueCodec::writeVarint(bytes_, key.size());
+    bytes_.insert(bytes_.end(), key.begin(), key.end());
+    ValueCodec::writeVarint(bytes_, size);
+    bytes_.insert(bytes_.end(), data, data + size);
+    ++count_;
+}
+
+void AtomStore::Builder::writeTo(const std::string& path) const {
+    auto bytes = bytes_;
+    writeU32(bytes.data() + kCountOffset, count_);
+
+    std::string temporary = path + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) fail("Cannot create store", temporary);
+
+    size_t written = 0;
+    while (written < bytes.size()) {
+        ssize_t result = ::write(fd, bytes.data() + written, bytes.size() - written);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            fail("Cannot write store", temporary);
+        }
+        written += static_cast<size_t>(result);
+    }
+    if (::fsync(fd) != 0) {
+        ::close(fd);
+        fail("Cannot sync store", temporary);
+    }
+    ::close(fd);
+
+    if (::rename(temporary.c_str(), path.c_str()) != 0) {
+        fail("Cannot replace store", path);
+    }
+}
+
+// ----- AtomStore -----
+
+AtomStore::~AtomStore() {
+    if (size_ > 0) {
+        ::munmap(const_cast<uint8_t*>(data_), size_);
+    }
+}
+
+std::shared_ptr<const AtomStore> AtomStore::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) return nullptr;
+        fail("Cannot open store", path);
+    }
+
+    struct stat info {};
+    if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        fail("Cannot stat store", path);
+    }
+    auto size = static_cast<size_t>(info.st_size);
+    if (size < kHeaderSize) {
+        ::close(fd);
+        throw std::runtime_error("Store '" + path + "' is truncated");
+    }
+
+    void* data = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // The mapping keeps the file alive on its own
+    ::close(fd);
+    if (data == MAP_FAILED) fail("Cannot map store", path);
+
+    std::shared_ptr<AtomStore> store(new AtomStore(static_cast<const uint8_t*>(data), size));
+    try {
+        store->index();
+    } catch (const std::runtime_error&) {
+        throw std::runtime_error("Store '" + path + "' is corrupt");
+    }
+    return store;
+}
+
+void AtomStore::index() {
+    if (std::memcmp(data_, kMagic, sizeof(kMagic)) != 0 ||
+        readU32(data_ + sizeof(kMagic)) != kFormatVersion) {
+        throw std::runtime_error("Unknown store format");
+    }
+    uint32_t count = readU32(data_ + kCountOffset);
+    commit_ = readU64(data_ + kCommitOffset);
+    size_t offset = kHeaderSize;
+
+    // Only lengths are read here; values are skipped over
+    auto take = [&](size_t& start, size_t& length) {
+        uint64_t size = ValueCodec::readVarint(data_, size_, offset);
+        if (size > size_ - offset) throw std::runtime_error("Entry out of bounds");
+        start = offset;
+        length = static_cast<size_t>(size);
+        offset += length;
+    };
+
+    if (count > size_ - offset) throw std::runtime_error("Entry count out of bounds");
+    ranges_.reserve(count);
+    for (uint32_t i = 0; i < count; ++i) {
+        Range range{};
+        take(range.keyOffset, range.keySize);
+        take(range.valueOffset, range.valueSize);
+        ranges_.push_back(range);
+    }
+}
+
+std::vector<AtomStore::Entry> AtomStore::entries() const {
+    auto self = shared_from_this();
+    std::vector<Entry> entries;
+    entries.reserve(ranges_.size());
+    for (const auto& range : ranges_) {
+        entries.push_back({
+            std::string(reinterpret_cast<const char*>(data_ + range.keyOffset), range.keySize),
+            StoredValue{self, data_ + range.valueOffset, range.valueSize},
+        });
+    }
+    return entries;
+}
+
+} // namespace margelo::nitro::nitrostate
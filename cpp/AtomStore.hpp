@@ -0,0 +1,111 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "ValueCodec.hpp"
+
+namespace margelo::nitro::nitrostate {
+
+class AtomStore;
+
+/**
+ * An encoded atom value inside a mapped store file or a recovered log.
+ * Keeps the bytes alive for as long as the value is referenced.
+ */
+struct StoredValue {
+    std::shared_ptr<const void> owner;
+    const uint8_t* data = nullptr;
+    size_t size = 0;
+};
+
+/**
+ * AtomStore - Read-only, memory-mapped file of persisted atom values
+ *
+ * Layout: "NSST", format version and entry count (u32 little-endian each)
+ * and the commit the file was written at (u64), then per entry a varint
+ * key length, the key, a varint value length and the ValueCodec encoding
+ * of the value. Opening only walks the keys and lengths; values are
+ * decoded by whoever reads them first.
+ */
+class AtomStore : public std::enable_shared_from_this<AtomStore> {
+public:
+    struct Entry {
+        std::string key;
+        StoredValue value;
+    };
+
+    /**
+     * Collects entries and writes a store file in one go
+     */
+    class Builder {
+    public:
+        /**
+         * @param commit Commit the collected values are as of
+         */
+        explicit Builder(uint64_t commit);
+
+        void add(const std::string& key, const uint8_t* data, size_t size);
+
+        /**
+         * Write to a temporary file, fsync it and rename it over `path`.
+         * Existing mappings of the old file stay valid.
+         */
+        void writeTo(const std::string& path) const;
+
+        size_t size() const { return bytes_.size(); }
+
+    private:
+        ValueCodec::Bytes bytes_;
+        uint32_t count_ = 0;
+    };
+
+    ~AtomStore();
+
+    // Non-copyable
+    AtomStore(const AtomStore&) = delete;
+    AtomStore& operator=(const AtomStore&) = delete;
+
+    /**
+     * Map the store at `path`
+     * @return nullptr if there is no file yet
+     */
+    static std::shared_ptr<const AtomStore> open(const std::string& path);
+
+    /**
+     * Every entry, in file order
+     */
+    std::vector<Entry> entries() const;
+
+    /**
+     * Commit the file was written at
+     */
+    uint64_t commit() const { return commit_; }
+
+    /**
+     * Size of the file in bytes
+     */
+    size_t size() const { return size_; }
+
+private:
+    struct Range {
+        size_t keyOffset;
+        size_t keySize;
+        size_t valueOffset;
+        size_t valueSize;
+    };
+
+    AtomStore(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+    // Validate the header and index every entry
+    void index();
+
+    const uint8_t* data_;
+    size_t size_;
+    uint64_t commit_ = 0;
+    std::vector<Range> ranges_;
+};
+
+} // namespace margelo::nitro::nitrostate
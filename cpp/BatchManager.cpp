@@ -1,42 +1,46 @@
 #include "BatchManager.hpp"
+#include <utility>
 
-namespace nitrostate {
+namespace margelo::nitro::nitrostate {
 
-BatchManager& BatchManager::instance() {
-    static BatchManager instance;
-    return instance;
+void BatchManager::startBatch() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    batches_[std::this_thread::get_id()].depth++;
 }
 
-void BatchManager::startBatch() {
+NotificationQueue BatchManager::endBatch() {
+    NotificationQueue flushed;
     std::lock_guard<std::mutex> lock(mutex_);
-    batchDepth_++;
+    auto it = batches_.find(std::this_thread::get_id());
+    if (it == batches_.end()) return flushed;
+
+    if (--it->second.depth == 0) {
+        std::swap(flushed, it->second.pending);
+        batches_.erase(it);
+    }
+    return flushed;
 }
 
-void BatchManager::endBatch() {
-    std::set<AtomCore*> atomsToNotify;
-    
-    {
-        std::lock_guard<std::mutex> lock(mutex_);
-        batchDepth_--;
-        
-        if (batchDepth_ == 0) {
-            atomsToNotify = std::move(pendingNotifications_);
-            pendingNotifications_.clear();
-        }
+bool BatchManager::queueNotification(
+    uint32_t handle,
+    const std::shared_ptr<AtomCore>& atom,
+    const std::vector<std::shared_ptr<ComputedCore>>& invalidated
+) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (batches_.empty()) {
+        return false;
     }
-    
-    // Notify outside lock
-    for (auto* atom : atomsToNotify) {
-        atom->notify();
-        atom->markClean();
+    auto it = batches_.find(std::this_thread::get_id());
+    if (it == batches_.end()) {
+        return false;
     }
+    it->second.pending.push(handle, atom, invalidated);
+    return true;
 }
 
-void BatchManager::queueNotification(AtomCore* atom) {
+bool BatchManager::isBatching() const {
     std::lock_guard<std::mutex> lock(mutex_);
-    if (batchDepth_ > 0) {
-        pendingNotifications_.insert(atom);
-    }
+    return batches_.find(std::this_thread::get_id()) != batches_.end();
 }
 
-} // namespace nitrostate
+} // namespace margelo::nitro::nitrostate
@@ -1,19 +1,28 @@
 #pragma once
 
-#include <set>
+#include <cstdint>
+#include <memory>
 #include <mutex>
-#include <jsi/jsi.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 #include "AtomCore.hpp"
+#include "ComputedCore.hpp"
+#include "NotificationQueue.hpp"
 
-namespace nitrostate {
-
-using namespace facebook;
+namespace margelo::nitro::nitrostate {
 
 /**
  * BatchManager - Batches multiple atom updates
  * 
- * Defers notifications until batch ends, preventing
- * unnecessary re-renders during bulk updates.
+ * Defers notifications until the outermost batch ends, preventing
+ * unnecessary re-renders during bulk updates. Each atom is queued once no
+ * matter how often it is set, and atoms are flushed in the order they were
+ * first written.
+ *
+ * Batches belong to the thread that opened them: writes on other threads
+ * neither join nor wait for them, so a native thread committing a
+ * transaction can't hold back or merge into a batch the JS thread has open.
  */
 class BatchManager {
 public:
@@ -25,34 +34,42 @@ public:
     BatchManager& operator=(const BatchManager&) = delete;
 
     /**
-     * Start a batch operation
+     * Start a batch operation on the calling thread
      */
     void startBatch();
 
     /**
-     * End batch and notify all queued atoms
+     * End the calling thread's batch. Closing the outermost batch hands back everything queued
+     * so the caller can deliver it now or pass it on to the scheduler.
+     * @return Queued notifications, empty while still nested
      */
-    void endBatch();
+    NotificationQueue endBatch();
 
     /**
-     * Queue an atom for notification (called during set)
+     * Queue an atom and the computeds it invalidated for notification
+     * (called during set)
+     * @return false if the calling thread has no batch open and should notify now
      */
-    void queueNotification(AtomCore* atom);
+    bool queueNotification(
+        uint32_t handle,
+        const std::shared_ptr<AtomCore>& atom,
+        const std::vector<std::shared_ptr<ComputedCore>>& invalidated
+    );
 
     /**
-     * Check if currently batching
+     * Check if the calling thread is batching
      */
-    bool isBatching() const { return batchDepth_ > 0; }
-
-    /**
-     * Get singleton instance
-     */
-    static BatchManager& instance();
+    bool isBatching() const;
 
 private:
-    std::set<AtomCore*> pendingNotifications_;
-    int batchDepth_ = 0;
+    struct Batch {
+        int depth = 0;
+        NotificationQueue pending;
+    };
+
+    // Open batches by thread; a thread's entry goes when its batch closes
+    std::unordered_map<std::thread::id, Batch> batches_;
     mutable std::mutex mutex_;
 };
 
-} // namespace nitrostate
+} // namespace margelo::nitro::nitrostate
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace margelo::nitro::nitrostate {
+
+/**
+ * CommitClock - Global, monotonic commit counter
+ *
+ * Every write that changes an atom takes the next version from begin() and
+ * reports back through complete() once the value is published. current()
+ * only advances over versions whose writes have all completed, so a reader
+ * that saw current() == V can rely on every commit <= V being visible.
+ * Writers never wait for each other: complete() marks its version done and
+ * advances current() as far as the completed versions reach, so whoever
+ * completes the oldest outstanding commit carries it past the later ones.
+ *
+ * The clock also records which versions snapshots are pinned to, so
+ * writers know when superseded values must be kept for them.
+ */
+class CommitClock {
+public:
+    /**
+     * Reserve the next commit version. Must be paired with complete(),
+     * and no locks may be acquired in between.
+     */
+    uint64_t begin() {
+        // Sequentially consistent with pin(): either the writer sees the
+        // pin, or the snapshot's version includes the writer's commit
+        return issued_.fetch_add(1, std::memory_order_seq_cst) + 1;
+    }
+
+    /**
+     * Mark a commit as published. Returns right away; current() reaches
+     * it once every earlier commit has completed too.
+     */
+    void complete(uint64_t version) {
+        auto& slot = completions_[version % kCompletionSlots];
+        // Only waits with more commits in flight than there are slots
+        unsigned spins = 0;
+        while (version - completed_.load(std::memory_order_acquire) > kCompletionSlots) {
+            if (++spins > 64) std::this_thread::yield();
+        }
+        // Sequentially consistent with the loads in advance(): either this
+        // writer sees the version before it completed, or the writer that
+        // completed it sees this slot and advances past it
+        slot.store(version, std::memory_order_seq_cst);
+        advance();
+    }
+
+    /**
+     * Highest version up to which every commit is visible
+     */
+    uint64_t current() const { return completed_.load(std::memory_order_acquire); }
+
+    /**
+     * Wait until current() reaches `version`, e.g. to read a value that
+     * includes every commit before one just completed
+     */
+    void waitFor(uint64_t version) const {
+        unsigned spins = 0;
+        while (completed_.load(std::memory_order_acquire) < version) {
+            if (++spins > 64) std::this_thread::yield();
+        }
+    }
+
+    /**
+     * Pin a snapshot at the latest issued version, once every commit up
+     * to it has completed. Writers that commit after it keep the values
+     * it can see until unpin().
+     */
+    uint64_t pin() {
+        std::lock_guard<std::mutex> lock(pinsMutex_);
+        pinCount_.fetch_add(1, std::memory_order_seq_cst);
+        uint64_t version = issued_.load(std::memory_order_seq_cst);
+        waitFor(version);
+        pins_.insert(std::upper_bound(pins_.begin(), pins_.end(), version), version);
+        return version;
+    }
+
+    void unpin(uint64_t version) {
+        std::lock_guard<std::mutex> lock(pinsMutex_);
+        auto it = std::lower_bound(pins_.begin(), pins_.end(), version);
+        if (it != pins_.end() && *it == version) {
+            pins_.erase(it);
+            pinCount_.fetch_sub(1, std::memory_order_seq_cst);
+        }
+    }
+
+    /**
+     * Whether a snapshot is pinned or being pinned. Call after begin().
+     */
+    bool hasPins() const { return pinCount_.load(std::memory_order_seq_cst) != 0; }
+
+    /**
+     * Pinned versions in ascending order
+     */
+    std::vector<uint64_t> pinnedVersions() const {
+        std::lock_guard<std::mutex> lock(pinsMutex_);
+        return pins_;
+    }
+
+private:
+    // Commits that may be in flight at once before complete() waits
+    static constexpr uint64_t kCompletionSlots = 1024;
+
+    // Move completed_ over every consecutive completed version
+    void advance() {
+        uint64_t completed = completed_.load(std::memory_order_seq_cst);
+        while (completions_[(completed + 1) % kCompletionSlots].load(std::memory_order_seq_cst) == completed + 1) {
+            // On failure another writer advanced; carry on from there
+            if (completed_.compare_exchange_weak(completed, completed + 1, std::memory_order_seq_cst)) {
+                completed++;
+            }
+        }
+    }
+
+    alignas(64) std::atomic<uint64_t> issued_{0};
+    alignas(64) std::atomic<uint64_t> completed_{0};
+    // Version last completed in each slot, indexed by version
+    alignas(64) std::array<std::atomic<uint64_t>, kCompletionSlots> completions_{};
+
+    mutable std::mutex pinsMutex_;
+    std::vector<uint64_t> pins_;
+    std::atomic<size_t> pinCount_{0};
+};
+
+} // namespace margelo::nitro::nitrostate
@@ -1,53 +1,412 @@
 #include "ComputedCore.hpp"
+#include <algorithm>
+#include <queue>
+#include <stdexcept>
+#include <unordered_set>
 
-namespace nitrostate {
+namespace margelo::nitro::nitrostate {
 
-ComputedCore::ComputedCore(ComputeFn compute)
-    : compute_(std::move(compute)) {}
+thread_local ComputedCore::Run* ComputedCore::currentRun_ = nullptr;
+std::mutex ComputedCore::edgesMutex_;
 
-ComputedCore::~ComputedCore() {
-    // Unsubscribe from all dependencies
-    for (size_t i = 0; i < dependencies_.size(); ++i) {
-        if (i < subscriptionIds_.size()) {
-            dependencies_[i]->unsubscribe(subscriptionIds_[i]);
+namespace {
+
+// Records the thread holding a node's compute lock for as long as it does
+class ComputingThread {
+public:
+    explicit ComputingThread(std::atomic<std::thread::id>& owner) : owner_(owner) {
+        owner_.store(std::this_thread::get_id(), std::memory_order_relaxed);
+    }
+    ~ComputingThread() { owner_.store(std::thread::id(), std::memory_order_relaxed); }
+
+private:
+    std::atomic<std::thread::id>& owner_;
+};
+
+} // namespace
+
+bool ComputedCore::Run::firstRead(const void* source) {
+    if (std::find(reads_.begin(), reads_.end(), source) != reads_.end()) return false;
+    reads_.push_back(source);
+    return true;
+}
+
+void ComputedCore::Run::read(AtomCore& atom) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (finished_ || !firstRead(&atom)) return;
+    // Still a source since the last run: nothing to wire up
+    const auto& sources = computed.atomSources_;
+    auto it = sources.find(&atom);
+    if (it != sources.end() && !it->second.expired()) return;
+    computed.addDependency(atom.shared_from_this());
+}
+
+void ComputedCore::Run::read(ComputedCore& source) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (finished_ || &source == &computed || !firstRead(&source)) return;
+    const auto& sources = computed.computedSources_;
+    auto it = sources.find(&source);
+    if (it != sources.end() && !it->second.expired()) return;
+    computed.addDependency(source.shared_from_this());
+}
+
+void ComputedCore::Run::finish(bool complete) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    finished_ = true;
+    if (!complete) return;
+
+    std::sort(reads_.begin(), reads_.end());
+    auto wasRead = [&](const void* source) { return std::binary_search(reads_.begin(), reads_.end(), source); };
+    for (auto it = computed.atomSources_.begin(); it != computed.atomSources_.end();) {
+        if (wasRead(it->first)) {
+            ++it;
+            continue;
         }
+        if (auto atom = it->second.lock()) atom->removeDependent(&computed);
+        it = computed.atomSources_.erase(it);
     }
+    for (auto it = computed.computedSources_.begin(); it != computed.computedSources_.end();) {
+        if (wasRead(it->first)) {
+            ++it;
+            continue;
+        }
+        if (auto source = it->second.lock()) source->removeDependent(&computed);
+        it = computed.computedSources_.erase(it);
+    }
+}
+
+ComputedCore::ComputedCore(
+    std::string key,
+    ComputeFn compute,
+    Mode mode,
+    std::shared_ptr<AnyMap> placeholder
+) : key_(std::move(key)),
+    compute_(std::move(compute)),
+    mode_(mode),
+    cachedValue_(std::move(placeholder)) {}
+
+std::shared_ptr<AnyMap> ComputedCore::get() {
+    return mode_ == Mode::Async ? getAsync() : getBlocking();
+}
+
+bool ComputedCore::isPending() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return !hasValue_ || computing_;
 }
 
-jsi::Value ComputedCore::get(jsi::Runtime& rt) {
-    if (dirty_ || !cachedValue_) {
-        // Recompute
-        jsi::Value result = compute_(rt);
-        cachedValue_ = std::make_shared<jsi::Value>(rt, result);
-        dirty_ = false;
+std::shared_ptr<AnyMap> ComputedCore::getBlocking() {
+    // Only this thread ever stores its own id, so a relaxed load is enough.
+    // Reads are tracked before they get here, which normally reports a
+    // cycle first; this catches the untracked ones
+    if (computingThread_.load(std::memory_order_relaxed) == std::this_thread::get_id()) {
+        throw std::runtime_error("Computed '" + key_ + "' read itself while computing");
     }
-    
-    // Return cached value
-    if (cachedValue_) {
-        if (cachedValue_->isUndefined()) return jsi::Value::undefined();
-        if (cachedValue_->isNull()) return jsi::Value::null();
-        if (cachedValue_->isBool()) return jsi::Value(cachedValue_->getBool());
-        if (cachedValue_->isNumber()) return jsi::Value(cachedValue_->getNumber());
-        if (cachedValue_->isString()) return jsi::Value(rt, cachedValue_->getString(rt));
-        if (cachedValue_->isObject()) {
-            return jsi::Value(rt, cachedValue_->getObject(rt));
+    std::lock_guard<std::mutex> computeLock(computeMutex_);
+    ComputingThread computing(computingThread_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        bool dirty = dirty_.exchange(false, std::memory_order_acq_rel);
+        if (!dirty && hasValue_) {
+            return cachedValue_;
         }
     }
-    return jsi::Value::undefined();
+
+    // Pull phase: the compute function reads its sources, which
+    // recompute themselves first if they are dirty too. A source
+    // changing meanwhile re-marks us dirty.
+    auto run = startRun();
+    std::shared_ptr<AnyMap> result;
+    try {
+        std::shared_ptr<Promise<std::shared_ptr<AnyMap>>> promise;
+        {
+            RunScope scope(*run);
+            promise = compute_(run->id);
+        }
+        // Reads reported by id may still come in until the value does
+        result = promise->await().get();
+        run->finish(true);
+    } catch (...) {
+        run->finish(false);
+        markDirty();
+        throw;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    cachedValue_ = result;
+    hasValue_ = true;
+    return result;
 }
 
-void ComputedCore::addDependency(AtomCore* atom) {
-    dependencies_.push_back(atom);
-    
-    // Subscribe to dependency changes
-    auto id = atom->subscribe([this]() {
-        this->markDirty();
+std::shared_ptr<AnyMap> ComputedCore::getAsync() {
+    std::shared_ptr<AnyMap> current;
+    bool shouldCompute = false;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        current = cachedValue_;
+        if (!computing_ && (dirty_.load(std::memory_order_acquire) || !hasValue_)) {
+            computing_ = true;
+            shouldCompute = true;
+        }
+    }
+    if (!shouldCompute) {
+        return current;
+    }
+
+    // A source changing while the compute runs re-marks us dirty, and the
+    // next read after the value lands schedules another round
+    dirty_.store(false, std::memory_order_release);
+    auto run = startRun();
+    std::shared_ptr<Promise<std::shared_ptr<AnyMap>>> promise;
+    try {
+        RunScope scope(*run);
+        promise = compute_(run->id);
+    } catch (...) {
+        run->finish(false);
+        onRecomputeFailed();
+        throw;
+    }
+
+    // The run ends with the promise; it must finish before computing_ is
+    // cleared, so the next run never overlaps it
+    std::weak_ptr<ComputedCore> weakSelf = weak_from_this();
+    promise->addOnResolvedListener([weakSelf, run](const std::shared_ptr<AnyMap>& result) {
+        if (auto self = weakSelf.lock()) {
+            run->finish(true);
+            self->onRecomputed(result);
+        }
+    });
+    promise->addOnRejectedListener([weakSelf, run](const std::exception_ptr&) {
+        if (auto self = weakSelf.lock()) {
+            run->finish(false);
+            self->onRecomputeFailed();
+        }
     });
-    subscriptionIds_.push_back(id);
+    return current;
+}
+
+void ComputedCore::onRecomputed(const std::shared_ptr<AnyMap>& result) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        cachedValue_ = result;
+        hasValue_ = true;
+        computing_ = false;
+    }
+
+    // The new value makes everything downstream stale
+    auto invalidated = invalidate(dependents());
+    notify();
+    for (const auto& computed : invalidated) {
+        computed->notify();
+    }
+}
+
+void ComputedCore::onRecomputeFailed() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        computing_ = false;
+    }
+    // Retry on the next read; keep serving the last good value until then
+    markDirty();
+}
+
+void ComputedCore::addDependency(const std::shared_ptr<AtomCore>& atom) {
+    // A live entry at this address can only be this atom
+    auto& source = atomSources_[atom.get()];
+    if (!source.expired()) return;
+    source = atom;
+    atom->addDependent(shared_from_this());
+}
+
+void ComputedCore::addDependency(const std::shared_ptr<ComputedCore>& computed) {
+    auto it = computedSources_.find(computed.get());
+    if (it != computedSources_.end() && !it->second.expired()) return;
+
+    // An edge closing a cycle would have raiseHeight chase it forever
+    std::lock_guard<std::mutex> lock(edgesMutex_);
+    if (reaches(*computed)) {
+        throw std::runtime_error(
+            "Circular dependency between computeds '" + key_ + "' and '" + computed->key() + "'"
+        );
+    }
+    computedSources_[computed.get()] = computed;
+    computed->addDependent(shared_from_this());
+    raiseHeight(computed->height() + 1);
+}
+
+bool ComputedCore::reaches(const ComputedCore& target) {
+    std::vector<std::shared_ptr<ComputedCore>> pending{shared_from_this()};
+    std::unordered_set<const ComputedCore*> visited;
+    while (!pending.empty()) {
+        auto node = std::move(pending.back());
+        pending.pop_back();
+        if (node.get() == &target) return true;
+        if (!visited.insert(node.get()).second) continue;
+        for (auto& dependent : node->dependents()) {
+            pending.push_back(std::move(dependent));
+        }
+    }
+    return false;
 }
 
-void ComputedCore::markDirty() {
-    dirty_ = true;
+void ComputedCore::raiseHeight(uint32_t required) {
+    // Dependents must stay above this node, so a rise carries on downstream
+    // until it reaches nodes that are already high enough
+    std::vector<std::pair<std::shared_ptr<ComputedCore>, uint32_t>> pending;
+    pending.emplace_back(shared_from_this(), required);
+    while (!pending.empty()) {
+        auto [node, height] = std::move(pending.back());
+        pending.pop_back();
+        uint32_t current = node->height_.load(std::memory_order_relaxed);
+        bool raised = false;
+        while (current < height && !(raised = node->height_.compare_exchange_weak(current, height))) {
+        }
+        if (!raised) continue;
+        for (auto& dependent : node->dependents()) {
+            pending.emplace_back(std::move(dependent), height + 1);
+        }
+    }
+}
+
+void ComputedCore::track(AtomCore& atom) {
+    if (Run* run = currentRun_) run->read(atom);
+}
+
+void ComputedCore::track(ComputedCore& computed) {
+    if (Run* run = currentRun_) run->read(computed);
+}
+
+void ComputedCore::track(RunId run, AtomCore& atom) {
+    if (auto current = runWithId(run)) current->read(atom);
+}
+
+void ComputedCore::track(RunId run, ComputedCore& computed) {
+    if (auto current = runWithId(run)) current->read(computed);
+}
+
+std::shared_ptr<ComputedCore::Run> ComputedCore::startRun() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    run_ = std::make_shared<Run>(*this, nextRun_++);
+    return run_;
+}
+
+std::shared_ptr<ComputedCore::Run> ComputedCore::runWithId(RunId id) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // A finished run ignores reads on its own, so only the id matters
+    return run_ && run_->id == id ? run_ : nullptr;
+}
+
+void ComputedCore::addDependent(const std::shared_ptr<ComputedCore>& computed) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    // Drop computeds that were deleted since
+    dependents_.erase(
+        std::remove_if(dependents_.begin(), dependents_.end(),
+            [](const auto& dependent) { return dependent.expired(); }),
+        dependents_.end()
+    );
+    for (const auto& dependent : dependents_) {
+        if (!dependent.owner_before(computed) && !computed.owner_before(dependent)) return;
+    }
+    dependents_.push_back(computed);
+}
+
+void ComputedCore::removeDependent(const ComputedCore* computed) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    dependents_.erase(
+        std::remove_if(dependents_.begin(), dependents_.end(),
+            [computed](const auto& dependent) {
+                auto live = dependent.lock();
+                return !live || live.get() == computed;
+            }),
+        dependents_.end()
+    );
+}
+
+std::vector<std::shared_ptr<ComputedCore>> ComputedCore::dependents() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<std::shared_ptr<ComputedCore>> result;
+    result.reserve(dependents_.size());
+    for (const auto& dependent : dependents_) {
+        if (auto computed = dependent.lock()) {
+            result.push_back(std::move(computed));
+        }
+    }
+    return result;
+}
+
+bool ComputedCore::isObserved() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!subscribers_.empty()) return true;
+    for (const auto& dependent : dependents_) {
+        if (!dependent.expired()) return true;
+    }
+    return false;
+}
+
+bool ComputedCore::markDirty() {
+    return !dirty_.exchange(true, std::memory_order_acq_rel);
+}
+
+ComputedCore::SubscriberId ComputedCore::subscribe(Callback callback) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    SubscriberId id = nextId_++;
+    subscribers_.emplace_back(id, std::move(callback));
+    return id;
+}
+
+void ComputedCore::unsubscribe(SubscriberId id) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    subscribers_.erase(
+        std::remove_if(subscribers_.begin(), subscribers_.end(),
+            [id](const auto& pair) { return pair.first == id; }),
+        subscribers_.end()
+    );
+}
+
+void ComputedCore::notify() {
+    std::vector<Callback> callbacksCopy;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        callbacksCopy.reserve(subscribers_.size());
+        for (const auto& [_, callback] : subscribers_) {
+            callbacksCopy.push_back(callback);
+        }
+    }
+
+    // Call subscribers outside lock
+    for (const auto& callback : callbacksCopy) {
+        callback();
+    }
+}
+
+std::vector<std::shared_ptr<ComputedCore>> ComputedCore::invalidate(
+    std::vector<std::shared_ptr<ComputedCore>> roots
+) {
+    auto byHeight = [](const std::shared_ptr<ComputedCore>& a, const std::shared_ptr<ComputedCore>& b) {
+        return a->height() > b->height();
+    };
+    std::priority_queue<std::shared_ptr<ComputedCore>, std::vector<std::shared_ptr<ComputedCore>>, decltype(byHeight)>
+        queue(byHeight, std::move(roots));
+    std::unordered_set<ComputedCore*> visited;
+    std::vector<std::shared_ptr<ComputedCore>> invalidated;
+
+    while (!queue.empty()) {
+        auto node = queue.top();
+        queue.pop();
+        if (!visited.insert(node.get()).second) {
+            continue;
+        }
+
+        // Keep walking through nodes that were already dirty: a downstream
+        // node may have been recomputed without reading this one.
+        if (node->markDirty()) {
+            invalidated.push_back(node);
+        }
+        for (auto& dependent : node->dependents()) {
+            queue.push(std::move(dependent));
+        }
+    }
+
+    return invalidated;
 }
 
-} // namespace nitrostate
+} // namespace margelo::nitro::nitrostate
@@ -1,60 +1,252 @@
 #pragma once
 
+#include <NitroModules/AnyMap.hpp>
+#include <NitroModules/Promise.hpp>
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <vector>
 #include <memory>
-#include <jsi/jsi.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include "AtomCore.hpp"
+#include "RefCount.hpp"
 
-namespace nitrostate {
+namespace margelo::nitro::nitrostate {
 
-using namespace facebook;
+using namespace margelo::nitro;
 
 /**
  * ComputedCore - Derived/computed reactive value
- * 
- * Lazily computes a value based on dependencies.
- * Automatically re-computes when dependencies change.
+ *
+ * A node in the dependency DAG. Sources (atoms or other computeds) push
+ * invalidation down the graph in height order; the value itself is pulled
+ * and recomputed lazily on the next read.
+ *
+ * Sources are whatever the compute function read on its last run, and
+ * sources a run no longer reads are dropped once it completes. Reads made
+ * on the thread that calls the compute function are recorded through a
+ * thread-local tracking context (see track()); a compute function that
+ * runs elsewhere, like a JS callback scheduled on the JS thread, reports
+ * its reads with the run id it was called with. A run completes when the
+ * promise it returned resolves.
  */
-class ComputedCore {
+class ComputedCore : public std::enable_shared_from_this<ComputedCore> {
 public:
-    using ComputeFn = std::function<jsi::Value(jsi::Runtime&)>;
+    using RunId = uint32_t;
+    using ComputeFn = std::function<std::shared_ptr<Promise<std::shared_ptr<AnyMap>>>(RunId run)>;
+    using SubscriberId = size_t;
+    using Callback = std::function<void()>;
 
-    explicit ComputedCore(ComputeFn compute);
-    ~ComputedCore();
+    enum class Mode {
+        // get() waits for the compute function to finish
+        Blocking,
+        // get() returns the cached value right away and recomputes in the background
+        Async,
+    };
 
-    // Non-copyable, movable
+    ComputedCore(
+        std::string key,
+        ComputeFn compute,
+        Mode mode = Mode::Blocking,
+        std::shared_ptr<AnyMap> placeholder = nullptr
+    );
+    ~ComputedCore() = default;
+
+    // Non-copyable, non-movable (dependencies hold weak references)
     ComputedCore(const ComputedCore&) = delete;
     ComputedCore& operator=(const ComputedCore&) = delete;
-    ComputedCore(ComputedCore&&) = default;
-    ComputedCore& operator=(ComputedCore&&) = default;
+
+    const std::string& key() const { return key_; }
 
     /**
-     * Get the computed value (lazy evaluation)
+     * Get the computed value (lazy evaluation).
+     * In async mode this never waits: it returns the last value (or the
+     * placeholder) and schedules a recompute if the node is dirty.
+     * Throws in blocking mode if called by this node's own compute function.
      */
-    jsi::Value get(jsi::Runtime& rt);
+    std::shared_ptr<AnyMap> get();
+
+    /**
+     * True while an async node has no value yet or a recompute is in flight
+     */
+    bool isPending() const;
 
     /**
      * Add a dependency atom
      */
-    void addDependency(AtomCore* atom);
+    void addDependency(const std::shared_ptr<AtomCore>& atom);
+
+    /**
+     * Add a dependency on another computed. Throws if `computed` already
+     * depends on this node, directly or through others.
+     */
+    void addDependency(const std::shared_ptr<ComputedCore>& computed);
+
+    /**
+     * Record a read by the compute function running on this thread, if
+     * any. A source read for the first time becomes a dependency right
+     * away, so a write landing mid-run still invalidates the node.
+     */
+    static void track(AtomCore& atom);
+    static void track(ComputedCore& computed);
+
+    /**
+     * Record a read reported by run `run` of this node, from any thread.
+     * Ignored once that run has completed or failed.
+     */
+    void track(RunId run, AtomCore& atom);
+    void track(RunId run, ComputedCore& computed);
 
     /**
      * Mark as dirty (called when any dependency changes)
+     * @return true if the node was clean before
      */
-    void markDirty();
+    bool markDirty();
 
     /**
      * Check if needs recomputation
      */
-    bool isDirty() const { return dirty_; }
+    bool isDirty() const { return dirty_.load(std::memory_order_acquire); }
+
+    /**
+     * Longest path from any atom to this node. Atoms have height 0, so a
+     * node always has a greater height than everything it reads.
+     */
+    uint32_t height() const { return height_.load(std::memory_order_acquire); }
+
+    /**
+     * Live computeds that read this computed
+     */
+    std::vector<std::shared_ptr<ComputedCore>> dependents() const;
+
+    /**
+     * Whether subscribers or live computeds still depend on this node
+     */
+    bool isObserved() const;
+
+    /**
+     * References held from JS; the collector reclaims the node once they
+     * are gone and nothing observes it
+     */
+    RefCount& refs() { return refs_; }
+
+    /**
+     * Subscribe to invalidation of this computed
+     */
+    SubscriberId subscribe(Callback callback);
+
+    /**
+     * Unsubscribe from invalidation
+     */
+    void unsubscribe(SubscriberId id);
+
+    /**
+     * Notify all subscribers
+     */
+    void notify();
+
+    /**
+     * Push-dirty phase: mark every computed downstream of `roots` dirty,
+     * visiting each node exactly once in height order.
+     * @return Nodes that went from clean to dirty, sorted by height
+     */
+    static std::vector<std::shared_ptr<ComputedCore>> invalidate(
+        std::vector<std::shared_ptr<ComputedCore>> roots
+    );
 
 private:
+    /**
+     * One run of the compute function. Reads arrive through the thread
+     * that started it or through its id, until the run finishes.
+     */
+    class Run {
+    public:
+        Run(ComputedCore& computed, RunId id) : computed(computed), id(id) {}
+
+        void read(AtomCore& atom);
+        void read(ComputedCore& source);
+
+        // Stop recording; `complete` also drops the node's sources this
+        // run did not read. A failed run keeps every source, old and new
+        void finish(bool complete);
+
+        ComputedCore& computed;
+        const RunId id;
+
+    private:
+        // Whether `source` was already read by this run; records it if not
+        bool firstRead(const void* source);
+
+        std::mutex mutex_;
+        bool finished_ = false;
+        // Most nodes read only a handful of sources
+        std::vector<const void*> reads_;
+    };
+
+    /**
+     * Makes a run current on this thread while the compute function is
+     * called. Scopes nest when a compute function reads a dirty computed.
+     */
+    class RunScope {
+    public:
+        explicit RunScope(Run& run) : outer_(currentRun_) { currentRun_ = &run; }
+        ~RunScope() { currentRun_ = outer_; }
+
+    private:
+        Run* outer_;
+    };
+
+    static thread_local Run* currentRun_;
+
+    // Start the next run; the previous one must have finished
+    std::shared_ptr<Run> startRun();
+    std::shared_ptr<Run> runWithId(RunId id) const;
+
+    void addDependent(const std::shared_ptr<ComputedCore>& computed);
+    void removeDependent(const ComputedCore* computed);
+    // Whether `target` is this node or depends on it, directly or through others
+    bool reaches(const ComputedCore& target);
+    // Lift the height to at least `required`, and every dependent above it
+    void raiseHeight(uint32_t required);
+    std::shared_ptr<AnyMap> getBlocking();
+    std::shared_ptr<AnyMap> getAsync();
+    void onRecomputed(const std::shared_ptr<AnyMap>& result);
+    void onRecomputeFailed();
+
+    std::string key_;
     ComputeFn compute_;
-    std::vector<AtomCore*> dependencies_;
-    std::vector<AtomCore::SubscriberId> subscriptionIds_;
-    std::shared_ptr<jsi::Value> cachedValue_;
-    bool dirty_ = true;
+    Mode mode_;
+    std::vector<std::weak_ptr<ComputedCore>> dependents_;
+    // Sources by address; an expired entry may share its address with a
+    // newer node and is replaced when that one is read. Only touched before
+    // the node is published and by its runs, which never overlap and each
+    // record under their own lock
+    std::unordered_map<const AtomCore*, std::weak_ptr<AtomCore>> atomSources_;
+    std::unordered_map<const ComputedCore*, std::weak_ptr<ComputedCore>> computedSources_;
+    std::vector<std::pair<SubscriberId, Callback>> subscribers_;
+    SubscriberId nextId_ = 0;
+    std::shared_ptr<AnyMap> cachedValue_;
+    bool hasValue_ = false;
+    bool computing_ = false;
+    // Latest run, kept so reads reported by id can find it
+    std::shared_ptr<Run> run_;
+    RunId nextRun_ = 0;
+    std::atomic<bool> dirty_{true};
+    std::atomic<uint32_t> height_{1};
+    RefCount refs_;
+    // Serializes blocking recomputation
+    std::mutex computeMutex_;
+    // Thread holding computeMutex_, so a re-entrant read fails instead of
+    // waiting on itself
+    std::atomic<std::thread::id> computingThread_{};
+    // Makes checking for a cycle and adding an edge between computeds one
+    // step, so two runs can't close a cycle from both ends
+    static std::mutex edgesMutex_;
+    // Guards dependents, subscribers, the cached value and the latest run
+    mutable std::mutex mutex_;
 };
 
-} // namespace nitrostate
+} // namespace margelo::nitro::nitrostate
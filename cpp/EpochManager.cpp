@@ -0,0 +1,143 @@
+#include "EpochManager.hpp"
+#include <algorithm>
+#include <atomic>
+
+namespace margelo::nitro::nitrostate {
+
+EpochManager& EpochManager::instance() {
+    static EpochManager instance;
+    return instance;
+}
+
+EpochManager::~EpochManager() {
+    for (auto& item : orphans_) {
+        item.deleter(item.ptr);
+    }
+    for (auto* record = records_.load(); record != nullptr; record = record->next) {
+        for (auto& item : record->retired) {
+            item.deleter(item.ptr);
+        }
+    }
+}
+
+EpochManager::Guard::Guard() {
+    EpochManager::instance().enter();
+}
+
+EpochManager::Guard::~Guard() {
+    EpochManager::instance().exit();
+}
+
+EpochManager::ThreadRecord* EpochManager::localRecord() {
+    // Hands the record back when the owning thread exits
+    struct Owner {
+        ThreadRecord* record = nullptr;
+        ~Owner() {
+            if (record != nullptr) {
+                EpochManager::instance().releaseRecord(record);
+            }
+        }
+    };
+    thread_local Owner owner;
+
+    if (owner.record == nullptr) {
+        owner.record = acquireRecord();
+    }
+    return owner.record;
+}
+
+EpochManager::ThreadRecord* EpochManager::acquireRecord() {
+    // Reuse a record left behind by an exited thread
+    for (auto* record = records_.load(); record != nullptr; record = record->next) {
+        bool expected = false;
+        if (record->inUse.compare_exchange_strong(expected, true)) {
+            return record;
+        }
+    }
+
+    auto* record = new ThreadRecord();
+    record->inUse.store(true);
+    record->next = records_.load();
+    while (!records_.compare_exchange_weak(record->next, record)) {
+    }
+    return record;
+}
+
+void EpochManager::releaseRecord(ThreadRecord* record) {
+    if (!record->retired.empty()) {
+        std::lock_guard<std::mutex> lock(orphansMutex_);
+        orphans_.insert(orphans_.end(), record->retired.begin(), record->retired.end());
+        record->retired.clear();
+    }
+    record->epoch.store(kInactive);
+    record->inUse.store(false);
+}
+
+void EpochManager::enter() {
+    auto* record = localRecord();
+    if (record->depth++ > 0) return;
+    record->epoch.store(globalEpoch_.load());
+    // Pairs with the fence in reclaim(): the announcement is visible to a
+    // reclaimer before this reader loads any pointer it could free
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+}
+
+void EpochManager::exit() {
+    auto* record = localRecord();
+    if (--record->depth > 0) return;
+    record->epoch.store(kInactive);
+}
+
+void EpochManager::retire(void* ptr, void (*deleter)(void*)) {
+    auto* record = localRecord();
+    record->retired.push_back({ptr, deleter, globalEpoch_.load()});
+    if (record->retired.size() >= kReclaimThreshold) {
+        reclaim();
+    }
+}
+
+uint64_t EpochManager::minActiveEpoch() const {
+    uint64_t minActive = kInactive;
+    for (auto* record = records_.load(); record != nullptr; record = record->next) {
+        minActive = std::min(minActive, record->epoch.load());
+    }
+    return minActive;
+}
+
+void EpochManager::reclaim() {
+    // Everything in these lists was unlinked before the scan below, so the
+    // scan observes every reader that could still hold one of them
+    auto* record = localRecord();
+    std::vector<Retired> orphans;
+    {
+        std::unique_lock<std::mutex> lock(orphansMutex_, std::try_to_lock);
+        if (lock.owns_lock()) {
+            orphans.swap(orphans_);
+        }
+    }
+
+    // Pairs with the fence in enter(): a reader that announced itself too
+    // late to be seen by the scan also sees every unlink made before it
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    uint64_t minActive = minActiveEpoch();
+    reclaim(record->retired, minActive);
+    if (!orphans.empty()) {
+        reclaim(orphans, minActive);
+        std::lock_guard<std::mutex> lock(orphansMutex_);
+        orphans_.insert(orphans_.end(), orphans.begin(), orphans.end());
+    }
+
+    // Readers entering from now on cannot observe anything retired so far
+    globalEpoch_.fetch_add(1);
+}
+
+void EpochManager::reclaim(std::vector<Retired>& retired, uint64_t minActive) {
+    auto split = std::partition(retired.begin(), retired.end(),
+        [minActive](const Retired& item) { return item.epoch >= minActive; });
+    for (auto it = split; it != retired.end(); ++it) {
+        it->deleter(it->ptr);
+    }
+    retired.erase(split, retired.end());
+}
+
+} // namespace margelo::nitro::nitrostate
@@ -0,0 +1,94 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+
+namespace margelo::nitro::nitrostate {
+
+/**
+ * EpochManager - Epoch-based memory reclamation
+ *
+ * Lets readers dereference atomically published pointers without taking a lock.
+ * Writers unlink a node and hand it to retire(); the node is freed once every
+ * reader that could still observe it has left its critical section.
+ */
+class EpochManager {
+public:
+    /**
+     * RAII read-side critical section. Nesting is allowed.
+     */
+    class Guard {
+    public:
+        Guard();
+        ~Guard();
+
+        Guard(const Guard&) = delete;
+        Guard& operator=(const Guard&) = delete;
+    };
+
+    /**
+     * Get singleton instance
+     */
+    static EpochManager& instance();
+
+    /**
+     * Defer deletion of an unlinked node until no reader can reach it
+     */
+    template <typename T>
+    void retire(const T* ptr) {
+        if (ptr == nullptr) return;
+        retire(const_cast<T*>(ptr), [](void* p) { delete static_cast<T*>(p); });
+    }
+
+    /**
+     * Free every node retired by the calling thread (plus nodes left behind
+     * by exited threads) that is no longer reachable by readers
+     */
+    void reclaim();
+
+    ~EpochManager();
+
+private:
+    static constexpr uint64_t kInactive = UINT64_MAX;
+    static constexpr size_t kReclaimThreshold = 64;
+
+    struct Retired {
+        void* ptr;
+        void (*deleter)(void*);
+        uint64_t epoch;
+    };
+
+    // Per-thread announcement slot and retire list. Records are recycled when
+    // their thread exits but never freed, so a late thread-exit never touches
+    // freed memory. The retire list is only touched by the owning thread, so
+    // writers never share a lock to retire nodes.
+    struct ThreadRecord {
+        std::atomic<uint64_t> epoch{kInactive};
+        std::atomic<bool> inUse{false};
+        ThreadRecord* next = nullptr;
+        unsigned depth = 0;
+        std::vector<Retired> retired;
+    };
+
+    EpochManager() = default;
+
+    void retire(void* ptr, void (*deleter)(void*));
+    void enter();
+    void exit();
+    ThreadRecord* localRecord();
+    ThreadRecord* acquireRecord();
+    void releaseRecord(ThreadRecord* record);
+    uint64_t minActiveEpoch() const;
+    void reclaim(std::vector<Retired>& retired, uint64_t minActive);
+
+    std::atomic<ThreadRecord*> records_{nullptr};
+    std::atomic<uint64_t> globalEpoch_{0};
+
+    // Nodes left behind by threads that exited before they could be freed
+    std::vector<Retired> orphans_;
+    std::mutex orphansMutex_;
+};
+
+} // namespace margelo::nitro::nitrostate
@@ -1,192 +1,1366 @@
 #include "HybridNitroState.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <thread>
 
 namespace margelo::nitro::nitrostate {
 
-// ----- Atom Operations -----
+// ----- Slot Helpers -----
 
-void HybridNitroState::createAtom(
+HybridNitroState::Shard& HybridNitroState::shardForKey(const std::string& key) {
+    return shards_[std::hash<std::string>{}(key) & (kShardCount - 1)];
+}
+
+HybridNitroState::Shard& HybridNitroState::shardForHandle(AtomHandle handle) {
+    return shards_[handle & (kShardCount - 1)];
+}
+
+AtomCore& HybridNitroState::atomForHandle(AtomHandle handle) const {
+    auto* slot = shards_[handle & (kShardCount - 1)].slots.at(handle >> kShardBits);
+    AtomCore* atom = slot != nullptr ? slot->atom.load(std::memory_order_acquire) : nullptr;
+    if (atom == nullptr) {
+        throw std::runtime_error("Atom with handle " + std::to_string(handle) + " not found");
+    }
+    return *atom;
+}
+
+HybridNitroState::AtomHandle HybridNitroState::createSlot(
+    Shard& shard,
     const std::string& key,
-    const std::shared_ptr<AnyMap>& initialValue
+    std::shared_ptr<AtomCore> atom
 ) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    if (atoms_.find(key) != atoms_.end()) {
+    std::unique_lock<std::shared_mutex> keysLock(shard.keysMutex);
+    if (shard.handles.find(key) != shard.handles.end()) {
         throw std::runtime_error("Atom with key '" + key + "' already exists");
     }
-    
-    atoms_[key] = initialValue;
+    if (shard.slots.size() == (std::numeric_limits<AtomHandle>::max() >> kShardBits)) {
+        throw std::runtime_error("Atom handle space exhausted");
+    }
+
+    uint32_t index = shard.slots.allocate();
+    auto* slot = shard.slots.at(index);
+    slot->owner = std::move(atom);
+    slot->atom.store(slot->owner.get(), std::memory_order_release);
+
+    auto shardIndex = static_cast<AtomHandle>(&shard - shards_.data());
+    AtomHandle handle = (index << kShardBits) | shardIndex;
+    shard.handles.emplace(key, handle);
+    return handle;
+}
+
+std::optional<HybridNitroState::AtomHandle> HybridNitroState::findHandle(const std::string& key) {
+    auto& shard = shardForKey(key);
+    std::shared_lock<std::shared_mutex> lock(shard.keysMutex);
+    auto it = shard.handles.find(key);
+    if (it == shard.handles.end()) {
+        return std::nullopt;
+    }
+    return it->second;
 }
 
-std::shared_ptr<AnyMap> HybridNitroState::getAtomValue(const std::string& key) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    auto it = atoms_.find(key);
-    if (it == atoms_.end()) {
+HybridNitroState::AtomHandle HybridNitroState::handleForKey(const std::string& key) {
+    auto handle = findHandle(key);
+    if (!handle) {
         throw std::runtime_error("Atom with key '" + key + "' not found");
     }
-    
-    return it->second;
+    return *handle;
+}
+
+std::vector<HybridNitroState::AtomHandle> HybridNitroState::handlesForKeys(const std::vector<std::string>& keys) {
+    std::array<std::vector<uint32_t>, kShardCount> byShard;
+    for (uint32_t i = 0; i < keys.size(); i++) {
+        byShard[std::hash<std::string>{}(keys[i]) & (kShardCount - 1)].push_back(i);
+    }
+
+    std::vector<AtomHandle> handles(keys.size());
+    for (size_t index = 0; index < kShardCount; index++) {
+        if (byShard[index].empty()) continue;
+        auto& shard = shards_[index];
+        std::shared_lock<std::shared_mutex> lock(shard.keysMutex);
+        for (uint32_t i : byShard[index]) {
+            auto it = shard.handles.find(keys[i]);
+            if (it == shard.handles.end()) {
+                throw std::runtime_error("Atom with key '" + keys[i] + "' not found");
+            }
+            handles[i] = it->second;
+        }
+    }
+    return handles;
+}
+
+HybridNitroState::AtomHandle HybridNitroState::toHandle(double handle) {
+    if (!(handle >= 0) || handle > std::numeric_limits<AtomHandle>::max() || std::floor(handle) != handle) {
+        throw std::runtime_error("Invalid atom handle " + std::to_string(handle));
+    }
+    return static_cast<AtomHandle>(handle);
+}
+
+uint64_t HybridNitroState::toVersion(double version) {
+    if (!(version >= 0) || version > 9007199254740992.0 || std::floor(version) != version) {
+        throw std::runtime_error("Invalid atom version " + std::to_string(version));
+    }
+    return static_cast<uint64_t>(version);
+}
+
+uint32_t HybridNitroState::toId(double id, const char* kind) {
+    if (!(id >= 0) || id > std::numeric_limits<uint32_t>::max() || std::floor(id) != id) {
+        throw std::runtime_error(std::string("Invalid ") + kind + " id " + std::to_string(id));
+    }
+    return static_cast<uint32_t>(id);
+}
+
+std::shared_ptr<AnyMap> HybridNitroState::getValue(AtomHandle handle) {
+    // Lock-free: the epoch guard keeps the atom alive while we read it
+    EpochManager::Guard guard;
+    auto& atom = atomForHandle(handle);
+    ComputedCore::track(atom);
+    return atom.get();
+}
+
+void HybridNitroState::setValue(AtomHandle handle, const std::shared_ptr<AnyMap>& value) {
+    std::shared_ptr<AtomCore> atom;
+    {
+        EpochManager::Guard guard;
+        auto& core = atomForHandle(handle);
+        if (!core.set(value, clock_)) {
+            // Equal to the current value: nothing to publish or notify
+            return;
+        }
+        atom = core.shared_from_this();
+    }
+    propagate(handle, atom);
+}
+
+AtomCore::CompareResult HybridNitroState::compareAndSetValue(
+    AtomHandle handle,
+    uint64_t expectedVersion,
+    const std::shared_ptr<AnyMap>& value
+) {
+    auto result = AtomCore::CompareResult::CONFLICT;
+    write(handle, [&](AtomCore& atom) {
+        result = atom.compareAndSet(expectedVersion, value, clock_);
+        return result == AtomCore::CompareResult::WRITTEN;
+    });
+    return result;
+}
+
+void HybridNitroState::write(AtomHandle handle, const std::function<bool(AtomCore&)>& apply) {
+    std::shared_ptr<AtomCore> atom;
+    {
+        EpochManager::Guard guard;
+        auto& core = atomForHandle(handle);
+        if (!apply(core)) {
+            return;
+        }
+        atom = core.shared_from_this();
+    }
+    propagate(handle, atom);
+}
+
+void HybridNitroState::propagate(AtomHandle handle, const std::shared_ptr<AtomCore>& atom) {
+    // Invalidate the whole downstream graph before anyone is notified, so
+    // subscribers never observe a mix of fresh and stale derived values
+    auto invalidated = ComputedCore::invalidate(atom->dependents());
+    logWrite(*atom);
+
+    // Notify outside the epoch so subscribers may call back into the state
+    if (!batch_.queueNotification(handle, atom, invalidated) &&
+        !scheduler_.enqueue(handle, atom, invalidated)) {
+        atom->notify();
+        for (const auto& computed : invalidated) {
+            computed->notify();
+        }
+    }
+}
+
+void HybridNitroState::logWrite(const AtomCore& atom) {
+    auto* log = logPtr_.load(std::memory_order_acquire);
+    if (log == nullptr || !atom.isPersisted()) return;
+
+    // Version first: a newer value only gets logged again under its own
+    uint64_t commit = atom.commitVersion();
+    log->put(atom.key(), storeBase_ + commit, atom.get());
+}
+
+void HybridNitroState::logCurrent(const AtomCore& atom) {
+    auto* log = logPtr_.load(std::memory_order_acquire);
+    if (log == nullptr) return;
+
+    // Once every commit up to this one is published, the value read next
+    // is at least as new as the commit it is logged under
+    uint64_t commit = clock_.begin();
+    clock_.complete(commit);
+    clock_.waitFor(commit);
+    log->put(atom.key(), storeBase_ + commit, atom.get());
+}
+
+std::function<void()> HybridNitroState::subscribe(
+    AtomHandle handle,
+    const std::function<void()>& callback
+) {
+    EpochManager::Guard guard;
+    auto& atom = atomForHandle(handle);
+    auto subscriberId = atom.subscribe(callback);
+    if (!outlivesDetach(handle, atom)) {
+        atom.unsubscribe(subscriberId);
+        throw std::runtime_error("Atom with handle " + std::to_string(handle) + " not found");
+    }
+
+    // Return unsubscribe function
+    return [weakAtom = atom.weak_from_this(), subscriberId]() {
+        if (auto atom = weakAtom.lock()) {
+            atom->unsubscribe(subscriberId);
+        }
+    };
+}
+
+// ----- Atom Operations -----
+
+void HybridNitroState::createAtom(
+    const std::string& key,
+    const std::shared_ptr<AnyMap>& initialValue
+) {
+    auto& shard = shardForKey(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    createSlot(shard, key, std::make_shared<AtomCore>(key, initialValue));
+}
+
+double HybridNitroState::createAtomHandle(
+    const std::string& key,
+    const std::shared_ptr<AnyMap>& initialValue
+) {
+    auto& shard = shardForKey(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    return createSlot(shard, key, std::make_shared<AtomCore>(key, initialValue));
+}
+
+void HybridNitroState::setAtomEquality(const std::string& key, EqualityMode mode) {
+    auto handle = handleForKey(key);
+    EpochManager::Guard guard;
+    atomForHandle(handle).setEqualityMode(mode);
+}
+
+double HybridNitroState::getAtomHandle(const std::string& key) {
+    return handleForKey(key);
+}
+
+std::shared_ptr<AnyMap> HybridNitroState::getAtomValue(const std::string& key) {
+    return getValue(handleForKey(key));
 }
 
 void HybridNitroState::setAtomValue(
     const std::string& key,
     const std::shared_ptr<AnyMap>& value
 ) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    auto it = atoms_.find(key);
-    if (it == atoms_.end()) {
-        throw std::runtime_error("Atom with key '" + key + "' not found");
+    setValue(handleForKey(key), value);
+}
+
+std::function<void()> HybridNitroState::subscribeAtom(
+    const std::string& key,
+    const std::function<void()>& callback
+) {
+    return subscribe(handleForKey(key), callback);
+}
+
+void HybridNitroState::deleteAtom(const std::string& key) {
+    detachAtom(key);
+}
+
+std::shared_ptr<AtomCore> HybridNitroState::detachAtom(const std::string& key, bool onlyIfIdle) {
+    auto& shard = shardForKey(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    std::unique_lock<std::shared_mutex> keysLock(shard.keysMutex);
+    auto it = shard.handles.find(key);
+    if (it == shard.handles.end()) {
+        return nullptr;
     }
-    
-    it->second = value;
-    
-    // Notify subscribers
-    if (isBatching_) {
-        pendingNotifications_.push_back(key);
-    } else {
-        auto subIt = subscribers_.find(key);
-        if (subIt != subscribers_.end()) {
-            for (const auto& [id, callback] : subIt->second) {
-                callback();
-            }
+
+    auto* slot = shard.slots.at(it->second >> kShardBits);
+    auto atom = slot->owner;
+    if (onlyIfIdle) {
+        // Subscribing and retaining take none of these locks, so announce
+        // the detach before looking; see outlivesDetach() for the other side
+        slot->detaching.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (atom->refs().isHeld() || atom->isObserved()) {
+            slot->detaching.store(false, std::memory_order_release);
+            return nullptr;
         }
     }
+    auto* log = logPtr_.load(std::memory_order_acquire);
+    if (log != nullptr && atom->isPersisted()) {
+        uint64_t commit = clock_.begin();
+        clock_.complete(commit);
+        log->remove(key, storeBase_ + commit);
+    }
+    retireSlot(*slot);
+    shard.handles.erase(it);
+    slot->detaching.store(false, std::memory_order_release);
+    return atom;
 }
 
-std::function<void()> HybridNitroState::subscribeAtom(
+bool HybridNitroState::outlivesDetach(AtomHandle handle, const AtomCore& atom) const {
+    auto* slot = shards_[handle & (kShardCount - 1)].slots.at(handle >> kShardBits);
+    // Either the eviction sees the new subscriber or reference after its
+    // fence, or this sees it announced and waits for the outcome
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    while (slot->detaching.load(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+    return slot->atom.load(std::memory_order_acquire) == &atom;
+}
+
+void HybridNitroState::retireSlot(AtomSlot& slot) {
+    // Handles are never reused, so the slot just becomes a tombstone.
+    // Lock-free readers may still hold the raw pointer, so ownership is
+    // released through the epoch manager.
+    slot.atom.store(nullptr, std::memory_order_release);
+    EpochManager::instance().retire(new std::shared_ptr<AtomCore>(std::move(slot.owner)));
+}
+
+// ----- Bulk Operations -----
+
+std::vector<std::shared_ptr<AnyMap>> HybridNitroState::getMany(const std::vector<std::string>& keys) {
+    auto handles = handlesForKeys(keys);
+    std::vector<std::shared_ptr<AnyMap>> values;
+    values.reserve(handles.size());
+    EpochManager::Guard guard;
+    for (auto handle : handles) {
+        auto& atom = atomForHandle(handle);
+        ComputedCore::track(atom);
+        values.push_back(atom.get());
+    }
+    return values;
+}
+
+void HybridNitroState::setMany(
+    const std::vector<std::string>& keys,
+    const std::vector<std::shared_ptr<AnyMap>>& values
+) {
+    if (keys.size() != values.size()) {
+        throw std::runtime_error("setMany expects one value per key");
+    }
+    // Every key is resolved before anything is written
+    auto handles = handlesForKeys(keys);
+
+    // Deliver the writes as one batch: each atom and computed once
+    batch_.startBatch();
+    try {
+        for (size_t i = 0; i < handles.size(); i++) {
+            setValue(handles[i], values[i]);
+        }
+    } catch (...) {
+        endBatch();
+        throw;
+    }
+    endBatch();
+}
+
+// ----- Handle-based Atom Operations -----
+
+std::shared_ptr<AnyMap> HybridNitroState::getAtomValueByHandle(double handle) {
+    return getValue(toHandle(handle));
+}
+
+void HybridNitroState::setAtomValueByHandle(double handle, const std::shared_ptr<AnyMap>& value) {
+    setValue(toHandle(handle), value);
+}
+
+std::function<void()> HybridNitroState::subscribeAtomByHandle(
+    double handle,
+    const std::function<void()>& callback
+) {
+    return subscribe(toHandle(handle), callback);
+}
+
+// ----- Nested Values -----
+
+void HybridNitroState::setIn(
+    const std::string& key,
+    const std::vector<std::string>& path,
+    const std::shared_ptr<AnyMap>& value
+) {
+    if (!value || !value->contains("value")) {
+        throw std::runtime_error("setIn expects the new value wrapped as { value }");
+    }
+    auto leaf = value->getAny("value");
+    write(handleForKey(key), [&](AtomCore& atom) {
+        return atom.setIn(path, leaf, clock_);
+    });
+}
+
+std::shared_ptr<AnyMap> HybridNitroState::getIn(
+    const std::string& key,
+    const std::vector<std::string>& path
+) {
+    auto handle = handleForKey(key);
+    std::optional<AnyValue> leaf;
+    {
+        EpochManager::Guard guard;
+        auto& atom = atomForHandle(handle);
+        ComputedCore::track(atom);
+        leaf = atom.getIn(path);
+    }
+
+    auto result = AnyMap::make();
+    if (leaf) {
+        result->setAny("value", *leaf);
+    }
+    return result;
+}
+
+std::function<void()> HybridNitroState::subscribePath(
     const std::string& key,
+    const std::vector<std::string>& path,
     const std::function<void()>& callback
 ) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    auto it = atoms_.find(key);
-    if (it == atoms_.end()) {
-        throw std::runtime_error("Atom with key '" + key + "' not found");
+    auto handle = handleForKey(key);
+    EpochManager::Guard guard;
+    auto& atom = atomForHandle(handle);
+    auto subscriberId = atom.subscribePath(path, callback);
+    if (!outlivesDetach(handle, atom)) {
+        atom.unsubscribePath(subscriberId);
+        throw std::runtime_error("Atom '" + key + "' not found");
     }
-    
-    size_t subscriberId = nextSubscriberId_++;
-    subscribers_[key].push_back({subscriberId, callback});
-    
-    // Return unsubscribe function
-    return [this, key, subscriberId]() {
-        std::lock_guard<std::mutex> lock(mutex_);
-        auto& subs = subscribers_[key];
-        subs.erase(
-            std::remove_if(subs.begin(), subs.end(),
-                [subscriberId](const auto& pair) { return pair.first == subscriberId; }),
-            subs.end()
-        );
+
+    return [weakAtom = atom.weak_from_this(), subscriberId]() {
+        if (auto atom = weakAtom.lock()) {
+            atom->unsubscribePath(subscriberId);
+        }
     };
 }
 
-void HybridNitroState::deleteAtom(const std::string& key) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    atoms_.erase(key);
-    subscribers_.erase(key);
+// ----- Patches -----
+
+namespace {
+
+AnyArray itemsOf(const std::shared_ptr<AnyMap>& items, const char* operation) {
+    if (!items || !items->contains("value") || !items->isArray("value")) {
+        throw std::runtime_error(std::string(operation) + " expects the items wrapped as { value: [...] }");
+    }
+    return items->getArray("value");
+}
+
+} // namespace
+
+void HybridNitroState::mergeAtom(const std::string& key, const std::shared_ptr<AnyMap>& partial) {
+    if (!partial) {
+        return;
+    }
+    write(handleForKey(key), [&](AtomCore& atom) {
+        return atom.merge(*partial, clock_);
+    });
+}
+
+double HybridNitroState::increment(
+    const std::string& key,
+    const std::vector<std::string>& path,
+    double delta
+) {
+    double result = 0;
+    write(handleForKey(key), [&](AtomCore& atom) {
+        return atom.increment(path, delta, clock_, result);
+    });
+    return result;
+}
+
+double HybridNitroState::push(
+    const std::string& key,
+    const std::vector<std::string>& path,
+    const std::shared_ptr<AnyMap>& items
+) {
+    auto values = itemsOf(items, "push");
+    AnyArray removed;
+    size_t length = 0;
+    write(handleForKey(key), [&](AtomCore& atom) {
+        // Past the end is clamped to the length, so this appends
+        return atom.splice(path, std::numeric_limits<double>::infinity(), 0, values, clock_, removed, length);
+    });
+    return static_cast<double>(length);
+}
+
+std::shared_ptr<AnyMap> HybridNitroState::splice(
+    const std::string& key,
+    const std::vector<std::string>& path,
+    double start,
+    double deleteCount,
+    const std::shared_ptr<AnyMap>& items
+) {
+    auto values = itemsOf(items, "splice");
+    AnyArray removed;
+    size_t length = 0;
+    write(handleForKey(key), [&](AtomCore& atom) {
+        return atom.splice(path, start, deleteCount, values, clock_, removed, length);
+    });
+
+    auto result = AnyMap::make();
+    result->setArray("value", removed);
+    return result;
+}
+
+// ----- Versions -----
+
+bool HybridNitroState::compareAndSet(
+    const std::string& key,
+    double expectedVersion,
+    const std::shared_ptr<AnyMap>& value
+) {
+    auto result = compareAndSetValue(handleForKey(key), toVersion(expectedVersion), value);
+    return result != AtomCore::CompareResult::CONFLICT;
+}
+
+bool HybridNitroState::compareAndSetByHandle(
+    double handle,
+    double expectedVersion,
+    const std::shared_ptr<AnyMap>& value
+) {
+    auto result = compareAndSetValue(toHandle(handle), toVersion(expectedVersion), value);
+    return result != AtomCore::CompareResult::CONFLICT;
+}
+
+double HybridNitroState::getAtomVersion(const std::string& key) {
+    return getAtomVersionByHandle(handleForKey(key));
+}
+
+double HybridNitroState::getAtomVersionByHandle(double handle) {
+    EpochManager::Guard guard;
+    return static_cast<double>(atomForHandle(toHandle(handle)).commitVersion());
+}
+
+double HybridNitroState::getCommitVersion() {
+    return static_cast<double>(clock_.current());
+}
+
+std::vector<std::string> HybridNitroState::getChangedSince(double version) {
+    // Commits above `until` may still be in flight; they will be reported
+    // to whoever asks since getCommitVersion() next time
+    uint64_t since = toVersion(version);
+    uint64_t until = clock_.current();
+
+    std::vector<std::string> changed;
+    if (since >= until) return changed;
+
+    // Lock-free scan over every slot; deleted slots hold a null atom
+    EpochManager::Guard guard;
+    for (const auto& shard : shards_) {
+        uint32_t count = shard.slots.size();
+        for (uint32_t index = 0; index < count; ++index) {
+            const auto* slot = shard.slots.at(index);
+            const AtomCore* atom = slot != nullptr ? slot->atom.load(std::memory_order_acquire) : nullptr;
+            if (atom == nullptr) continue;
+
+            uint64_t commit = atom->commitVersion();
+            if (commit > since && commit <= until) {
+                changed.push_back(atom->key());
+            }
+        }
+    }
+    return changed;
 }
 
 // ----- Computed Operations -----
 
+namespace {
+
+// The run id goes to JS, which reports reads with it (see trackRead)
+ComputedCore::ComputeFn runWith(const std::function<std::shared_ptr<Promise<std::shared_ptr<AnyMap>>>(double)>& compute) {
+    return [compute](ComputedCore::RunId run) { return compute(static_cast<double>(run)); };
+}
+
+} // namespace
+
 void HybridNitroState::createComputed(
     const std::string& key,
     const std::vector<std::string>& dependencies,
-    const std::function<std::shared_ptr<Promise<std::shared_ptr<AnyMap>>>()>& compute
+    const std::function<std::shared_ptr<Promise<std::shared_ptr<AnyMap>>>(double /* run */)>& compute
 ) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    if (computed_.find(key) != computed_.end()) {
-        throw std::runtime_error("Computed with key '" + key + "' already exists");
+    registerComputed(std::make_shared<ComputedCore>(key, runWith(compute)), dependencies);
+}
+
+void HybridNitroState::createAsyncComputed(
+    const std::string& key,
+    const std::vector<std::string>& dependencies,
+    const std::function<std::shared_ptr<Promise<std::shared_ptr<AnyMap>>>(double /* run */)>& compute,
+    const std::shared_ptr<AnyMap>& placeholder
+) {
+    registerComputed(
+        std::make_shared<ComputedCore>(key, runWith(compute), ComputedCore::Mode::Async, placeholder),
+        dependencies
+    );
+}
+
+void HybridNitroState::createSelector(const std::string& key, const std::shared_ptr<AnyMap>& spec) {
+    if (!spec) {
+        throw std::runtime_error("createSelector expects a spec");
     }
-    
-    // Store compute function
-    computeFns_[key] = compute;
-    
-    // Subscribe to dependencies to invalidate cache
+    auto selector = std::make_shared<const Selector>(Selector::compile(*spec));
+
+    // Sources are resolved once: atoms by handle, computeds by key
+    std::vector<std::optional<AtomHandle>> handles;
+    for (const auto& source : selector->sources()) {
+        auto handle = findHandle(source);
+        if (!handle && !findComputed(source)) {
+            throw std::runtime_error("Selector source '" + source + "' not found");
+        }
+        handles.push_back(handle);
+    }
+
+    // Evaluated on the reading thread with no JS involved; atoms are read
+    // at the requested path only, without materializing the whole value.
+    // Sources skipped by and/or are dropped until read again
+    auto compute = [this, selector, handles = std::move(handles)](ComputedCore::RunId) {
+        auto value = selector->evaluate([&](size_t source, const std::vector<std::string>& path) -> std::optional<AnyValue> {
+            if (handles[source]) {
+                EpochManager::Guard guard;
+                auto& atom = atomForHandle(*handles[source]);
+                ComputedCore::track(atom);
+                return atom.getIn(path);
+            }
+            auto computed = computedForKey(selector->sources()[source]);
+            ComputedCore::track(*computed);
+            auto value = computed->get();
+            return value ? PersistentMap::getIn(*value, path) : std::nullopt;
+        });
+        return Promise<std::shared_ptr<AnyMap>>::resolved(std::move(value));
+    };
+    registerComputed(std::make_shared<ComputedCore>(key, std::move(compute)), selector->sources());
+}
+
+void HybridNitroState::registerComputed(
+    const std::shared_ptr<ComputedCore>& computed,
+    const std::vector<std::string>& dependencies
+) {
+    const auto& key = computed->key();
+
+    // Wire up the declared dependencies before publishing; from the first
+    // run on, the reads recorded while computing add and drop sources.
+    // Dependencies can be atoms or previously created computeds.
     for (const auto& depKey : dependencies) {
-        if (atoms_.find(depKey) != atoms_.end()) {
-            // When dependency changes, clear cached value
-            subscribeAtom(depKey, [this, key]() {
-                std::lock_guard<std::mutex> lock(mutex_);
-                computed_.erase(key);
-            });
+        if (auto depHandle = findHandle(depKey)) {
+            EpochManager::Guard guard;
+            computed->addDependency(atomForHandle(*depHandle).shared_from_this());
+        } else if (auto depComputed = findComputed(depKey)) {
+            computed->addDependency(depComputed);
         }
     }
+
+    auto& shard = shardForKey(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if (!shard.computeds.emplace(key, computed).second) {
+        throw std::runtime_error("Computed with key '" + key + "' already exists");
+    }
 }
 
-std::shared_ptr<AnyMap> HybridNitroState::getComputedValue(const std::string& key) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    
-    // Check cache first
-    auto cachedIt = computed_.find(key);
-    if (cachedIt != computed_.end()) {
-        return cachedIt->second;
-    }
-    
-    // Compute value
-    auto fnIt = computeFns_.find(key);
-    if (fnIt == computeFns_.end()) {
+void HybridNitroState::trackRead(const std::string& computed, double run, const std::string& key) {
+    auto reader = findComputed(computed);
+    if (!reader) {
+        // Deleted while its compute function ran; nothing left to wire up
+        return;
+    }
+    auto id = toId(run, "run");
+    if (auto handle = findHandle(key)) {
+        EpochManager::Guard guard;
+        reader->track(id, atomForHandle(*handle));
+    } else if (auto source = findComputed(key)) {
+        reader->track(id, *source);
+    } else {
+        throw std::runtime_error("Atom or computed with key '" + key + "' not found");
+    }
+}
+
+std::shared_ptr<ComputedCore> HybridNitroState::findComputed(const std::string& key) {
+    auto& shard = shardForKey(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto it = shard.computeds.find(key);
+    return it != shard.computeds.end() ? it->second : nullptr;
+}
+
+std::shared_ptr<ComputedCore> HybridNitroState::computedForKey(const std::string& key) {
+    auto computed = findComputed(key);
+    if (!computed) {
         throw std::runtime_error("Computed with key '" + key + "' not found");
     }
-    
-    // Call compute function and wait for result
-    auto promise = fnIt->second();
-    auto future = promise->await();
-    auto result = future.get();
-    
-    // Cache result
-    computed_[key] = result;
-    
-    return result;
+    return computed;
+}
+
+std::shared_ptr<AnyMap> HybridNitroState::getComputedValue(const std::string& key) {
+    auto computed = computedForKey(key);
+    ComputedCore::track(*computed);
+    return computed->get();
 }
 
+bool HybridNitroState::isComputedPending(const std::string& key) {
+    return computedForKey(key)->isPending();
+}
+
+std::function<void()> HybridNitroState::subscribeComputed(
+    const std::string& key,
+    const std::function<void()>& callback
+) {
+    auto computed = computedForKey(key);
+    auto subscriberId = computed->subscribe(callback);
+
+    // Return unsubscribe function
+    return [weakComputed = std::weak_ptr<ComputedCore>(computed), subscriberId]() {
+        if (auto computed = weakComputed.lock()) {
+            computed->unsubscribe(subscriberId);
+        }
+    };
+}
 
 void HybridNitroState::deleteComputed(const std::string& key) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    computed_.erase(key);
-    computeFns_.erase(key);
+    std::shared_ptr<ComputedCore> computed;
+    {
+        auto& shard = shardForKey(key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto it = shard.computeds.find(key);
+        if (it == shard.computeds.end()) {
+            return;
+        }
+        computed = std::move(it->second);
+        shard.computeds.erase(it);
+    }
+    // Dependencies are unsubscribed when the last reference goes away
 }
 
 // ----- Batch Operations -----
 
 void HybridNitroState::startBatch() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    isBatching_ = true;
-    pendingNotifications_.clear();
+    batch_.startBatch();
 }
 
 void HybridNitroState::endBatch() {
-    std::lock_guard<std::mutex> lock(mutex_);
-    isBatching_ = false;
-    
-    // Notify all pending subscribers
-    for (const auto& key : pendingNotifications_) {
-        auto subIt = subscribers_.find(key);
-        if (subIt != subscribers_.end()) {
-            for (const auto& [id, callback] : subIt->second) {
-                callback();
+    auto queued = batch_.endBatch();
+    if (!queued.empty() && !scheduler_.enqueue(queued)) {
+        queued.notifyAll();
+    }
+}
+
+// ----- Persistence -----
+
+std::vector<std::string> HybridNitroState::openStore(const std::string& path) {
+    std::lock_guard<std::mutex> storeLock(storeMutex_);
+    if (log_) {
+        throw std::runtime_error("A store is already open at '" + storePath_ + "'");
+    }
+    auto store = AtomStore::open(path);
+    auto records = WriteAheadLog::read(path + ".wal");
+
+    // Replay the log on top of the store file: a record wins if it is
+    // newer than the file and than every other record for its key
+    struct Latest {
+        std::string key;
+        uint64_t commit;
+        std::optional<StoredValue> value;
+    };
+    uint64_t base = store ? store->commit() : 0;
+    uint64_t newest = base;
+    std::vector<Latest> latest;
+    std::unordered_map<std::string, size_t> indices;
+    if (store) {
+        for (auto& entry : store->entries()) {
+            indices.emplace(entry.key, latest.size());
+            latest.push_back({std::move(entry.key), base, std::move(entry.value)});
+        }
+    }
+    for (auto& record : records) {
+        if (record.commit <= base) continue;
+        newest = std::max(newest, record.commit);
+        auto [it, inserted] = indices.try_emplace(record.key, latest.size());
+        if (inserted) {
+            latest.push_back({std::move(record.key), record.commit, std::move(record.value)});
+        } else if (latest[it->second].commit <= record.commit) {
+            latest[it->second].commit = record.commit;
+            latest[it->second].value = std::move(record.value);
+        }
+    }
+
+    storePath_ = path;
+    storeBase_ = newest;
+
+    // Only keys are read here; each value is decoded on its first read
+    std::vector<std::string> keys;
+    for (auto& entry : latest) {
+        if (!entry.value) continue; // Deleted
+        auto& shard = shardForKey(entry.key);
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (auto existing = findHandle(entry.key)) {
+            // Created before the store was opened: keep its current value
+            EpochManager::Guard guard;
+            atomForHandle(*existing).setPersisted(true);
+            continue;
+        }
+        auto atom = std::make_shared<AtomCore>(entry.key, std::move(*entry.value));
+        atom->setPersisted(true);
+        createSlot(shard, entry.key, std::move(atom));
+        keys.push_back(std::move(entry.key));
+    }
+
+    log_ = std::make_unique<WriteAheadLog>(
+        path + ".wal",
+        store ? store->size() : 0,
+        [this] { return writeSnapshot(); }
+    );
+    logPtr_.store(log_.get(), std::memory_order_release);
+
+    // Atoms persisted before the store was opened were never logged;
+    // values still in their stored encoding are on disk already
+    std::vector<std::shared_ptr<AtomCore>> unlogged;
+    {
+        EpochManager::Guard guard;
+        for (const auto& shard : shards_) {
+            uint32_t count = shard.slots.size();
+            for (uint32_t index = 0; index < count; ++index) {
+                const auto* slot = shard.slots.at(index);
+                AtomCore* atom = slot != nullptr ? slot->atom.load(std::memory_order_acquire) : nullptr;
+                if (atom != nullptr && atom->isPersisted() && !atom->storedAt(clock_.current())) {
+                    unlogged.push_back(atom->shared_from_this());
+                }
+            }
+        }
+    }
+    for (const auto& atom : unlogged) {
+        logCurrent(*atom);
+    }
+    return keys;
+}
+
+void HybridNitroState::persistAtom(const std::string& key) {
+    auto handle = handleForKey(key);
+    std::shared_ptr<AtomCore> atom;
+    {
+        EpochManager::Guard guard;
+        auto& core = atomForHandle(handle);
+        if (core.isPersisted()) return;
+        core.setPersisted(true);
+        atom = core.shared_from_this();
+    }
+    logCurrent(*atom);
+}
+
+void HybridNitroState::saveStore() {
+    auto* log = logPtr_.load(std::memory_order_acquire);
+    if (log == nullptr) {
+        throw std::runtime_error("No store is open; call openStore first");
+    }
+    log->compact();
+}
+
+WriteAheadLog::Compaction HybridNitroState::writeSnapshot() {
+    // Save one consistent version of every persisted atom without
+    // stopping writers
+    uint64_t version = clock_.pin();
+    AtomStore::Builder builder(storeBase_ + version);
+    ValueCodec::Bytes encoded;
+    try {
+        EpochManager::Guard guard;
+        for (const auto& shard : shards_) {
+            uint32_t count = shard.slots.size();
+            for (uint32_t index = 0; index < count; ++index) {
+                const auto* slot = shard.slots.at(index);
+                const AtomCore* atom = slot != nullptr ? slot->atom.load(std::memory_order_acquire) : nullptr;
+                if (atom == nullptr || !atom->isPersisted()) continue;
+
+                // Values never read since loading are copied without decoding
+                if (auto stored = atom->storedAt(version)) {
+                    builder.add(atom->key(), stored->data, stored->size);
+                } else if (auto value = atom->getAt(version)) {
+                    encoded.clear();
+                    ValueCodec::encode(*value, encoded);
+                    builder.add(atom->key(), encoded.data(), encoded.size());
+                }
+            }
+        }
+    } catch (...) {
+        unpin(version);
+        throw;
+    }
+    unpin(version);
+
+    builder.writeTo(storePath_);
+    return {storeBase_ + version, builder.size()};
+}
+
+// ----- Families -----
+
+HybridNitroState::Family& HybridNitroState::familyForName(const std::string& name) {
+    std::lock_guard<std::mutex> lock(familiesMutex_);
+    auto it = families_.find(name);
+    if (it == families_.end()) {
+        throw std::runtime_error("Family '" + name + "' not found");
+    }
+    return *it->second;
+}
+
+void HybridNitroState::createFamily(const std::string& name, const std::shared_ptr<AnyMap>& defaultValue) {
+    std::lock_guard<std::mutex> lock(familiesMutex_);
+    if (!families_.emplace(name, std::make_unique<Family>(defaultValue)).second) {
+        throw std::runtime_error("Family '" + name + "' already exists");
+    }
+}
+
+double HybridNitroState::familyGet(const std::string& name, const std::string& param) {
+    auto& family = familyForName(name);
+    AtomHandle handle;
+    std::vector<std::shared_ptr<AtomCore>> evicted;
+    {
+        std::lock_guard<std::mutex> familyLock(family.mutex);
+        if (auto member = family.members.find(param)) {
+            auto* slot = shardForHandle(*member).slots.at(*member >> kShardBits);
+            if (slot->atom.load(std::memory_order_acquire) != nullptr) {
+                return *member;
+            }
+            // Deleted with deleteAtom; create it afresh
+            family.members.erase(param);
+        }
+
+        auto key = name + ":" + param;
+        if (auto existing = findHandle(key)) {
+            // Loaded from the store, or evicted and recreated by hand
+            handle = *existing;
+            EpochManager::Guard guard;
+            atomForHandle(handle).trackFootprint(&family.bytes);
+        } else {
+            auto atom = std::make_shared<AtomCore>(key, family.defaultValue);
+            atom->trackFootprint(&family.bytes);
+            auto& shard = shardForKey(key);
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            handle = createSlot(shard, key, std::move(atom));
+        }
+        family.members.insert(param, handle);
+        // The caller is about to use it, even if it alone is over budget
+        evicted = evict(family, name, handle);
+    }
+    // Evicted members are destroyed here, outside the family's lock
+    return handle;
+}
+
+void HybridNitroState::setFamilyBudget(const std::string& name, double maxMembers, double maxBytes) {
+    if (!(maxMembers >= 0) || !(maxBytes >= 0)) {
+        throw std::runtime_error("Family budgets must be non-negative numbers");
+    }
+    auto& family = familyForName(name);
+    std::vector<std::shared_ptr<AtomCore>> evicted;
+    {
+        std::lock_guard<std::mutex> lock(family.mutex);
+        family.maxMembers = static_cast<size_t>(maxMembers);
+        family.maxBytes = static_cast<size_t>(maxBytes);
+        evicted = evict(family, name);
+    }
+    // Evicted members are destroyed here, outside the family's lock
+}
+
+std::vector<std::shared_ptr<AtomCore>> HybridNitroState::evict(
+    Family& family,
+    const std::string& name,
+    std::optional<AtomHandle> keep
+) {
+    auto overBudget = [&] {
+        return (family.maxMembers != 0 && family.members.size() > family.maxMembers) ||
+               (family.maxBytes != 0 && family.bytes.load(std::memory_order_relaxed) > family.maxBytes);
+    };
+    if (!overBudget()) return {};
+
+    // Only idle members go: anything observed is still on screen, a held
+    // member is still referenced from JS, and persisted members would be
+    // deleted from the store
+    std::vector<std::string> keys;
+    family.members.evict(overBudget, [&](const std::string& param, AtomHandle handle) {
+        if (handle == keep) return false;
+        EpochManager::Guard guard;
+        auto* slot = shardForHandle(handle).slots.at(handle >> kShardBits);
+        AtomCore* atom = slot->atom.load(std::memory_order_acquire);
+        if (atom == nullptr) return true;
+        if (atom->refs().isHeld() || atom->isPersisted() || atom->isObserved()) return false;
+        atom->untrackFootprint();
+        keys.push_back(name + ":" + param);
+        return true;
+    });
+
+    // Unregistered right away, so a familyGet after the lock is released
+    // creates the member afresh instead of adopting one being deleted.
+    // Nothing here calls back out: evicted members have no subscribers and
+    // are never persisted, and their last reference is dropped by the caller.
+    // The scan above holds no registry lock, so a member subscribed to or
+    // retained since is skipped; it stays registered, outside the family,
+    // until the next familyGet for it adopts it again
+    std::vector<std::shared_ptr<AtomCore>> evicted;
+    for (const auto& key : keys) {
+        if (auto atom = detachAtom(key, true)) {
+            evicted.push_back(std::move(atom));
+        }
+    }
+    return evicted;
+}
+
+// ----- Serialization -----
+
+std::shared_ptr<ArrayBuffer> HybridNitroState::exportAtom(const std::string& key) {
+    auto handle = handleForKey(key);
+    ValueCodec::Bytes bytes;
+    {
+        EpochManager::Guard guard;
+        auto& atom = atomForHandle(handle);
+        // A value still in its stored encoding is handed out as is
+        if (auto stored = atom.storedAt(clock_.current())) {
+            bytes.assign(stored->data, stored->data + stored->size);
+        } else {
+            ValueCodec::encode(*atom.get(), bytes);
+        }
+    }
+    return ArrayBuffer::move(std::move(bytes));
+}
+
+void HybridNitroState::importAtom(const std::string& key, const std::shared_ptr<ArrayBuffer>& data) {
+    if (!data) {
+        throw std::runtime_error("importAtom expects an ArrayBuffer");
+    }
+    auto value = ValueCodec::decodeMap(data->data(), data->size());
+    if (auto handle = findHandle(key)) {
+        setValue(*handle, value);
+        return;
+    }
+    auto& shard = shardForKey(key);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    createSlot(shard, key, std::make_shared<AtomCore>(key, value));
+}
+
+// ----- Lifetime -----
+
+namespace {
+
+// Slots visited between checks of the sweep's deadline
+constexpr uint32_t kSweepStride = 64;
+
+} // namespace
+
+bool HybridNitroState::retainAtom(double handle) {
+    auto atomHandle = toHandle(handle);
+    EpochManager::Guard guard;
+    auto* slot = shardForHandle(atomHandle).slots.at(atomHandle >> kShardBits);
+    if (slot == nullptr) {
+        throw std::runtime_error("Atom with handle " + std::to_string(atomHandle) + " not found");
+    }
+    AtomCore* atom = slot->atom.load(std::memory_order_acquire);
+    if (atom == nullptr || !atom->refs().retain()) {
+        return false;
+    }
+    if (!outlivesDetach(atomHandle, *atom)) {
+        atom->refs().release();
+        return false;
+    }
+    return true;
+}
+
+void HybridNitroState::releaseAtom(double handle) {
+    auto atomHandle = toHandle(handle);
+    EpochManager::Guard guard;
+    auto* slot = shardForHandle(atomHandle).slots.at(atomHandle >> kShardBits);
+    AtomCore* atom = slot != nullptr ? slot->atom.load(std::memory_order_acquire) : nullptr;
+    if (atom != nullptr) {
+        atom->refs().release();
+    }
+}
+
+bool HybridNitroState::retainComputed(const std::string& key) {
+    auto computed = findComputed(key);
+    return computed && computed->refs().retain();
+}
+
+void HybridNitroState::releaseComputed(const std::string& key) {
+    if (auto computed = findComputed(key)) {
+        computed->refs().release();
+    }
+}
+
+double HybridNitroState::collectGarbage(double sliceMs) {
+    if (!(sliceMs >= 0)) {
+        throw std::runtime_error("collectGarbage expects a non-negative time slice");
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::duration<double, std::milli>(sliceMs);
+    std::lock_guard<std::mutex> gcLock(gcMutex_);
+
+    // Resume where the last slice stopped and visit each shard at most once.
+    // A shard's computeds go first: dropping them releases the atoms they
+    // read, which the same pass can then reclaim. The deadline is only
+    // checked once some work is done, so every call makes progress.
+    size_t collected = 0;
+    bool progressed = false;
+    auto outOfTime = [&] { return progressed && std::chrono::steady_clock::now() >= deadline; };
+    for (size_t visited = 0; visited < kShardCount; visited++) {
+        auto& shard = shards_[gcShard_];
+        if (!gcComputedsSwept_) {
+            if (outOfTime()) return static_cast<double>(collected);
+            collected += collectComputeds(shard);
+            gcComputedsSwept_ = true;
+            progressed = true;
+        }
+
+        uint32_t size = shard.slots.size();
+        while (gcIndex_ < size) {
+            if (gcIndex_ % kSweepStride == 0 && outOfTime()) {
+                return static_cast<double>(collected);
+            }
+            progressed = true;
+            auto handle = static_cast<AtomHandle>((gcIndex_ << kShardBits) | gcShard_);
+            gcIndex_++;
+
+            EpochManager::Guard guard;
+            AtomCore* atom = shard.slots.at(handle >> kShardBits)->atom.load(std::memory_order_acquire);
+            // Unmanaged atoms (never retained from JS) and persisted ones stay
+            if (atom == nullptr || !atom->refs().isUnheld() || atom->isPersisted() || atom->isObserved()) {
+                continue;
+            }
+            if (atom->refs().tryCollect()) {
+                collectAtom(handle, *atom);
+                collected++;
+            }
+        }
+
+        gcShard_ = (gcShard_ + 1) % kShardCount;
+        gcIndex_ = 0;
+        gcComputedsSwept_ = false;
+    }
+    return static_cast<double>(collected);
+}
+
+void HybridNitroState::collectAtom(AtomHandle handle, const AtomCore& atom) {
+    auto& shard = shardForHandle(handle);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    std::unique_lock<std::shared_mutex> keysLock(shard.keysMutex);
+    auto* slot = shard.slots.at(handle >> kShardBits);
+    if (slot->atom.load(std::memory_order_acquire) != &atom) {
+        return;
+    }
+
+    slot->owner->untrackFootprint();
+    auto it = shard.handles.find(atom.key());
+    if (it != shard.handles.end() && it->second == handle) {
+        shard.handles.erase(it);
+    }
+    retireSlot(*slot);
+}
+
+size_t HybridNitroState::collectComputeds(Shard& shard) {
+    std::vector<std::shared_ptr<ComputedCore>> collected;
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto it = shard.computeds.begin(); it != shard.computeds.end();) {
+            auto& computed = it->second;
+            if (computed->refs().isUnheld() && !computed->isObserved() && computed->refs().tryCollect()) {
+                collected.push_back(std::move(computed));
+                it = shard.computeds.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+    // Released outside the lock: destroying a node frees its compute function
+    return collected.size();
+}
+
+// ----- Snapshots -----
+
+uint64_t HybridNitroState::snapshotVersion(double snapshot) {
+    uint32_t id = toId(snapshot, "snapshot");
+    std::lock_guard<std::mutex> lock(snapshotsMutex_);
+    auto it = snapshots_.find(id);
+    if (it == snapshots_.end()) {
+        throw std::runtime_error("Snapshot " + std::to_string(id) + " is not held");
+    }
+    return it->second;
+}
+
+double HybridNitroState::acquireSnapshot() {
+    uint64_t version = clock_.pin();
+    std::lock_guard<std::mutex> lock(snapshotsMutex_);
+    uint32_t id = nextSnapshotId_++;
+    snapshots_.emplace(id, version);
+    return id;
+}
+
+std::shared_ptr<AnyMap> HybridNitroState::getAtomValueAt(double snapshot, const std::string& key) {
+    uint64_t version = snapshotVersion(snapshot);
+    auto handle = handleForKey(key);
+    EpochManager::Guard guard;
+    auto value = atomForHandle(handle).getAt(version);
+    if (!value) {
+        throw std::runtime_error("Atom '" + key + "' has no value at snapshot " + std::to_string(version));
+    }
+    return value;
+}
+
+void HybridNitroState::releaseSnapshot(double snapshot) {
+    uint32_t id = toId(snapshot, "snapshot");
+    uint64_t version;
+    {
+        std::lock_guard<std::mutex> lock(snapshotsMutex_);
+        auto it = snapshots_.find(id);
+        if (it == snapshots_.end()) return;
+        version = it->second;
+        snapshots_.erase(it);
+    }
+    unpin(version);
+}
+
+void HybridNitroState::unpin(uint64_t version) {
+    clock_.unpin(version);
+
+    // Drop the values only this snapshot was keeping. Atoms without
+    // history are skipped, so the scan is cheap when few were written.
+    EpochManager::Guard guard;
+    for (auto& shard : shards_) {
+        uint32_t count = shard.slots.size();
+        for (uint32_t index = 0; index < count; ++index) {
+            auto* slot = shard.slots.at(index);
+            AtomCore* atom = slot != nullptr ? slot->atom.load(std::memory_order_acquire) : nullptr;
+            if (atom != nullptr && atom->historyLength() > 0) {
+                atom->pruneHistory(clock_);
             }
         }
     }
-    
-    pendingNotifications_.clear();
+}
+
+// ----- Transactions -----
+
+std::shared_ptr<Transaction> HybridNitroState::transactionForId(double transaction) {
+    uint32_t id = toId(transaction, "transaction");
+    std::lock_guard<std::mutex> lock(transactionsMutex_);
+    auto it = transactions_.find(id);
+    if (it == transactions_.end()) {
+        throw std::runtime_error("Transaction " + std::to_string(id) + " is not open");
+    }
+    return it->second;
+}
+
+double HybridNitroState::beginTransaction() {
+    // Pinned so the values it reads stay in the history until it closes
+    auto tx = std::make_shared<Transaction>(clock_.pin(), [this](uint64_t version) { unpin(version); });
+    std::lock_guard<std::mutex> lock(transactionsMutex_);
+    uint32_t id = nextTransactionId_++;
+    transactions_.emplace(id, std::move(tx));
+    return id;
+}
+
+std::shared_ptr<AnyMap> HybridNitroState::transactionGet(double transaction, const std::string& key) {
+    auto tx = transactionForId(transaction);
+    auto handle = handleForKey(key);
+    EpochManager::Guard guard;
+    return tx->get(handle, atomForHandle(handle));
+}
+
+void HybridNitroState::transactionSet(
+    double transaction,
+    const std::string& key,
+    const std::shared_ptr<AnyMap>& value
+) {
+    auto tx = transactionForId(transaction);
+    auto handle = handleForKey(key);
+    EpochManager::Guard guard;
+    tx->set(handle, atomForHandle(handle), value);
+}
+
+bool HybridNitroState::commitTransaction(double transaction) {
+    auto tx = transactionForId(transaction);
+    {
+        // Closed whether or not it commits; callers retry with a new one
+        std::lock_guard<std::mutex> lock(transactionsMutex_);
+        transactions_.erase(toId(transaction, "transaction"));
+    }
+
+    auto isLive = [this](AtomHandle handle, const AtomCore& atom) {
+        EpochManager::Guard guard;
+        auto* slot = shardForHandle(handle).slots.at(handle >> kShardBits);
+        return slot != nullptr && slot->atom.load(std::memory_order_acquire) == &atom;
+    };
+    std::vector<Transaction::Change> changed;
+    if (!tx->commit(clock_, isLive, changed)) {
+        return false;
+    }
+
+    // Deliver the whole commit as one batch: each atom and computed once
+    batch_.startBatch();
+    try {
+        for (const auto& change : changed) {
+            propagate(change.handle, change.atom);
+        }
+    } catch (...) {
+        endBatch();
+        throw;
+    }
+    endBatch();
+    return true;
+}
+
+void HybridNitroState::abortTransaction(double transaction) {
+    uint32_t id = toId(transaction, "transaction");
+    std::shared_ptr<Transaction> tx;
+    {
+        std::lock_guard<std::mutex> lock(transactionsMutex_);
+        auto it = transactions_.find(id);
+        if (it == transactions_.end()) return;
+        tx = std::move(it->second);
+        transactions_.erase(it);
+    }
+    // Outside the lock: unpinning scans the registry
+    tx->close();
+}
+
+// ----- Scheduling -----
+
+void HybridNitroState::startScheduler(double intervalMs) {
+    scheduler_.start(intervalMs);
+}
+
+void HybridNitroState::stopScheduler() {
+    scheduler_.stop();
+}
+
+void HybridNitroState::flush() {
+    scheduler_.flush();
 }
 
 // ----- Utility -----
 
 bool HybridNitroState::hasAtom(const std::string& key) {
-    std::lock_guard<std::mutex> lock(mutex_);
-    return atoms_.find(key) != atoms_.end();
+    return findHandle(key).has_value();
 }
 
 std::vector<std::string> HybridNitroState::getAtomKeys() {
-    std::lock_guard<std::mutex> lock(mutex_);
     std::vector<std::string> keys;
-    keys.reserve(atoms_.size());
-    for (const auto& [key, _] : atoms_) {
-        keys.push_back(key);
+    for (auto& shard : shards_) {
+        std::shared_lock<std::shared_mutex> lock(shard.keysMutex);
+        keys.reserve(keys.size() + shard.handles.size());
+        for (const auto& [key, _] : shard.handles) {
+            keys.push_back(key);
+        }
     }
     return keys;
 }
 
+// ----- Native Updates -----
+
+std::shared_ptr<AnyMap> HybridNitroState::updateAtom(const std::string& key, const Updater& updater) {
+    auto handle = handleForKey(key);
+    while (true) {
+        uint64_t expectedVersion;
+        std::shared_ptr<AnyMap> current;
+        {
+            EpochManager::Guard guard;
+            auto& atom = atomForHandle(handle);
+            // Version first: a value newer than it only makes the CAS fail
+            expectedVersion = atom.commitVersion();
+            current = atom.get();
+        }
+
+        auto next = updater(current);
+        if (compareAndSetValue(handle, expectedVersion, next) != AtomCore::CompareResult::CONFLICT) {
+            return next;
+        }
+    }
+}
+
 } // namespace margelo::nitro::nitrostate
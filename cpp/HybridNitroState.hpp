@@ -2,13 +2,28 @@
 
 #include "HybridNitroStateSpec.hpp"
 #include <NitroModules/AnyMap.hpp>
+#include <NitroModules/ArrayBuffer.hpp>
 #include <unordered_map>
+#include <array>
+#include <optional>
+#include <vector>
 #include <memory>
 #include <string>
 #include <mutex>
+#include <shared_mutex>
+#include <atomic>
+#include <cstdint>
 #include "AtomCore.hpp"
+#include "AtomFamily.hpp"
 #include "ComputedCore.hpp"
 #include "BatchManager.hpp"
+#include "CommitClock.hpp"
+#include "NotificationScheduler.hpp"
+#include "EpochManager.hpp"
+#include "Selector.hpp"
+#include "SlotTable.hpp"
+#include "Transaction.hpp"
+#include "WriteAheadLog.hpp"
 
 namespace margelo::nitro::nitrostate {
 
@@ -26,37 +41,285 @@ public:
 
     // ----- Atom Operations -----
     void createAtom(const std::string& key, const std::shared_ptr<AnyMap>& initialValue) override;
+    double createAtomHandle(const std::string& key, const std::shared_ptr<AnyMap>& initialValue) override;
+    double getAtomHandle(const std::string& key) override;
     std::shared_ptr<AnyMap> getAtomValue(const std::string& key) override;
     void setAtomValue(const std::string& key, const std::shared_ptr<AnyMap>& value) override;
     std::function<void()> subscribeAtom(const std::string& key, const std::function<void()>& callback) override;
     void deleteAtom(const std::string& key) override;
+    void setAtomEquality(const std::string& key, EqualityMode mode) override;
+
+    // ----- Bulk Operations -----
+    std::vector<std::shared_ptr<AnyMap>> getMany(const std::vector<std::string>& keys) override;
+    void setMany(const std::vector<std::string>& keys, const std::vector<std::shared_ptr<AnyMap>>& values) override;
+
+    // ----- Handle-based Atom Operations -----
+    std::shared_ptr<AnyMap> getAtomValueByHandle(double handle) override;
+    void setAtomValueByHandle(double handle, const std::shared_ptr<AnyMap>& value) override;
+    std::function<void()> subscribeAtomByHandle(double handle, const std::function<void()>& callback) override;
+
+    // ----- Nested Values -----
+    void setIn(const std::string& key, const std::vector<std::string>& path, const std::shared_ptr<AnyMap>& value) override;
+    std::shared_ptr<AnyMap> getIn(const std::string& key, const std::vector<std::string>& path) override;
+    std::function<void()> subscribePath(
+        const std::string& key,
+        const std::vector<std::string>& path,
+        const std::function<void()>& callback
+    ) override;
+
+    // ----- Patches -----
+    void mergeAtom(const std::string& key, const std::shared_ptr<AnyMap>& partial) override;
+    double increment(const std::string& key, const std::vector<std::string>& path, double delta) override;
+    double push(const std::string& key, const std::vector<std::string>& path, const std::shared_ptr<AnyMap>& items) override;
+    std::shared_ptr<AnyMap> splice(
+        const std::string& key,
+        const std::vector<std::string>& path,
+        double start,
+        double deleteCount,
+        const std::shared_ptr<AnyMap>& items
+    ) override;
+
+    // ----- Versions -----
+    bool compareAndSet(const std::string& key, double expectedVersion, const std::shared_ptr<AnyMap>& value) override;
+    bool compareAndSetByHandle(double handle, double expectedVersion, const std::shared_ptr<AnyMap>& value) override;
+    double getAtomVersion(const std::string& key) override;
+    double getAtomVersionByHandle(double handle) override;
+    double getCommitVersion() override;
+    std::vector<std::string> getChangedSince(double version) override;
 
     // ----- Computed Operations -----
     void createComputed(
         const std::string& key,
         const std::vector<std::string>& dependencies,
-        const std::function<std::shared_ptr<Promise<std::shared_ptr<AnyMap>>>()>& compute
+        const std::function<std::shared_ptr<Promise<std::shared_ptr<AnyMap>>>(double /* run */)>& compute
     ) override;
+    void createAsyncComputed(
+        const std::string& key,
+        const std::vector<std::string>& dependencies,
+        const std::function<std::shared_ptr<Promise<std::shared_ptr<AnyMap>>>(double /* run */)>& compute,
+        const std::shared_ptr<AnyMap>& placeholder
+    ) override;
+    void createSelector(const std::string& key, const std::shared_ptr<AnyMap>& spec) override;
+    void trackRead(const std::string& computed, double run, const std::string& key) override;
     std::shared_ptr<AnyMap> getComputedValue(const std::string& key) override;
+    bool isComputedPending(const std::string& key) override;
+    std::function<void()> subscribeComputed(const std::string& key, const std::function<void()>& callback) override;
     void deleteComputed(const std::string& key) override;
 
     // ----- Batch Operations -----
     void startBatch() override;
     void endBatch() override;
 
+    // ----- Persistence -----
+    std::vector<std::string> openStore(const std::string& path) override;
+    void persistAtom(const std::string& key) override;
+    void saveStore() override;
+
+    // ----- Families -----
+    void createFamily(const std::string& name, const std::shared_ptr<AnyMap>& defaultValue) override;
+    double familyGet(const std::string& name, const std::string& param) override;
+    void setFamilyBudget(const std::string& name, double maxMembers, double maxBytes) override;
+
+    // ----- Serialization -----
+    std::shared_ptr<ArrayBuffer> exportAtom(const std::string& key) override;
+    void importAtom(const std::string& key, const std::shared_ptr<ArrayBuffer>& data) override;
+
+    // ----- Lifetime -----
+    bool retainAtom(double handle) override;
+    void releaseAtom(double handle) override;
+    bool retainComputed(const std::string& key) override;
+    void releaseComputed(const std::string& key) override;
+    double collectGarbage(double sliceMs) override;
+
+    // ----- Snapshots -----
+    double acquireSnapshot() override;
+    std::shared_ptr<AnyMap> getAtomValueAt(double snapshot, const std::string& key) override;
+    void releaseSnapshot(double snapshot) override;
+
+    // ----- Transactions -----
+    double beginTransaction() override;
+    std::shared_ptr<AnyMap> transactionGet(double transaction, const std::string& key) override;
+    void transactionSet(double transaction, const std::string& key, const std::shared_ptr<AnyMap>& value) override;
+    bool commitTransaction(double transaction) override;
+    void abortTransaction(double transaction) override;
+
+    // ----- Scheduling -----
+    void startScheduler(double intervalMs) override;
+    void stopScheduler() override;
+    void flush() override;
+
     // ----- Utility -----
     bool hasAtom(const std::string& key) override;
     std::vector<std::string> getAtomKeys() override;
 
+    // ----- Native Updates -----
+    using Updater = std::function<std::shared_ptr<AnyMap>(const std::shared_ptr<AnyMap>& current)>;
+
+    /**
+     * Atomic read-modify-write for native threads. `updater` runs without
+     * the atom's lock and is re-run on the latest value whenever another
+     * write lands first, so it must be free of side effects.
+     * @return The value that was written
+     */
+    std::shared_ptr<AnyMap> updateAtom(const std::string& key, const Updater& updater);
+
 private:
-    std::unordered_map<std::string, std::shared_ptr<AnyMap>> atoms_;
-    std::unordered_map<std::string, std::shared_ptr<AnyMap>> computed_;
-    std::unordered_map<std::string, std::function<std::shared_ptr<Promise<std::shared_ptr<AnyMap>>>()>> computeFns_;
-    std::unordered_map<std::string, std::vector<std::pair<size_t, std::function<void()>>>> subscribers_;
-    size_t nextSubscriberId_ = 0;
-    mutable std::mutex mutex_;
-    bool isBatching_ = false;
-    std::vector<std::string> pendingNotifications_;
+    using AtomHandle = uint32_t;
+
+    // Handles carry their shard in the low bits: (localIndex << kShardBits) | shard
+    static constexpr unsigned kShardBits = 4;
+    static constexpr size_t kShardCount = size_t{1} << kShardBits;
+
+    /**
+     * Storage for a single atom, addressed by its handle. Readers load `atom`
+     * lock-free inside an EpochManager::Guard; `owner` keeps it alive and is
+     * only touched under the shard mutex. A null atom marks a deleted slot.
+     * `detaching` is set while an eviction decides whether the atom is idle.
+     */
+    struct AtomSlot {
+        std::atomic<AtomCore*> atom{nullptr};
+        std::shared_ptr<AtomCore> owner;
+        std::atomic<bool> detaching{false};
+    };
+
+    /**
+     * Independent partition of the registry. A key always maps to the same
+     * shard, and every atom created in a shard gets a handle pointing back to it.
+     */
+    struct Shard {
+        // Guards slot allocation, slot owners and computeds
+        std::mutex mutex;
+        // Guards the key index so keyed lookups don't wait for writers
+        std::shared_mutex keysMutex;
+        SlotTable<AtomSlot> slots;
+        std::unordered_map<std::string, AtomHandle> handles;
+        std::unordered_map<std::string, std::shared_ptr<ComputedCore>> computeds;
+    };
+
+    Shard& shardForKey(const std::string& key);
+    Shard& shardForHandle(AtomHandle handle);
+
+    // Must be called inside an EpochManager::Guard
+    AtomCore& atomForHandle(AtomHandle handle) const;
+
+    // Must be called with the shard's mutex held
+    AtomHandle createSlot(Shard& shard, const std::string& key, std::shared_ptr<AtomCore> atom);
+
+    // Tombstone a slot; call with the shard's mutex and keys lock held
+    static void retireSlot(AtomSlot& slot);
+
+    // deleteAtom(), handing back the atom (null if there is none) so the
+    // caller decides where its last reference is dropped. With `onlyIfIdle`
+    // an atom observed or held from JS is left in place
+    std::shared_ptr<AtomCore> detachAtom(const std::string& key, bool onlyIfIdle = false);
+    // Call after subscribing to or retaining `atom`: whether it is still in
+    // its slot, once any eviction deciding its fate meanwhile is done
+    bool outlivesDetach(AtomHandle handle, const AtomCore& atom) const;
+
+    std::optional<AtomHandle> findHandle(const std::string& key);
+    AtomHandle handleForKey(const std::string& key);
+    // handleForKey() for every key, taking each shard's lock once
+    std::vector<AtomHandle> handlesForKeys(const std::vector<std::string>& keys);
+    void registerComputed(const std::shared_ptr<ComputedCore>& computed, const std::vector<std::string>& dependencies);
+    std::shared_ptr<ComputedCore> findComputed(const std::string& key);
+    std::shared_ptr<ComputedCore> computedForKey(const std::string& key);
+    static AtomHandle toHandle(double handle);
+    // Versions are exact in a double up to 2^53
+    static uint64_t toVersion(double version);
+    // Snapshot and transaction ids; `kind` names the id in errors
+    static uint32_t toId(double id, const char* kind);
+
+    std::shared_ptr<AnyMap> getValue(AtomHandle handle);
+    void setValue(AtomHandle handle, const std::shared_ptr<AnyMap>& value);
+    AtomCore::CompareResult compareAndSetValue(AtomHandle handle, uint64_t expectedVersion, const std::shared_ptr<AnyMap>& value);
+    // Run `apply` on the atom and propagate if it reports a change
+    void write(AtomHandle handle, const std::function<bool(AtomCore&)>& apply);
+    // Invalidate dependents of a freshly written atom and notify (or queue)
+    void propagate(AtomHandle handle, const std::shared_ptr<AtomCore>& atom);
+    // Append a persisted atom's latest value to the log, if a store is open
+    void logWrite(const AtomCore& atom);
+    // Same, under a fresh commit, for atoms that were not logged until now
+    void logCurrent(const AtomCore& atom);
+    // Write every persisted atom to the store file; the log's compactor
+    WriteAheadLog::Compaction writeSnapshot();
+    std::function<void()> subscribe(AtomHandle handle, const std::function<void()>& callback);
+    std::shared_ptr<Transaction> transactionForId(double transaction);
+
+    /**
+     * Members of one atom family and its eviction budget. Members are
+     * ordinary atoms registered under "<name>:<param>".
+     */
+    struct Family {
+        explicit Family(std::shared_ptr<AnyMap> defaultValue) : defaultValue(std::move(defaultValue)) {}
+
+        // Guards everything below; taken before any shard mutex
+        std::mutex mutex;
+        AtomFamily members;
+        std::shared_ptr<AnyMap> defaultValue;
+        // Approximate bytes held by the members' values
+        std::atomic<size_t> bytes{0};
+        // 0 disables a limit
+        size_t maxMembers = kDefaultFamilyMembers;
+        size_t maxBytes = 0;
+    };
+
+    static constexpr size_t kDefaultFamilyMembers = 10000;
+
+    Family& familyForName(const std::string& name);
+    // Detach idle members other than `keep` until the family fits its
+    // budget; call with its mutex held and drop the returned atoms only
+    // once it is released
+    std::vector<std::shared_ptr<AtomCore>> evict(
+        Family& family,
+        const std::string& name,
+        std::optional<AtomHandle> keep = std::nullopt
+    );
+    // Remove an atom the collector claimed, unless it is already gone
+    void collectAtom(AtomHandle handle, const AtomCore& atom);
+    // Remove the shard's unreachable computeds; returns how many went
+    size_t collectComputeds(Shard& shard);
+    uint64_t snapshotVersion(double snapshot);
+    // Unpin a snapshot version and drop the history only it was keeping
+    void unpin(uint64_t version);
+
+    std::array<Shard, kShardCount> shards_;
+    BatchManager batch_;
+    CommitClock clock_;
+
+    // Guards opening the store; the path and base never change afterwards
+    std::mutex storeMutex_;
+    std::string storePath_;
+    // Added to this session's commits when persisting them, so they sort
+    // after every commit persisted by earlier sessions
+    uint64_t storeBase_ = 0;
+
+    // Pinned commit version of each open snapshot, by id
+    std::mutex snapshotsMutex_;
+    std::unordered_map<uint32_t, uint64_t> snapshots_;
+    uint32_t nextSnapshotId_ = 1;
+
+    // Open transactions by id; each is driven by one caller
+    std::mutex transactionsMutex_;
+    std::unordered_map<uint32_t, std::shared_ptr<Transaction>> transactions_;
+    uint32_t nextTransactionId_ = 1;
+
+    // Families are never removed, so references to them stay valid
+    std::mutex familiesMutex_;
+    std::unordered_map<std::string, std::unique_ptr<Family>> families_;
+
+    // Position the incremental sweep resumes from
+    std::mutex gcMutex_;
+    size_t gcShard_ = 0;
+    uint32_t gcIndex_ = 0;
+    // Whether the current shard's computeds were swept already
+    bool gcComputedsSwept_ = false;
+
+    // Declared after the registry: its thread compacts from it
+    std::unique_ptr<WriteAheadLog> log_;
+    // Read on every write; set once by openStore
+    std::atomic<WriteAheadLog*> logPtr_{nullptr};
+    // Declared last so its timer thread stops before the registry goes away
+    NotificationScheduler scheduler_;
 };
 
 } // namespace margelo::nitro::nitrostate
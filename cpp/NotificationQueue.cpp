@@ -0,0 +1,51 @@
+#include "NotificationQueue.hpp"
+#include <algorithm>
+
+namespace margelo::nitro::nitrostate {
+
+void NotificationQueue::push(
+    uint32_t handle,
+    const std::shared_ptr<AtomCore>& atom,
+    const std::vector<std::shared_ptr<ComputedCore>>& invalidated
+) {
+    if (queuedHandles_.insert(handle).second) {
+        atoms_.emplace_back(handle, atom);
+    }
+    for (const auto& computed : invalidated) {
+        if (queuedComputeds_.insert(computed.get()).second) {
+            computeds_.push_back(computed);
+        }
+    }
+}
+
+void NotificationQueue::append(NotificationQueue&& other) {
+    for (auto& [handle, atom] : other.atoms_) {
+        if (queuedHandles_.insert(handle).second) {
+            atoms_.emplace_back(handle, std::move(atom));
+        }
+    }
+    for (auto& computed : other.computeds_) {
+        if (queuedComputeds_.insert(computed.get()).second) {
+            computeds_.push_back(std::move(computed));
+        }
+    }
+    other = NotificationQueue();
+}
+
+void NotificationQueue::notifyAll() {
+    auto atoms = std::move(atoms_);
+    auto computeds = std::move(computeds_);
+    *this = NotificationQueue();
+
+    // Atoms first, then computeds in height order
+    for (const auto& [_, atom] : atoms) {
+        atom->notify();
+    }
+    std::stable_sort(computeds.begin(), computeds.end(),
+        [](const auto& a, const auto& b) { return a->height() < b->height(); });
+    for (const auto& computed : computeds) {
+        computed->notify();
+    }
+}
+
+} // namespace margelo::nitro::nitrostate
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+#include "AtomCore.hpp"
+#include "ComputedCore.hpp"
+
+namespace margelo::nitro::nitrostate {
+
+/**
+ * NotificationQueue - Pending notifications for atoms and computeds
+ *
+ * Each atom is queued once, keyed by handle, and atoms are delivered in
+ * the order they were first written. Computeds are delivered after all
+ * atoms, in height order. Not thread-safe; owners guard it.
+ */
+class NotificationQueue {
+public:
+    /**
+     * Queue an atom and the computeds its write invalidated
+     */
+    void push(
+        uint32_t handle,
+        const std::shared_ptr<AtomCore>& atom,
+        const std::vector<std::shared_ptr<ComputedCore>>& invalidated
+    );
+
+    /**
+     * Move everything queued in `other` to the back of this queue
+     */
+    void append(NotificationQueue&& other);
+
+    bool empty() const { return atoms_.empty() && computeds_.empty(); }
+
+    /**
+     * Notify everything queued and leave the queue empty.
+     * Call without holding the owner's lock.
+     */
+    void notifyAll();
+
+private:
+    std::vector<std::pair<uint32_t, std::shared_ptr<AtomCore>>> atoms_;
+    std::unordered_set<uint32_t> queuedHandles_;
+    std::vector<std::shared_ptr<ComputedCore>> computeds_;
+    std::unordered_set<const ComputedCore*> queuedComputeds_;
+};
+
+} // namespace margelo::nitro::nitrostate
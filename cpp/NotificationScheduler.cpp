@@ -0,0 +1,121 @@
+#include "NotificationScheduler.hpp"
+#include <stdexcept>
+#include <utility>
+
+namespace margelo::nitro::nitrostate {
+
+NotificationScheduler::~NotificationScheduler() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    active_ = false;
+    stopTimer(lock);
+}
+
+void NotificationScheduler::start(double intervalMs) {
+    if (!(intervalMs >= 0)) {
+        throw std::runtime_error("Scheduler interval must be a non-negative number");
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    stopTimer(lock);
+    active_ = true;
+
+    if (intervalMs > 0) {
+        auto interval = std::chrono::microseconds(static_cast<int64_t>(intervalMs * 1000));
+        if (interval.count() == 0) interval = std::chrono::microseconds(1);
+        timer_ = std::thread(&NotificationScheduler::run, this, generation_, interval);
+    }
+}
+
+void NotificationScheduler::stop() {
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!active_) return;
+        active_ = false;
+        stopTimer(lock);
+    }
+    flush();
+}
+
+void NotificationScheduler::stopTimer(std::unique_lock<std::mutex>& lock) {
+    generation_++;
+    wakeup_.notify_all();
+
+    std::vector<std::thread> finished;
+    std::thread current;
+    for (auto* thread : {&timer_, &exiting_}) {
+        if (!thread->joinable()) continue;
+        if (thread->get_id() == std::this_thread::get_id()) {
+            // Called from a subscriber running on this timer thread, which
+            // can't join itself. It exits once the subscriber returns and is
+            // joined by the next start/stop or the destructor
+            current = std::move(*thread);
+        } else {
+            finished.push_back(std::move(*thread));
+        }
+    }
+    exiting_ = std::move(current);
+    if (finished.empty()) return;
+
+    // The timer takes mutex_ to check its generation, so join unlocked
+    lock.unlock();
+    for (auto& thread : finished) {
+        thread.join();
+    }
+    lock.lock();
+}
+
+bool NotificationScheduler::enqueue(
+    uint32_t handle,
+    const std::shared_ptr<AtomCore>& atom,
+    const std::vector<std::shared_ptr<ComputedCore>>& invalidated
+) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!active_) return false;
+    pending_.push(handle, atom, invalidated);
+    return true;
+}
+
+bool NotificationScheduler::enqueue(NotificationQueue& queue) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!active_) return false;
+    pending_.append(std::move(queue));
+    return true;
+}
+
+void NotificationScheduler::flush() {
+    NotificationQueue ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        std::swap(ready, pending_);
+    }
+    // Subscribers run outside the lock and may write again; those writes
+    // land in the next tick
+    ready.notifyAll();
+}
+
+bool NotificationScheduler::isActive() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return active_;
+}
+
+void NotificationScheduler::run(uint64_t generation, std::chrono::microseconds interval) {
+    auto nextTick = std::chrono::steady_clock::now() + interval;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            if (wakeup_.wait_until(lock, nextTick, [&] { return generation_ != generation; })) {
+                return;
+            }
+        }
+        flush();
+
+        // Fixed cadence; skip ticks missed while subscribers were running
+        nextTick += interval;
+        auto now = std::chrono::steady_clock::now();
+        if (nextTick < now) {
+            nextTick = now + interval;
+        }
+    }
+}
+
+} // namespace margelo::nitro::nitrostate
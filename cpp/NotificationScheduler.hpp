@@ -0,0 +1,85 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "AtomCore.hpp"
+#include "ComputedCore.hpp"
+#include "NotificationQueue.hpp"
+
+namespace margelo::nitro::nitrostate {
+
+/**
+ * NotificationScheduler - Coalesces notifications into periodic flushes
+ *
+ * Off by default, in which case writes notify synchronously. Once started,
+ * writes only queue their atom and subscribers are called once per tick,
+ * either from a native timer thread or from an explicit flush(). Subscribers
+ * read the value when notified, so they always see the latest write.
+ */
+class NotificationScheduler {
+public:
+    NotificationScheduler() = default;
+    // Joins the timer thread, so it must not run on it
+    ~NotificationScheduler();
+
+    // Non-copyable
+    NotificationScheduler(const NotificationScheduler&) = delete;
+    NotificationScheduler& operator=(const NotificationScheduler&) = delete;
+
+    /**
+     * Start coalescing. A positive interval flushes from a timer thread
+     * every `intervalMs`; zero leaves flushing entirely to flush().
+     * Restarting with a new interval keeps anything already queued.
+     */
+    void start(double intervalMs);
+
+    /**
+     * Stop coalescing, deliver anything still queued and go back to
+     * synchronous notification
+     */
+    void stop();
+
+    /**
+     * Queue a write for the next flush
+     * @return false if the scheduler is off and the caller should notify now
+     */
+    bool enqueue(
+        uint32_t handle,
+        const std::shared_ptr<AtomCore>& atom,
+        const std::vector<std::shared_ptr<ComputedCore>>& invalidated
+    );
+
+    /**
+     * Queue the contents of a finished batch
+     * @return false if the scheduler is off and the caller should notify now
+     */
+    bool enqueue(NotificationQueue& queue);
+
+    /**
+     * Deliver everything queued on the calling thread
+     */
+    void flush();
+
+    bool isActive() const;
+
+private:
+    void stopTimer(std::unique_lock<std::mutex>& lock);
+    void run(uint64_t generation, std::chrono::microseconds interval);
+
+    NotificationQueue pending_;
+    bool active_ = false;
+    // Bumped on every start/stop so a stale timer thread knows to exit
+    uint64_t generation_ = 0;
+    std::thread timer_;
+    // A timer stopped from its own thread, still to be joined
+    std::thread exiting_;
+    std::condition_variable wakeup_;
+    mutable std::mutex mutex_;
+};
+
+} // namespace margelo::nitro::nitrostate
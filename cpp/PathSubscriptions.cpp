@@ -0,0 +1,165 @@
+#include "PathSubscriptions.hpp"
+#include "ValueEquality.hpp"
+#include <algorithm>
+
+namespace margelo::nitro::nitrostate {
+
+namespace {
+
+/**
+ * Read-only cursor into either representation of a value. At most one
+ * member is set; none means the path does not exist.
+ */
+struct View {
+    const PersistentMap* map = nullptr;
+    const AnyObject* object = nullptr;
+    const AnyValue* value = nullptr;
+
+    static View of(const AnyValue& value) {
+        View view;
+        if (const auto* object = std::get_if<AnyObject>(&value)) {
+            view.object = object;
+        } else {
+            view.value = &value;
+        }
+        return view;
+    }
+
+    static View of(const PersistentValue& value) {
+        if (const auto* map = std::get_if<PersistentMap>(&value)) {
+            View view;
+            view.map = map;
+            return view;
+        }
+        return of(std::get<AnyValue>(value));
+    }
+
+    static View of(const PathSubscriptions::Snapshot& snapshot) {
+        View view;
+        if (snapshot.tree) {
+            view.map = &*snapshot.tree;
+        } else if (snapshot.map) {
+            view.object = &snapshot.map->getMap();
+        }
+        return view;
+    }
+
+    bool exists() const { return map != nullptr || object != nullptr || value != nullptr; }
+    bool isObject() const { return map != nullptr || object != nullptr; }
+    size_t size() const { return map != nullptr ? map->size() : object->size(); }
+
+    View child(const std::string& segment) const {
+        if (map != nullptr) {
+            const PersistentValue* found = map->find(segment);
+            return found != nullptr ? of(*found) : View();
+        }
+        if (object != nullptr) {
+            auto it = object->find(segment);
+            return it != object->end() ? of(it->second) : View();
+        }
+        if (value != nullptr) {
+            if (const auto* array = std::get_if<AnyArray>(value)) {
+                auto index = PersistentMap::arrayIndex(segment);
+                if (index && *index < array->size()) return of((*array)[*index]);
+            }
+        }
+        return View();
+    }
+
+    // Pointer identity only; equal contents in different places return false
+    bool identical(const View& other) const {
+        if (map != nullptr && other.map != nullptr) return map->sameAs(*other.map);
+        if (object != nullptr) return object == other.object;
+        if (value != nullptr) return value == other.value;
+        return !other.exists();
+    }
+};
+
+bool equalViews(const View& a, const View& b) {
+    if (!a.exists() || !b.exists()) return a.exists() == b.exists();
+    if (a.identical(b)) return true;
+
+    if (a.isObject() != b.isObject()) return false;
+    if (!a.isObject()) return ValueEquality::deepEqual(*a.value, *b.value);
+
+    if (a.size() != b.size()) return false;
+    if (a.map != nullptr) {
+        return a.map->every([&](const std::string& key, const PersistentValue& value) {
+            return equalViews(View::of(value), b.child(key));
+        });
+    }
+    for (const auto& [key, value] : *a.object) {
+        if (!equalViews(View::of(value), b.child(key))) return false;
+    }
+    return true;
+}
+
+template <typename NodeT, typename Callback>
+void collect(const NodeT& node, const View& before, const View& after, std::vector<Callback>& out) {
+    if (before.identical(after)) return;
+
+    if (!node.callbacks.empty()) {
+        // Nothing below an unchanged path can have changed either
+        if (equalViews(before, after)) return;
+        for (const auto& [_, callback] : node.callbacks) {
+            out.push_back(callback);
+        }
+    }
+    for (const auto& [segment, child] : node.children) {
+        collect(*child, before.child(segment), after.child(segment), out);
+    }
+}
+
+} // namespace
+
+PathSubscriptions::SubscriberId PathSubscriptions::subscribe(
+    const std::vector<std::string>& path,
+    Callback callback
+) {
+    Node* node = &root_;
+    for (const auto& segment : path) {
+        auto& child = node->children[segment];
+        if (!child) child = std::make_unique<Node>();
+        node = child.get();
+    }
+    SubscriberId id = nextId_++;
+    node->callbacks.emplace_back(id, std::move(callback));
+    paths_.emplace(id, path);
+    return id;
+}
+
+void PathSubscriptions::unsubscribe(SubscriberId id) {
+    auto it = paths_.find(id);
+    if (it == paths_.end()) return;
+    auto path = std::move(it->second);
+    paths_.erase(it);
+
+    // Remember the way down so empty nodes can be pruned on the way back up
+    std::vector<Node*> trail{&root_};
+    for (const auto& segment : path) {
+        trail.push_back(trail.back()->children.at(segment).get());
+    }
+
+    auto& callbacks = trail.back()->callbacks;
+    callbacks.erase(
+        std::remove_if(callbacks.begin(), callbacks.end(),
+            [id](const auto& pair) { return pair.first == id; }),
+        callbacks.end()
+    );
+
+    for (size_t depth = path.size(); depth > 0; --depth) {
+        Node* node = trail[depth];
+        if (!node->callbacks.empty() || !node->children.empty()) break;
+        trail[depth - 1]->children.erase(path[depth - 1]);
+    }
+}
+
+void PathSubscriptions::collectChanged(
+    const Snapshot& before,
+    const Snapshot& after,
+    std::vector<Callback>& out
+) const {
+    collect(root_, View::of(before), View::of(after), out);
+}
+
+} // namespace margelo::nitro::nitrostate
@@ -0,0 +1,61 @@
+#pragma once
+
+#include <NitroModules/AnyMap.hpp>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "PersistentMap.hpp"
+
+namespace margelo::nitro::nitrostate {
+
+using namespace margelo::nitro;
+
+/**
+ * PathSubscriptions - Field-level subscribers of one atom
+ *
+ * Subscriptions are kept in a trie keyed by path segment. On notify, the
+ * trie is walked alongside the previous and current values: a subscriber
+ * fires only if the value at its path changed, and subtrees that are
+ * unchanged (or shared between two persistent versions) are skipped.
+ * Not thread-safe; AtomCore guards it.
+ */
+class PathSubscriptions {
+public:
+    using SubscriberId = size_t;
+    using Callback = std::function<void()>;
+
+    /**
+     * A published atom value: a plain map or a persistent tree
+     */
+    struct Snapshot {
+        std::shared_ptr<AnyMap> map;
+        std::optional<PersistentMap> tree;
+    };
+
+    SubscriberId subscribe(const std::vector<std::string>& path, Callback callback);
+    void unsubscribe(SubscriberId id);
+    // Unsubscribing prunes the trie, so only the root is left once empty
+    bool empty() const { return root_.children.empty() && root_.callbacks.empty(); }
+
+    /**
+     * Append the callbacks whose path holds a different value in `after`
+     * than in `before`
+     */
+    void collectChanged(const Snapshot& before, const Snapshot& after, std::vector<Callback>& out) const;
+
+private:
+    struct Node {
+        std::unordered_map<std::string, std::unique_ptr<Node>> children;
+        std::vector<std::pair<SubscriberId, Callback>> callbacks;
+    };
+
+    Node root_;
+    std::unordered_map<SubscriberId, std::vector<std::string>> paths_;
+    SubscriberId nextId_ = 0;
+};
+
+} // namespace margelo::nitro::nitrostate
@@ -0,0 +1,393 @@
+#include "PersistentMap.hpp"
+#include <stdexcept>
+#include <utility>
+
+namespace margelo::nitro::nitrostate {
+
+namespace {
+
+constexpr unsigned kBits = 5;
+constexpr uint32_t kMask = (1u << kBits) - 1;
+// Past this shift the hash is exhausted and colliding keys share a list
+constexpr unsigned kMaxShift = 64;
+
+uint64_t hashKey(const std::string& key) {
+    uint64_t hash = std::hash<std::string>{}(key);
+    // Spread the bits; std::hash may be the identity on some platforms
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    return hash;
+}
+
+} // namespace
+
+std::optional<size_t> PersistentMap::arrayIndex(const std::string& segment) {
+    if (segment.empty() || segment.size() > 9) return std::nullopt;
+    size_t index = 0;
+    for (char c : segment) {
+        if (c < '0' || c > '9') return std::nullopt;
+        index = index * 10 + static_cast<size_t>(c - '0');
+    }
+    return index;
+}
+
+struct PersistentMap::Entry {
+    uint64_t hash;
+    std::string key;
+    PersistentValue value;
+};
+
+/**
+ * Bitmap-indexed node: bit i of `bitmap` is set when slot i is occupied,
+ * and occupied slots are packed in `children` in bit order. A slot holds
+ * either an entry or a child node. Nodes past kMaxShift are plain lists.
+ */
+struct PersistentMap::Node {
+    struct Slot {
+        std::shared_ptr<const Entry> entry;
+        std::shared_ptr<const Node> node;
+    };
+
+    uint32_t bitmap = 0;
+    std::vector<Slot> children;
+    // Only used once the hash is exhausted
+    std::vector<std::shared_ptr<const Entry>> collisions;
+
+    static size_t position(uint32_t bitmap, uint32_t bit) {
+        return static_cast<size_t>(__builtin_popcount(bitmap & (bit - 1)));
+    }
+
+    const Entry* find(uint64_t hash, const std::string& key, unsigned shift) const {
+        if (shift >= kMaxShift) {
+            for (const auto& entry : collisions) {
+                if (entry->key == key) return entry.get();
+            }
+            return nullptr;
+        }
+        uint32_t bit = 1u << ((hash >> shift) & kMask);
+        if ((bitmap & bit) == 0) return nullptr;
+        const auto& slot = children[position(bitmap, bit)];
+        if (slot.node) return slot.node->find(hash, key, shift + kBits);
+        return slot.entry->key == key ? slot.entry.get() : nullptr;
+    }
+
+    // Node holding two entries that share the hash bits below `shift`
+    static std::shared_ptr<const Node> pair(
+        std::shared_ptr<const Entry> a,
+        std::shared_ptr<const Entry> b,
+        unsigned shift
+    ) {
+        auto node = std::make_shared<Node>();
+        if (shift >= kMaxShift) {
+            node->collisions = {std::move(a), std::move(b)};
+            return node;
+        }
+        uint32_t indexA = (a->hash >> shift) & kMask;
+        uint32_t indexB = (b->hash >> shift) & kMask;
+        if (indexA == indexB) {
+            node->bitmap = 1u << indexA;
+            node->children.push_back({nullptr, pair(std::move(a), std::move(b), shift + kBits)});
+        } else {
+            node->bitmap = (1u << indexA) | (1u << indexB);
+            if (indexA > indexB) std::swap(a, b);
+            node->children.push_back({std::move(a), nullptr});
+            node->children.push_back({std::move(b), nullptr});
+        }
+        return node;
+    }
+
+    // Path-copying insert; sets `added` when the key was not present before
+    static std::shared_ptr<const Node> insert(
+        const Node* node,
+        std::shared_ptr<const Entry> entry,
+        unsigned shift,
+        bool& added
+    ) {
+        if (shift >= kMaxShift) {
+            auto copy = std::make_shared<Node>(*node);
+            for (auto& existing : copy->collisions) {
+                if (existing->key == entry->key) {
+                    existing = std::move(entry);
+                    return copy;
+                }
+            }
+            copy->collisions.push_back(std::move(entry));
+            added = true;
+            return copy;
+        }
+
+        uint32_t bit = 1u << ((entry->hash >> shift) & kMask);
+        size_t index = position(node->bitmap, bit);
+        auto copy = std::make_shared<Node>(*node);
+
+        if ((node->bitmap & bit) == 0) {
+            copy->bitmap |= bit;
+            copy->children.insert(copy->children.begin() + static_cast<ptrdiff_t>(index), Slot{std::move(entry), nullptr});
+            added = true;
+            return copy;
+        }
+
+        auto& slot = copy->children[index];
+        if (slot.node) {
+            slot.node = insert(slot.node.get(), std::move(entry), shift + kBits, added);
+        } else if (slot.entry->key == entry->key) {
+            slot.entry = std::move(entry);
+        } else {
+            slot.node = pair(std::move(slot.entry), std::move(entry), shift + kBits);
+            slot.entry = nullptr;
+            added = true;
+        }
+        return copy;
+    }
+
+    // insert() for a node nothing shares yet, as while building a map:
+    // mutates in place instead of copying the path
+    static void insertInPlace(Node& node, std::shared_ptr<const Entry> entry, unsigned shift, bool& added) {
+        if (shift >= kMaxShift) {
+            for (auto& existing : node.collisions) {
+                if (existing->key == entry->key) {
+                    existing = std::move(entry);
+                    return;
+                }
+            }
+            node.collisions.push_back(std::move(entry));
+            added = true;
+            return;
+        }
+
+        uint32_t bit = 1u << ((entry->hash >> shift) & kMask);
+        size_t index = position(node.bitmap, bit);
+        if ((node.bitmap & bit) == 0) {
+            node.bitmap |= bit;
+            node.children.insert(node.children.begin() + static_cast<ptrdiff_t>(index), Slot{std::move(entry), nullptr});
+            added = true;
+            return;
+        }
+
+        auto& slot = node.children[index];
+        if (slot.node) {
+            // Created by pair() during this build, so not actually const
+            insertInPlace(const_cast<Node&>(*slot.node), std::move(entry), shift + kBits, added);
+        } else if (slot.entry->key == entry->key) {
+            slot.entry = std::move(entry);
+        } else {
+            slot.node = pair(std::move(slot.entry), std::move(entry), shift + kBits);
+            slot.entry = nullptr;
+            added = true;
+        }
+    }
+
+    bool every(const std::function<bool(const std::string&, const PersistentValue&)>& predicate) const {
+        for (const auto& entry : collisions) {
+            if (!predicate(entry->key, entry->value)) return false;
+        }
+        for (const auto& slot : children) {
+            bool passed = slot.node
+                ? slot.node->every(predicate)
+                : predicate(slot.entry->key, slot.entry->value);
+            if (!passed) return false;
+        }
+        return true;
+    }
+};
+
+PersistentMap PersistentMap::fromObject(const AnyObject& object) {
+    if (object.empty()) return PersistentMap();
+    // Nested objects stay plain; setIn() converts the ones it descends into
+    auto root = std::make_shared<Node>();
+    size_t size = 0;
+    for (const auto& [key, value] : object) {
+        bool added = false;
+        Node::insertInPlace(*root, std::make_shared<const Entry>(Entry{hashKey(key), key, value}), 0, added);
+        size += added ? 1 : 0;
+    }
+    return PersistentMap(std::move(root), size);
+}
+
+const PersistentValue* PersistentMap::find(const std::string& key) const {
+    if (!root_) return nullptr;
+    const Entry* entry = root_->find(hashKey(key), key, 0);
+    return entry != nullptr ? &entry->value : nullptr;
+}
+
+PersistentMap PersistentMap::set(const std::string& key, PersistentValue value) const {
+    auto entry = std::make_shared<const Entry>(Entry{hashKey(key), key, std::move(value)});
+    if (!root_) {
+        auto root = std::make_shared<Node>();
+        root->bitmap = 1u << (entry->hash & kMask);
+        root->children.push_back({std::move(entry), nullptr});
+        return PersistentMap(std::move(root), 1);
+    }
+    bool added = false;
+    auto root = Node::insert(root_.get(), std::move(entry), 0, added);
+    return PersistentMap(std::move(root), size_ + (added ? 1 : 0));
+}
+
+void PersistentMap::forEach(const std::function<void(const std::string&, const PersistentValue&)>& visitor) const {
+    every([&](const std::string& key, const PersistentValue& value) {
+        visitor(key, value);
+        return true;
+    });
+}
+
+bool PersistentMap::every(const std::function<bool(const std::string&, const PersistentValue&)>& predicate) const {
+    return !root_ || root_->every(predicate);
+}
+
+AnyObject PersistentMap::toObject() const {
+    AnyObject object;
+    object.reserve(size_);
+    forEach([&](const std::string& key, const PersistentValue& value) {
+        object.emplace(key, toAny(value));
+    });
+    return object;
+}
+
+PersistentValue PersistentMap::fromAny(const AnyValue& value) {
+    if (const auto* object = std::get_if<AnyObject>(&value)) {
+        return fromObject(*object);
+    }
+    return value;
+}
+
+AnyValue PersistentMap::toAny(const PersistentValue& value) {
+    if (const auto* map = std::get_if<PersistentMap>(&value)) {
+        return map->toObject();
+    }
+    return std::get<AnyValue>(value);
+}
+
+namespace {
+
+// Arrays and plain objects below a persistent level are copied on write
+const AnyValue* findInPlain(const AnyValue& root, const std::vector<std::string>& path, size_t depth) {
+    const AnyValue* current = &root;
+    for (; depth < path.size(); ++depth) {
+        if (const auto* object = std::get_if<AnyObject>(current)) {
+            auto it = object->find(path[depth]);
+            if (it == object->end()) return nullptr;
+            current = &it->second;
+        } else if (const auto* array = std::get_if<AnyArray>(current)) {
+            auto index = PersistentMap::arrayIndex(path[depth]);
+            if (!index || *index >= array->size()) return nullptr;
+            current = &(*array)[*index];
+        } else {
+            return nullptr;
+        }
+    }
+    return current;
+}
+
+std::optional<AnyValue> getInPlain(const AnyValue& root, const std::vector<std::string>& path, size_t depth) {
+    const AnyValue* found = findInPlain(root, path, depth);
+    if (found == nullptr) return std::nullopt;
+    return *found;
+}
+
+AnyValue setInPlain(const AnyValue& root, const std::vector<std::string>& path, size_t depth, AnyValue& value) {
+    if (depth == path.size()) return std::move(value);
+
+    if (const auto* array = std::get_if<AnyArray>(&root)) {
+        auto index = PersistentMap::arrayIndex(path[depth]);
+        if (!index) {
+            throw std::runtime_error("Path segment '" + path[depth] + "' is not an array index");
+        }
+        // Like a JS array, but without holes: at most one past the end
+        if (*index > array->size()) {
+            throw std::runtime_error("Array index " + path[depth] + " is past the end of an array of length " +
+                                     std::to_string(array->size()));
+        }
+        AnyArray copy = *array;
+        if (*index == copy.size()) copy.emplace_back(NullType());
+        copy[*index] = setInPlain(copy[*index], path, depth + 1, value);
+        return copy;
+    }
+
+    AnyObject copy;
+    if (const auto* object = std::get_if<AnyObject>(&root)) copy = *object;
+    static const AnyValue kMissing{NullType()};
+    auto it = copy.find(path[depth]);
+    copy[path[depth]] = setInPlain(it != copy.end() ? it->second : kMissing, path, depth + 1, value);
+    return copy;
+}
+
+} // namespace
+
+std::optional<AnyValue> PersistentMap::getIn(const PersistentValue& root, const std::vector<std::string>& path) {
+    const PersistentValue* current = &root;
+    for (size_t depth = 0; depth < path.size(); ++depth) {
+        const auto* map = std::get_if<PersistentMap>(current);
+        if (map == nullptr) {
+            return getInPlain(std::get<AnyValue>(*current), path, depth);
+        }
+        current = map->find(path[depth]);
+        if (current == nullptr) return std::nullopt;
+    }
+    return toAny(*current);
+}
+
+const AnyValue* PersistentMap::findPlainIn(const PersistentValue& root, const std::vector<std::string>& path) {
+    const PersistentValue* current = &root;
+    for (size_t depth = 0; depth < path.size(); ++depth) {
+        const auto* map = std::get_if<PersistentMap>(current);
+        if (map == nullptr) {
+            return findInPlain(std::get<AnyValue>(*current), path, depth);
+        }
+        current = map->find(path[depth]);
+        if (current == nullptr) return nullptr;
+    }
+    return std::get_if<AnyValue>(current);
+}
+
+std::optional<AnyValue> PersistentMap::getIn(const AnyMap& root, const std::vector<std::string>& path) {
+    const auto& object = root.getMap();
+    if (path.empty()) {
+        return AnyObject(object);
+    }
+    auto it = object.find(path.front());
+    if (it == object.end()) return std::nullopt;
+    return getInPlain(it->second, path, 1);
+}
+
+PersistentValue PersistentMap::setIn(
+    const PersistentValue& root,
+    const std::vector<std::string>& path,
+    AnyValue value
+) {
+    // Taken by value so a caller's fresh array is moved in, not copied
+    return setIn(root, path, 0, value);
+}
+
+PersistentValue PersistentMap::setIn(
+    const PersistentValue& node,
+    const std::vector<std::string>& path,
+    size_t depth,
+    AnyValue& value
+) {
+    if (depth == path.size()) {
+        if (std::holds_alternative<AnyObject>(value)) return fromAny(value);
+        return std::move(value);
+    }
+
+    PersistentMap map;
+    if (const auto* existing = std::get_if<PersistentMap>(&node)) {
+        map = *existing;
+    } else {
+        const auto& plain = std::get<AnyValue>(node);
+        if (std::holds_alternative<AnyArray>(plain)) {
+            return setInPlain(plain, path, depth, value);
+        }
+        if (const auto* object = std::get_if<AnyObject>(&plain)) {
+            map = fromObject(*object);
+        }
+    }
+
+    // By reference: a conditional with a temporary would copy the child
+    static const PersistentValue kMissing{AnyValue(NullType())};
+    const PersistentValue* child = map.find(path[depth]);
+    auto updated = setIn(child != nullptr ? *child : kMissing, path, depth + 1, value);
+    return map.set(path[depth], std::move(updated));
+}
+
+} // namespace margelo::nitro::nitrostate
@@ -0,0 +1,136 @@
+#pragma once
+
+#include <NitroModules/AnyMap.hpp>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <variant>
+#include <vector>
+
+namespace margelo::nitro::nitrostate {
+
+using namespace margelo::nitro;
+
+class PersistentMap;
+
+/**
+ * A value stored in a PersistentMap: a plain AnyValue, or a nested
+ * PersistentMap for an object that has been edited through setIn()
+ */
+using PersistentValue = std::variant<AnyValue, PersistentMap>;
+
+/**
+ * PersistentMap - Immutable hash array mapped trie keyed by string
+ *
+ * Updates copy only the O(log32 n) nodes on the path to the changed entry
+ * and share everything else with the previous version, so editing one
+ * entry of a 50k-entry object does not copy the other 49,999.
+ * Instances are cheap to copy and safe to read from any thread.
+ */
+class PersistentMap {
+public:
+    PersistentMap() = default;
+
+    /**
+     * Convert a plain object. Only the top level becomes a trie, built in
+     * place in O(n); nested objects stay plain values until an edit
+     * descends into them.
+     */
+    static PersistentMap fromObject(const AnyObject& object);
+
+    size_t size() const { return size_; }
+
+    /**
+     * True if both maps are the same version, i.e. share their root.
+     * Cheap identity check for diffing; equal contents may still differ here.
+     */
+    bool sameAs(const PersistentMap& other) const { return root_ == other.root_; }
+
+    /**
+     * @return The value stored under `key`, or nullptr if absent
+     */
+    const PersistentValue* find(const std::string& key) const;
+
+    /**
+     * @return A new map with `key` set to `value`
+     */
+    PersistentMap set(const std::string& key, PersistentValue value) const;
+
+    /**
+     * Visit every entry in unspecified order
+     */
+    void forEach(const std::function<void(const std::string&, const PersistentValue&)>& visitor) const;
+
+    /**
+     * Check `predicate` against every entry, stopping at the first false
+     */
+    bool every(const std::function<bool(const std::string&, const PersistentValue&)>& predicate) const;
+
+    /**
+     * Materialize back into a plain object. O(n).
+     */
+    AnyObject toObject() const;
+
+    /**
+     * Convert a plain value: objects become maps (see fromObject), the rest
+     * is kept as is
+     */
+    static PersistentValue fromAny(const AnyValue& value);
+
+    /**
+     * Materialize a stored value into a plain AnyValue
+     */
+    static AnyValue toAny(const PersistentValue& value);
+
+    /**
+     * Parse a path segment as an array index
+     */
+    static std::optional<size_t> arrayIndex(const std::string& segment);
+
+    /**
+     * Read the value at `path`, descending through nested objects and
+     * (by numeric segment) arrays
+     */
+    static std::optional<AnyValue> getIn(const PersistentValue& root, const std::vector<std::string>& path);
+    static std::optional<AnyValue> getIn(const AnyMap& root, const std::vector<std::string>& path);
+
+    /**
+     * getIn() without the copy: the plain value stored at `path`, or nullptr
+     * if there is none or it is a nested map. Valid while `root` is.
+     */
+    static const AnyValue* findPlainIn(const PersistentValue& root, const std::vector<std::string>& path);
+
+    /**
+     * @return A copy of `root` with `value` written at `path`. Plain objects
+     * along the path become maps, so later writes there copy O(log n).
+     * Missing or non-object intermediate values are replaced by empty objects. An
+     * array index may be at most the array's length, which appends.
+     * Arrays are plain values: writing into one copies it, O(length).
+     * @throws std::runtime_error for an index further past the end
+     */
+    static PersistentValue setIn(
+        const PersistentValue& root,
+        const std::vector<std::string>& path,
+        AnyValue value
+    );
+
+private:
+    struct Entry;
+    struct Node;
+
+    static PersistentValue setIn(
+        const PersistentValue& node,
+        const std::vector<std::string>& path,
+        size_t depth,
+        AnyValue& value
+    );
+
+    PersistentMap(std::shared_ptr<const Node> root, size_t size) : root_(std::move(root)), size_(size) {}
+
+    std::shared_ptr<const Node> root_;
+    size_t size_ = 0;
+};
+
+} // namespace margelo::nitro::nitrostate
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+namespace margelo::nitro::nitrostate {
+
+/**
+ * RefCount - External owners of an atom or computed (JS objects)
+ *
+ * Nodes start out unmanaged and are never collected. The first retain()
+ * makes a node managed; from then on the collector may claim it with
+ * tryCollect() whenever the count is zero. A claimed node stays dead:
+ * every later retain() fails, so a swept node is never revived.
+ */
+class RefCount {
+public:
+    /**
+     * @return false if the node was already collected
+     */
+    bool retain() {
+        uint32_t state = state_.load(std::memory_order_relaxed);
+        while (true) {
+            if (state == kCollected) return false;
+            uint32_t next = state == kUnmanaged ? 1 : state + 1;
+            if (state_.compare_exchange_weak(state, next, std::memory_order_acq_rel)) return true;
+        }
+    }
+
+    void release() {
+        uint32_t state = state_.load(std::memory_order_relaxed);
+        while (state != kUnmanaged && state != kCollected && state != 0) {
+            if (state_.compare_exchange_weak(state, state - 1, std::memory_order_acq_rel)) return;
+        }
+    }
+
+    /**
+     * Claim a managed node nobody holds
+     * @return true if the caller now owns its reclamation
+     */
+    bool tryCollect() {
+        uint32_t expected = 0;
+        return state_.compare_exchange_strong(expected, kCollected, std::memory_order_acq_rel);
+    }
+
+    /**
+     * Whether the node is managed and currently unheld
+     */
+    bool isUnheld() const { return state_.load(std::memory_order_acquire) == 0; }
+
+    /**
+     * Whether some owner currently holds the node
+     */
+    bool isHeld() const {
+        uint32_t state = state_.load(std::memory_order_acquire);
+        return state != 0 && state != kUnmanaged && state != kCollected;
+    }
+
+private:
+    static constexpr uint32_t kUnmanaged = UINT32_MAX;
+    static constexpr uint32_t kCollected = UINT32_MAX - 1;
+
+    std::atomic<uint32_t> state_{kUnmanaged};
+};
+
+} // namespace margelo::nitro::nitrostate
@@ -0,0 +1,286 @@
+#include "Selector.hpp"
+#include "PersistentMap.hpp"
+#include "ValueEquality.hpp"
+#include <cmath>
+#include <stdexcept>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+
+namespace margelo::nitro::nitrostate {
+
+namespace {
+
+// Deeper specs are rejected rather than risking the stack while evaluating
+constexpr unsigned kMaxDepth = 64;
+
+[[noreturn]] void invalid(const std::string& message) {
+    throw std::runtime_error("Invalid selector: " + message);
+}
+
+const AnyValue* member(const AnyObject& object, const char* name) {
+    auto it = object.find(name);
+    return it != object.end() ? &it->second : nullptr;
+}
+
+std::vector<std::string> pathOf(const AnyValue* value, bool required) {
+    std::vector<std::string> path;
+    if (value == nullptr) {
+        if (required) invalid("expected a path");
+        return path;
+    }
+    const auto* array = std::get_if<AnyArray>(value);
+    if (array == nullptr) invalid("a path must be an array");
+    for (const auto& segment : *array) {
+        if (const auto* string = std::get_if<std::string>(&segment)) {
+            path.push_back(*string);
+        } else if (const auto* number = std::get_if<double>(&segment);
+                   number != nullptr && *number >= 0 && std::floor(*number) == *number) {
+            path.push_back(std::to_string(static_cast<uint64_t>(*number)));
+        } else {
+            invalid("path segments must be strings or array indices");
+        }
+    }
+    return path;
+}
+
+// Value at `path` below `root`, without copying it
+const AnyValue* lookup(const AnyValue& root, const std::vector<std::string>& path) {
+    const AnyValue* current = &root;
+    for (const auto& segment : path) {
+        if (const auto* object = std::get_if<AnyObject>(current)) {
+            auto it = object->find(segment);
+            if (it == object->end()) return nullptr;
+            current = &it->second;
+        } else if (const auto* array = std::get_if<AnyArray>(current)) {
+            auto index = PersistentMap::arrayIndex(segment);
+            if (!index || *index >= array->size()) return nullptr;
+            current = &(*array)[*index];
+        } else {
+            return nullptr;
+        }
+    }
+    return current;
+}
+
+bool truthy(const AnyValue& value) {
+    if (const auto* flag = std::get_if<bool>(&value)) return *flag;
+    if (const auto* number = std::get_if<double>(&value)) return *number != 0 && !std::isnan(*number);
+    if (const auto* bigint = std::get_if<int64_t>(&value)) return *bigint != 0;
+    if (const auto* string = std::get_if<std::string>(&value)) return !string->empty();
+    return !std::holds_alternative<NullType>(value);
+}
+
+// String length as JS counts it, in UTF-16 code units
+double utf16Length(std::string_view string) {
+    double length = 0;
+    for (unsigned char byte : string) {
+        if ((byte & 0xC0) != 0x80) length++;
+        // Four-byte sequences become surrogate pairs
+        if (byte >= 0xF0) length++;
+    }
+    return length;
+}
+
+} // namespace
+
+Selector Selector::compile(const AnyMap& spec) {
+    Selector selector;
+    for (const auto& [field, expression] : spec.getMap()) {
+        selector.fields_.emplace_back(field, selector.compileNode(expression, 0));
+    }
+    return selector;
+}
+
+uint32_t Selector::sourceIndex(const std::string& key) {
+    for (uint32_t i = 0; i < sources_.size(); i++) {
+        if (sources_[i] == key) return i;
+    }
+    sources_.push_back(key);
+    return static_cast<uint32_t>(sources_.size() - 1);
+}
+
+uint32_t Selector::compileNode(const AnyValue& expression, unsigned depth) {
+    if (depth > kMaxDepth) invalid("expressions nest too deeply");
+    const auto* object = std::get_if<AnyObject>(&expression);
+    if (object == nullptr) invalid("expressions must be objects with an op");
+    const auto* opValue = member(*object, "op");
+    const auto* opName = opValue != nullptr ? std::get_if<std::string>(opValue) : nullptr;
+    if (opName == nullptr) invalid("expressions must be objects with an op");
+
+    static const std::unordered_map<std::string, Op> kOps = {
+        {"get", Op::Get}, {"const", Op::Const}, {"field", Op::Field},
+        {"add", Op::Add}, {"sub", Op::Sub}, {"mul", Op::Mul}, {"div", Op::Div}, {"mod", Op::Mod},
+        {"eq", Op::Eq}, {"ne", Op::Ne}, {"lt", Op::Lt}, {"le", Op::Le}, {"gt", Op::Gt}, {"ge", Op::Ge},
+        {"and", Op::And}, {"or", Op::Or}, {"not", Op::Not},
+        {"length", Op::Length}, {"filter", Op::Filter},
+    };
+    auto it = kOps.find(*opName);
+    if (it == kOps.end()) invalid("unknown op '" + *opName + "'");
+
+    Node node;
+    node.op = it->second;
+    auto operand = [&](const char* name) {
+        const auto* value = member(*object, name);
+        if (value == nullptr) invalid("'" + *opName + "' expects '" + name + "'");
+        node.args.push_back(compileNode(*value, depth + 1));
+    };
+    auto operands = [&](size_t count) {
+        const auto* value = member(*object, "args");
+        const auto* args = value != nullptr ? std::get_if<AnyArray>(value) : nullptr;
+        if (args == nullptr || (count != 0 && args->size() != count) || args->empty()) {
+            invalid("'" + *opName + "' expects " + (count != 0 ? std::to_string(count) : "some") + " args");
+        }
+        for (const auto& arg : *args) {
+            node.args.push_back(compileNode(arg, depth + 1));
+        }
+    };
+
+    switch (node.op) {
+        case Op::Get: {
+            const auto* source = member(*object, "source");
+            if (source == nullptr || !std::holds_alternative<std::string>(*source)) {
+                invalid("'get' expects a source key");
+            }
+            node.source = sourceIndex(std::get<std::string>(*source));
+            node.path = pathOf(member(*object, "path"), false);
+            break;
+        }
+        case Op::Const: {
+            const auto* value = member(*object, "value");
+            node.value = value != nullptr ? *value : AnyValue(NullType());
+            break;
+        }
+        case Op::Field:
+            operand("of");
+            node.path = pathOf(member(*object, "path"), true);
+            break;
+        case Op::Add: case Op::Sub: case Op::Mul: case Op::Div: case Op::Mod:
+        case Op::Eq: case Op::Ne: case Op::Lt: case Op::Le: case Op::Gt: case Op::Ge:
+            operands(2);
+            break;
+        case Op::And: case Op::Or:
+            operands(0);
+            break;
+        case Op::Not: case Op::Length:
+            operand("of");
+            break;
+        case Op::Filter:
+            operand("of");
+            operand("equals");
+            node.path = pathOf(member(*object, "path"), true);
+            break;
+    }
+
+    nodes_.push_back(std::move(node));
+    return static_cast<uint32_t>(nodes_.size() - 1);
+}
+
+std::shared_ptr<AnyMap> Selector::evaluate(const Reader& read) const {
+    auto result = AnyMap::make();
+    auto& map = result->getMap();
+    for (const auto& [field, root] : fields_) {
+        map.insert_or_assign(field, evaluateNode(root, read));
+    }
+    return result;
+}
+
+AnyValue Selector::evaluateNode(uint32_t index, const Reader& read) const {
+    const auto& node = nodes_[index];
+    auto arg = [&](size_t i) { return evaluateNode(node.args[i], read); };
+
+    switch (node.op) {
+        case Op::Get: {
+            auto value = read(node.source, node.path);
+            return value ? std::move(*value) : AnyValue(NullType());
+        }
+        case Op::Const:
+            return node.value;
+        case Op::Field: {
+            auto of = arg(0);
+            const auto* value = lookup(of, node.path);
+            return value != nullptr ? *value : AnyValue(NullType());
+        }
+        case Op::Add: case Op::Sub: case Op::Mul: case Op::Div: case Op::Mod: {
+            auto left = arg(0);
+            auto right = arg(1);
+            if (node.op == Op::Add) {
+                const auto* a = std::get_if<std::string>(&left);
+                const auto* b = std::get_if<std::string>(&right);
+                if (a != nullptr && b != nullptr) return *a + *b;
+            }
+            const auto* a = std::get_if<double>(&left);
+            const auto* b = std::get_if<double>(&right);
+            if (a == nullptr || b == nullptr) return NullType();
+            switch (node.op) {
+                case Op::Add: return *a + *b;
+                case Op::Sub: return *a - *b;
+                case Op::Mul: return *a * *b;
+                case Op::Div: return *a / *b;
+                default: return std::fmod(*a, *b);
+            }
+        }
+        case Op::Eq:
+            return ValueEquality::deepEqual(arg(0), arg(1));
+        case Op::Ne:
+            return !ValueEquality::deepEqual(arg(0), arg(1));
+        case Op::Lt: case Op::Le: case Op::Gt: case Op::Ge: {
+            auto left = arg(0);
+            auto right = arg(1);
+            int order;
+            if (std::holds_alternative<double>(left) && std::holds_alternative<double>(right)) {
+                double a = std::get<double>(left);
+                double b = std::get<double>(right);
+                // NaN is unordered, like in JS
+                if (std::isnan(a) || std::isnan(b)) return false;
+                order = a < b ? -1 : (a > b ? 1 : 0);
+            } else if (std::holds_alternative<std::string>(left) && std::holds_alternative<std::string>(right)) {
+                order = std::get<std::string>(left).compare(std::get<std::string>(right));
+            } else {
+                return false;
+            }
+            switch (node.op) {
+                case Op::Lt: return order < 0;
+                case Op::Le: return order <= 0;
+                case Op::Gt: return order > 0;
+                default: return order >= 0;
+            }
+        }
+        case Op::And:
+            for (size_t i = 0; i < node.args.size(); i++) {
+                if (!truthy(arg(i))) return false;
+            }
+            return true;
+        case Op::Or:
+            for (size_t i = 0; i < node.args.size(); i++) {
+                if (truthy(arg(i))) return true;
+            }
+            return false;
+        case Op::Not:
+            return !truthy(arg(0));
+        case Op::Length: {
+            auto of = arg(0);
+            if (const auto* array = std::get_if<AnyArray>(&of)) return static_cast<double>(array->size());
+            if (const auto* string = std::get_if<std::string>(&of)) return utf16Length(*string);
+            return NullType();
+        }
+        case Op::Filter: {
+            auto of = arg(0);
+            const auto* items = std::get_if<AnyArray>(&of);
+            if (items == nullptr) return NullType();
+            auto equals = arg(1);
+            AnyArray matches;
+            for (const auto& item : *items) {
+                const auto* value = lookup(item, node.path);
+                if (value != nullptr ? ValueEquality::deepEqual(*value, equals)
+                                     : std::holds_alternative<NullType>(equals)) {
+                    matches.push_back(item);
+                }
+            }
+            return matches;
+        }
+    }
+    return NullType();
+}
+
+} // namespace margelo::nitro::nitrostate
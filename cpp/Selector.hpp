@@ -0,0 +1,84 @@
+#pragma once
+
+#include <NitroModules/AnyMap.hpp>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace margelo::nitro::nitrostate {
+
+using namespace margelo::nitro;
+
+/**
+ * Selector - Derived value evaluated natively from a declarative spec
+ *
+ * A spec maps each field of the result to an expression, written as
+ * nested objects tagged with `op`:
+ *
+ *   { op: 'get', source: key, path?: [...] }   value in an atom or computed
+ *   { op: 'const', value }
+ *   { op: 'field', of, path }                  value at `path` inside `of`
+ *   { op: 'add' | 'sub' | 'mul' | 'div' | 'mod', args: [a, b] }
+ *   { op: 'eq' | 'ne' | 'lt' | 'le' | 'gt' | 'ge', args: [a, b] }
+ *   { op: 'and' | 'or', args: [...] }, { op: 'not', of }
+ *   { op: 'length', of }                       array or string length
+ *   { op: 'filter', of, path, equals }         items whose `path` equals `equals`
+ *
+ * Missing values read as null, and operators given the wrong types
+ * yield null (arithmetic) or false (ordering), so evaluation never
+ * throws. The spec is validated and flattened once by compile().
+ */
+class Selector {
+public:
+    /**
+     * Read the value at `path` in sources()[source]; nullopt if missing
+     */
+    using Reader = std::function<std::optional<AnyValue>(size_t source, const std::vector<std::string>& path)>;
+
+    /**
+     * @throws std::runtime_error if the spec is malformed
+     */
+    static Selector compile(const AnyMap& spec);
+
+    /**
+     * Keys of the atoms and computeds the expressions read, without duplicates
+     */
+    const std::vector<std::string>& sources() const { return sources_; }
+
+    std::shared_ptr<AnyMap> evaluate(const Reader& read) const;
+
+private:
+    enum class Op : uint8_t {
+        Get, Const, Field,
+        Add, Sub, Mul, Div, Mod,
+        Eq, Ne, Lt, Le, Gt, Ge,
+        And, Or, Not,
+        Length, Filter,
+    };
+
+    struct Node {
+        Op op;
+        // Operands by node index; `of` comes first, then `equals` for Filter
+        std::vector<uint32_t> args;
+        std::vector<std::string> path;
+        AnyValue value;
+        uint32_t source = 0;
+    };
+
+    Selector() = default;
+
+    uint32_t compileNode(const AnyValue& expression, unsigned depth);
+    uint32_t sourceIndex(const std::string& key);
+    AnyValue evaluateNode(uint32_t index, const Reader& read) const;
+
+    std::vector<Node> nodes_;
+    // Output field and the root node of its expression
+    std::vector<std::pair<std::string, uint32_t>> fields_;
+    std::vector<std::string> sources_;
+};
+
+} // namespace margelo::nitro::nitrostate
@@ -0,0 +1,81 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+namespace margelo::nitro::nitrostate {
+
+/**
+ * SlotTable - Append-only table addressed by dense 32-bit indices
+ *
+ * Storage is split into segments that double in size and are never moved,
+ * so readers can index into the table without a lock while a (single,
+ * externally serialized) writer appends new slots.
+ */
+template <typename T, unsigned FirstSegmentBits = 10>
+class SlotTable {
+public:
+    SlotTable() = default;
+    ~SlotTable() {
+        for (auto& segment : segments_) {
+            delete[] segment.load(std::memory_order_relaxed);
+        }
+    }
+
+    // Non-copyable
+    SlotTable(const SlotTable&) = delete;
+    SlotTable& operator=(const SlotTable&) = delete;
+
+    /**
+     * Number of slots handed out so far
+     */
+    uint32_t size() const { return size_.load(std::memory_order_acquire); }
+
+    /**
+     * Lock-free lookup, returns nullptr for indices never allocated
+     */
+    T* at(uint32_t index) const {
+        if (index >= size()) return nullptr;
+        auto [segment, offset] = locate(index);
+        return &segments_[segment].load(std::memory_order_acquire)[offset];
+    }
+
+    /**
+     * Append a default-constructed slot and return its index.
+     * Callers must serialize allocations.
+     */
+    uint32_t allocate() {
+        uint32_t index = size_.load(std::memory_order_relaxed);
+        auto [segment, offset] = locate(index);
+        if (offset == 0) {
+            segments_[segment].store(new T[segmentSize(segment)], std::memory_order_release);
+        }
+        size_.store(index + 1, std::memory_order_release);
+        return index;
+    }
+
+    static constexpr uint64_t capacity() {
+        return (uint64_t{1} << FirstSegmentBits) * ((uint64_t{1} << kSegmentCount) - 1);
+    }
+
+private:
+    static constexpr unsigned kSegmentCount = 33 - FirstSegmentBits;
+
+    static constexpr uint64_t segmentSize(unsigned segment) {
+        return uint64_t{1} << (FirstSegmentBits + segment);
+    }
+
+    static std::pair<unsigned, uint64_t> locate(uint32_t index) {
+        uint64_t biased = uint64_t{index} + (uint64_t{1} << FirstSegmentBits);
+        unsigned msb = 63 - static_cast<unsigned>(__builtin_clzll(biased));
+        unsigned segment = msb - FirstSegmentBits;
+        return {segment, biased - (uint64_t{1} << msb)};
+    }
+
+    std::array<std::atomic<T*>, kSegmentCount> segments_{};
+    std::atomic<uint32_t> size_{0};
+};
+
+} // namespace margelo::nitro::nitrostate
@@ -0,0 +1,73 @@
+#include "Transaction.hpp"
+#include <mutex>
+
+namespace margelo::nitro::nitrostate {
+
+Transaction::Entry& Transaction::track(AtomHandle handle, AtomCore& atom) {
+    auto it = entries_.find(handle);
+    if (it == entries_.end()) {
+        it = entries_.emplace(handle, Entry{atom.shared_from_this(), std::nullopt}).first;
+    }
+    return it->second;
+}
+
+std::shared_ptr<AnyMap> Transaction::get(AtomHandle handle, AtomCore& atom) {
+    auto& entry = track(handle, atom);
+    if (entry.pending) {
+        return *entry.pending;
+    }
+    if (auto value = atom.getAt(snapshotVersion_)) {
+        return value;
+    }
+    // Nothing that old is left; commit() will fail on the newer value
+    return atom.get();
+}
+
+void Transaction::set(AtomHandle handle, AtomCore& atom, const std::shared_ptr<AnyMap>& value) {
+    track(handle, atom).pending = value;
+}
+
+bool Transaction::commit(CommitClock& clock, const LivenessCheck& isLive, std::vector<Change>& changed) {
+    bool committed = tryCommit(clock, isLive, changed);
+    close();
+    return committed;
+}
+
+bool Transaction::tryCommit(CommitClock& clock, const LivenessCheck& isLive, std::vector<Change>& changed) {
+    std::vector<std::unique_lock<std::mutex>> locks;
+    locks.reserve(entries_.size());
+    for (const auto& [handle, entry] : entries_) {
+        locks.push_back(entry.atom->lockWrites());
+        if (entry.atom->commitVersion() > snapshotVersion_) {
+            return false;
+        }
+        // Writing into a deleted atom would report a write nobody can read
+        if (entry.pending && !isLive(handle, *entry.atom)) {
+            return false;
+        }
+    }
+
+    std::vector<const Entry*> writes;
+    for (const auto& [handle, entry] : entries_) {
+        if (entry.pending && entry.atom->acceptsLocked(*entry.pending)) {
+            changed.push_back({handle, entry.atom});
+            writes.push_back(&entry);
+        }
+    }
+    if (writes.empty()) {
+        return true;
+    }
+
+    uint64_t commit = clock.begin();
+    for (const auto* entry : writes) {
+        entry->atom->commitLocked(*entry->pending, commit, clock);
+    }
+    locks.clear();
+    clock.complete(commit);
+    for (const auto* entry : writes) {
+        entry->atom->trimHistory(clock);
+    }
+    return true;
+}
+
+} // namespace margelo::nitro::nitrostate
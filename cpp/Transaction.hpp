@@ -0,0 +1,105 @@
+#pragma once
+
+#include <NitroModules/AnyMap.hpp>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <vector>
+#include "AtomCore.hpp"
+#include "CommitClock.hpp"
+
+namespace margelo::nitro::nitrostate {
+
+using namespace margelo::nitro;
+
+/**
+ * Transaction - Private write set over several atoms
+ *
+ * Writes stay invisible to everyone else until commit(), which publishes
+ * them all under a single commit version. Concurrency control is
+ * optimistic: nothing is locked while the transaction runs, and commit()
+ * fails if any atom it read or wrote was written by someone else after
+ * the snapshot version. Reads come from the snapshot, which stays pinned
+ * until the transaction commits, aborts or is destroyed, so a committed
+ * transaction only ever saw values from it. Not thread-safe; one caller
+ * owns it.
+ */
+class Transaction {
+public:
+    using AtomHandle = uint32_t;
+
+    struct Change {
+        AtomHandle handle;
+        std::shared_ptr<AtomCore> atom;
+    };
+
+    /**
+     * @param snapshotVersion Pinned commit version the transaction reads at
+     * @param unpin Releases the pin; called exactly once
+     */
+    Transaction(uint64_t snapshotVersion, std::function<void(uint64_t)> unpin)
+        : snapshotVersion_(snapshotVersion), unpin_(std::move(unpin)) {}
+
+    ~Transaction() { close(); }
+
+    // Non-copyable
+    Transaction(const Transaction&) = delete;
+    Transaction& operator=(const Transaction&) = delete;
+
+    uint64_t snapshotVersion() const { return snapshotVersion_; }
+
+    /**
+     * Read an atom: the transaction's own write if there is one, else its
+     * value at the snapshot. Must be called inside an EpochManager::Guard.
+     */
+    std::shared_ptr<AnyMap> get(AtomHandle handle, AtomCore& atom);
+
+    /**
+     * Buffer a write. Must be called inside an EpochManager::Guard.
+     */
+    void set(AtomHandle handle, AtomCore& atom, const std::shared_ptr<AnyMap>& value);
+
+    using LivenessCheck = std::function<bool(AtomHandle handle, const AtomCore& atom)>;
+
+    /**
+     * Validate and publish the write set. Locks every atom involved (in
+     * handle order, so concurrent commits can't deadlock).
+     * Closes the transaction either way.
+     * @param isLive Whether `handle` still refers to `atom`; a write to an
+     *   atom deleted since it was first touched is a conflict
+     * @param changed Receives the atoms whose value changed
+     * @return false on a conflict; nothing is published
+     */
+    bool commit(CommitClock& clock, const LivenessCheck& isLive, std::vector<Change>& changed);
+
+    /**
+     * Release the snapshot. Later reads and commits are not allowed.
+     */
+    void close() {
+        if (unpin_) {
+            auto unpin = std::move(unpin_);
+            unpin_ = nullptr;
+            unpin(snapshotVersion_);
+        }
+    }
+
+private:
+    struct Entry {
+        std::shared_ptr<AtomCore> atom;
+        // Set once the transaction writes the atom
+        std::optional<std::shared_ptr<AnyMap>> pending;
+    };
+
+    Entry& track(AtomHandle handle, AtomCore& atom);
+
+    bool tryCommit(CommitClock& clock, const LivenessCheck& isLive, std::vector<Change>& changed);
+
+    uint64_t snapshotVersion_;
+    std::function<void(uint64_t)> unpin_;
+    // Ordered by handle, which is also the lock order
+    std::map<AtomHandle, Entry> entries_;
+};
+
+} // namespace margelo::nitro::nitrostate
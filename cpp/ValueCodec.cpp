@@ -0,0 +1,357 @@
+#include "ValueCodec.hpp"
+#include "PersistentMap.hpp"
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <variant>
+
+namespace margelo::nitro::nitrostate {
+
+namespace {
+
+enum Tag : uint8_t {
+    kNull = 0,
+    kFalse = 1,
+    kTrue = 2,
+    kDouble = 3,
+    kBigInt = 4,
+    kString = 5,
+    kArray = 6,
+    kObject = 7,
+    // Prefix of a value whose strings are interned
+    kInterned = 8,
+    kStringRef = 9,
+};
+
+// Deeper input is rejected rather than risking the stack
+constexpr unsigned kMaxDepth = 512;
+
+// Strings outside this range are always written out: shorter ones are no
+// larger than a reference, longer ones rarely repeat
+constexpr size_t kMinInternedLength = 2;
+constexpr size_t kMaxInternedLength = 64;
+
+bool internable(size_t length) {
+    return length >= kMinInternedLength && length <= kMaxInternedLength;
+}
+
+[[noreturn]] void corrupt() {
+    throw std::runtime_error("Corrupt encoded value");
+}
+
+uint64_t zigzag(int64_t value) {
+    return (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63);
+}
+
+int64_t unzigzag(uint64_t value) {
+    return static_cast<int64_t>(value >> 1) ^ -static_cast<int64_t>(value & 1);
+}
+
+/**
+ * Encodes one value. Every internable string is numbered in order of first
+ * appearance, and repeats are written as that number.
+ */
+class Writer {
+public:
+    explicit Writer(ValueCodec::Bytes& out) : out_(out) {}
+
+    void value(const AnyValue& value) {
+        if (std::holds_alternative<NullType>(value)) {
+            out_.push_back(kNull);
+        } else if (const auto* flag = std::get_if<bool>(&value)) {
+            out_.push_back(*flag ? kTrue : kFalse);
+        } else if (const auto* number = std::get_if<double>(&value)) {
+            out_.push_back(kDouble);
+            uint8_t bytes[sizeof(double)];
+            std::memcpy(bytes, number, sizeof(double));
+            out_.insert(out_.end(), bytes, bytes + sizeof(double));
+        } else if (const auto* bigint = std::get_if<int64_t>(&value)) {
+            out_.push_back(kBigInt);
+            ValueCodec::writeVarint(out_, zigzag(*bigint));
+        } else if (const auto* string = std::get_if<std::string>(&value)) {
+            if (auto index = find(*string)) {
+                out_.push_back(kStringRef);
+                ValueCodec::writeVarint(out_, *index);
+            } else {
+                out_.push_back(kString);
+                literal(*string);
+            }
+        } else if (const auto* array = std::get_if<AnyArray>(&value)) {
+            out_.push_back(kArray);
+            ValueCodec::writeVarint(out_, array->size());
+            for (const auto& item : *array) {
+                this->value(item);
+            }
+        } else {
+            object(std::get<AnyObject>(value));
+        }
+    }
+
+    void object(const AnyObject& object) {
+        out_.push_back(kObject);
+        ValueCodec::writeVarint(out_, object.size());
+        for (const auto& [key, value] : object) {
+            // Keys carry their kind in the low bit: literal length or reference
+            if (auto index = find(key)) {
+                ValueCodec::writeVarint(out_, (*index << 1) | 1);
+            } else {
+                ValueCodec::writeVarint(out_, uint64_t{key.size()} << 1);
+                out_.insert(out_.end(), key.begin(), key.end());
+                remember(key);
+            }
+            this->value(value);
+        }
+    }
+
+private:
+    std::optional<uint64_t> find(std::string_view string) const {
+        if (!internable(string.size())) return std::nullopt;
+        auto it = strings_.find(string);
+        if (it == strings_.end()) return std::nullopt;
+        return it->second;
+    }
+
+    void literal(std::string_view string) {
+        ValueCodec::writeVarint(out_, string.size());
+        out_.insert(out_.end(), string.begin(), string.end());
+        remember(string);
+    }
+
+    void remember(std::string_view string) {
+        if (internable(string.size())) {
+            strings_.emplace(string, strings_.size());
+        }
+    }
+
+    ValueCodec::Bytes& out_;
+    // Views into the value being encoded, which outlives the writer
+    std::unordered_map<std::string_view, uint64_t> strings_;
+};
+
+/**
+ * Decodes one value. Strings are read as views into the input and only
+ * copied when they end up in the result.
+ */
+class Reader {
+public:
+    Reader(const uint8_t* data, size_t size) : data_(data), size_(size) {}
+
+    bool atEnd() const { return offset_ == size_; }
+
+    uint8_t byte() {
+        if (offset_ >= size_) corrupt();
+        return data_[offset_++];
+    }
+
+    uint64_t varint() { return ValueCodec::readVarint(data_, size_, offset_); }
+
+    // A count of items that each take at least one byte
+    size_t count() {
+        uint64_t count = varint();
+        if (count > size_ - offset_) corrupt();
+        return static_cast<size_t>(count);
+    }
+
+    /**
+     * Consume the prefix every encoding starts with
+     */
+    void start() {
+        if (byte() != kInterned) corrupt();
+    }
+
+    std::string_view bytes(size_t length) {
+        std::string_view view(reinterpret_cast<const char*>(data_ + offset_), length);
+        offset_ += length;
+        if (internable(length)) {
+            strings_.push_back(view);
+        }
+        return view;
+    }
+
+    std::string_view string() { return bytes(count()); }
+
+    std::string_view reference() {
+        uint64_t index = varint();
+        if (index >= strings_.size()) corrupt();
+        return strings_[static_cast<size_t>(index)];
+    }
+
+    std::string_view key() {
+        uint64_t header = varint();
+        if (header & 1) {
+            uint64_t index = header >> 1;
+            if (index >= strings_.size()) corrupt();
+            return strings_[static_cast<size_t>(index)];
+        }
+        uint64_t length = header >> 1;
+        if (length > size_ - offset_) corrupt();
+        return bytes(static_cast<size_t>(length));
+    }
+
+    double float64() {
+        if (size_ - offset_ < sizeof(double)) corrupt();
+        double value;
+        std::memcpy(&value, data_ + offset_, sizeof(double));
+        offset_ += sizeof(double);
+        return value;
+    }
+
+    AnyObject object(unsigned depth) {
+        size_t count = this->count();
+        AnyObject object;
+        object.reserve(count);
+        for (size_t i = 0; i < count; ++i) {
+            std::string key(this->key());
+            object.insert_or_assign(std::move(key), value(depth + 1));
+        }
+        return object;
+    }
+
+    AnyValue value(unsigned depth) {
+        if (depth > kMaxDepth) corrupt();
+        switch (byte()) {
+            case kNull: return NullType();
+            case kFalse: return false;
+            case kTrue: return true;
+            case kDouble: return float64();
+            case kBigInt: return unzigzag(varint());
+            case kString: return std::string(string());
+            case kStringRef: return std::string(reference());
+            case kArray: {
+                size_t count = this->count();
+                AnyArray array;
+                array.reserve(count);
+                for (size_t i = 0; i < count; ++i) {
+                    array.push_back(value(depth + 1));
+                }
+                return array;
+            }
+            case kObject: return object(depth);
+            default: corrupt();
+        }
+    }
+
+    /**
+     * Step over a value without building it. Its strings are still
+     * numbered, since later references may point at them.
+     */
+    void skip(unsigned depth) {
+        if (depth > kMaxDepth) corrupt();
+        switch (byte()) {
+            case kNull:
+            case kFalse:
+            case kTrue: return;
+            case kDouble: float64(); return;
+            case kBigInt: varint(); return;
+            case kString: string(); return;
+            case kStringRef: reference(); return;
+            case kArray: {
+                size_t count = this->count();
+                for (size_t i = 0; i < count; ++i) skip(depth + 1);
+                return;
+            }
+            case kObject: {
+                size_t count = this->count();
+                for (size_t i = 0; i < count; ++i) {
+                    key();
+                    skip(depth + 1);
+                }
+                return;
+            }
+            default: corrupt();
+        }
+    }
+
+    /**
+     * Decode only the value at `path[depth..]` below the current position
+     */
+    std::optional<AnyValue> find(const std::vector<std::string>& path, size_t depth) {
+        if (depth == path.size()) return value(depth);
+        if (depth > kMaxDepth) corrupt();
+
+        switch (byte()) {
+            case kObject: {
+                size_t count = this->count();
+                for (size_t i = 0; i < count; ++i) {
+                    if (key() == path[depth]) return find(path, depth + 1);
+                    skip(depth + 1);
+                }
+                return std::nullopt;
+            }
+            case kArray: {
+                size_t count = this->count();
+                auto index = PersistentMap::arrayIndex(path[depth]);
+                if (!index || *index >= count) return std::nullopt;
+                for (size_t i = 0; i < *index; ++i) skip(depth + 1);
+                return find(path, depth + 1);
+            }
+            default:
+                return std::nullopt;
+        }
+    }
+
+private:
+    const uint8_t* data_;
+    size_t size_;
+    size_t offset_ = 0;
+    std::vector<std::string_view> strings_;
+};
+
+} // namespace
+
+void ValueCodec::writeVarint(Bytes& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+uint64_t ValueCodec::readVarint(const uint8_t* data, size_t size, size_t& offset) {
+    uint64_t value = 0;
+    for (unsigned shift = 0; shift < 64; shift += 7) {
+        if (offset >= size) corrupt();
+        uint8_t byte = data[offset++];
+        value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+        if ((byte & 0x80) == 0) return value;
+    }
+    corrupt();
+}
+
+void ValueCodec::encode(const AnyValue& value, Bytes& out) {
+    out.push_back(kInterned);
+    Writer(out).value(value);
+}
+
+void ValueCodec::encode(const AnyMap& map, Bytes& out) {
+    out.push_back(kInterned);
+    Writer(out).object(map.getMap());
+}
+
+AnyValue ValueCodec::decode(const uint8_t* data, size_t size) {
+    Reader reader(data, size);
+    reader.start();
+    auto value = reader.value(0);
+    if (!reader.atEnd()) corrupt();
+    return value;
+}
+
+std::shared_ptr<AnyMap> ValueCodec::decodeMap(const uint8_t* data, size_t size) {
+    Reader reader(data, size);
+    reader.start();
+    if (reader.byte() != kObject) corrupt();
+    auto map = AnyMap::make();
+    map->getMap() = reader.object(0);
+    if (!reader.atEnd()) corrupt();
+    return map;
+}
+
+std::optional<AnyValue> ValueCodec::decodeIn(const uint8_t* data, size_t size, const std::vector<std::string>& path) {
+    Reader reader(data, size);
+    reader.start();
+    return reader.find(path, 0);
+}
+
+} // namespace margelo::nitro::nitrostate
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <NitroModules/AnyMap.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace margelo::nitro::nitrostate {
+
+using namespace margelo::nitro;
+
+/**
+ * ValueCodec - Native binary encoding of AnyMap / AnyValue trees
+ *
+ * Each value is a one-byte tag followed by its payload. Integers, lengths
+ * and counts are LEB128 varints; doubles are 8 little-endian bytes.
+ * Decoding validates every length against the input and throws
+ * std::runtime_error on malformed data.
+ *
+ * Strings are interned: every object key and string value of 2 to 64
+ * bytes is numbered in order of first appearance, and repeats are written
+ * as that number. Every encoding starts with a prefix byte saying so.
+ */
+class ValueCodec {
+public:
+    using Bytes = std::vector<uint8_t>;
+
+    /**
+     * Append the encoding of `value` to `out`
+     */
+    static void encode(const AnyValue& value, Bytes& out);
+
+    /**
+     * Append the encoding of `map`, as an object, to `out`
+     */
+    static void encode(const AnyMap& map, Bytes& out);
+
+    /**
+     * Decode one value that spans exactly `size` bytes
+     */
+    static AnyValue decode(const uint8_t* data, size_t size);
+
+    /**
+     * Decode an encoded object into a new AnyMap
+     */
+    static std::shared_ptr<AnyMap> decodeMap(const uint8_t* data, size_t size);
+
+    /**
+     * Decode only the value at `path` inside an encoded value. Everything
+     * before it is stepped over without being built.
+     * @return std::nullopt if there is no value at `path`
+     */
+    static std::optional<AnyValue> decodeIn(const uint8_t* data, size_t size, const std::vector<std::string>& path);
+
+    static void writeVarint(Bytes& out, uint64_t value);
+
+    /**
+     * Read a varint at `offset` and advance past it
+     */
+    static uint64_t readVarint(const uint8_t* data, size_t size, size_t& offset);
+};
+
+} // namespace margelo::nitro::nitrostate
@@ -0,0 +1,156 @@
+#include "ValueEquality.hpp"
+#include <cmath>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <variant>
+
+namespace margelo::nitro::nitrostate {
+
+namespace {
+
+uint64_t mix(uint64_t x) {
+    // splitmix64 finalizer
+    x ^= x >> 30;
+    x *= 0xbf58476d1ce4e5b9ULL;
+    x ^= x >> 27;
+    x *= 0x94d049bb133111ebULL;
+    x ^= x >> 31;
+    return x;
+}
+
+uint64_t combine(uint64_t seed, uint64_t value) {
+    return mix(seed ^ (value + 0x9e3779b97f4a7c15ULL + (seed << 6) + (seed >> 2)));
+}
+
+bool sameDouble(double a, double b) {
+    // Object.is: NaN equals itself, and +0 and -0 differ, so writing -0
+    // over 0 is not dropped as a no-op
+    return (a == b && std::signbit(a) == std::signbit(b)) || (std::isnan(a) && std::isnan(b));
+}
+
+} // namespace
+
+bool ValueEquality::equals(
+    EqualityMode mode,
+    const std::shared_ptr<AnyMap>& a,
+    const std::shared_ptr<AnyMap>& b
+) {
+    if (a == b) return true;
+    if (!a || !b) return false;
+
+    switch (mode) {
+        case EqualityMode::SHALLOW:
+            return shallowEqual(*a, *b);
+        case EqualityMode::DEEP:
+            return deepEqual(*a, *b);
+        default:
+            return false;
+    }
+}
+
+bool ValueEquality::primitiveEqual(const AnyValue& a, const AnyValue& b) {
+    if (a.index() != b.index()) return false;
+
+    if (const auto* lhs = std::get_if<double>(&a)) return sameDouble(*lhs, std::get<double>(b));
+    if (const auto* lhs = std::get_if<bool>(&a)) return *lhs == std::get<bool>(b);
+    if (const auto* lhs = std::get_if<int64_t>(&a)) return *lhs == std::get<int64_t>(b);
+    if (const auto* lhs = std::get_if<std::string>(&a)) return *lhs == std::get<std::string>(b);
+    if (std::holds_alternative<AnyArray>(a) || std::holds_alternative<AnyObject>(a)) return false;
+    // null
+    return true;
+}
+
+bool ValueEquality::shallowEqual(const AnyMap& a, const AnyMap& b) {
+    const auto& lhs = a.getMap();
+    const auto& rhs = b.getMap();
+    if (lhs.size() != rhs.size()) return false;
+
+    for (const auto& [key, value] : lhs) {
+        auto it = rhs.find(key);
+        if (it == rhs.end() || !primitiveEqual(value, it->second)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ValueEquality::deepEqual(const AnyMap& a, const AnyMap& b) {
+    const auto& lhs = a.getMap();
+    const auto& rhs = b.getMap();
+    if (lhs.size() != rhs.size()) return false;
+
+    for (const auto& [key, value] : lhs) {
+        auto it = rhs.find(key);
+        if (it == rhs.end() || !deepEqual(value, it->second)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool ValueEquality::deepEqual(const AnyValue& a, const AnyValue& b) {
+    if (a.index() != b.index()) return false;
+
+    if (const auto* lhs = std::get_if<AnyArray>(&a)) {
+        const auto& rhs = std::get<AnyArray>(b);
+        if (lhs->size() != rhs.size()) return false;
+        for (size_t i = 0; i < lhs->size(); ++i) {
+            if (!deepEqual((*lhs)[i], rhs[i])) return false;
+        }
+        return true;
+    }
+
+    if (const auto* lhs = std::get_if<AnyObject>(&a)) {
+        const auto& rhs = std::get<AnyObject>(b);
+        if (lhs->size() != rhs.size()) return false;
+        for (const auto& [key, value] : *lhs) {
+            auto it = rhs.find(key);
+            if (it == rhs.end() || !deepEqual(value, it->second)) return false;
+        }
+        return true;
+    }
+
+    return primitiveEqual(a, b);
+}
+
+uint64_t ValueEquality::fingerprint(const AnyMap& map) {
+    return fingerprint(map.getMap());
+}
+
+uint64_t ValueEquality::fingerprint(const AnyObject& object) {
+    // Entries are combined with a commutative sum so that hash map
+    // iteration order does not matter
+    uint64_t sum = 0;
+    for (const auto& [key, value] : object) {
+        sum += combine(std::hash<std::string>{}(key), fingerprint(value));
+    }
+    return combine(0x6f626a6563740000ULL ^ object.size(), sum);
+}
+
+uint64_t ValueEquality::fingerprint(const AnyValue& value) {
+    uint64_t tag = static_cast<uint64_t>(value.index()) + 1;
+
+    if (const auto* v = std::get_if<double>(&value)) {
+        if (std::isnan(*v)) return combine(tag, 0x7ff8000000000000ULL);
+        // -0 keeps its sign bit and hashes apart from +0, as sameDouble()
+        uint64_t bits;
+        std::memcpy(&bits, v, sizeof(bits));
+        return combine(tag, bits);
+    }
+    if (const auto* v = std::get_if<bool>(&value)) return combine(tag, *v ? 1 : 0);
+    if (const auto* v = std::get_if<int64_t>(&value)) return combine(tag, static_cast<uint64_t>(*v));
+    if (const auto* v = std::get_if<std::string>(&value)) return combine(tag, std::hash<std::string>{}(*v));
+    if (const auto* v = std::get_if<AnyArray>(&value)) {
+        uint64_t hash = combine(tag, v->size());
+        for (const auto& element : *v) {
+            hash = combine(hash, fingerprint(element));
+        }
+        return hash;
+    }
+    if (const auto* v = std::get_if<AnyObject>(&value)) return fingerprint(*v);
+    // null
+    return tag;
+}
+
+} // namespace margelo::nitro::nitrostate
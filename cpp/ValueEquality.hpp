@@ -0,0 +1,51 @@
+#pragma once
+
+#include <NitroModules/AnyMap.hpp>
+#include <cstdint>
+#include <memory>
+#include "EqualityMode.hpp"
+
+namespace margelo::nitro::nitrostate {
+
+using namespace margelo::nitro;
+
+/**
+ * ValueEquality - Native comparison of AnyMap / AnyValue trees
+ *
+ * Used to suppress no-op writes without pulling values back into JS.
+ * Every walk exits on the first difference.
+ */
+class ValueEquality {
+public:
+    /**
+     * Compare two values under the given policy.
+     * HASH is not handled here since it compares cached fingerprints.
+     */
+    static bool equals(EqualityMode mode, const std::shared_ptr<AnyMap>& a, const std::shared_ptr<AnyMap>& b);
+
+    /**
+     * Same keys and equal primitive values at the top level. Nested arrays
+     * and objects are copied on every trip across JSI, so there is no
+     * reference to compare and they always count as changed.
+     */
+    static bool shallowEqual(const AnyMap& a, const AnyMap& b);
+
+    /**
+     * Full structural comparison
+     */
+    static bool deepEqual(const AnyMap& a, const AnyMap& b);
+    static bool deepEqual(const AnyValue& a, const AnyValue& b);
+
+    /**
+     * Order-independent 64-bit structural hash. Equal values always hash
+     * equal; different values collide with negligible probability.
+     */
+    static uint64_t fingerprint(const AnyMap& map);
+    static uint64_t fingerprint(const AnyValue& value);
+
+private:
+    static bool primitiveEqual(const AnyValue& a, const AnyValue& b);
+    static uint64_t fingerprint(const AnyObject& object);
+};
+
+} // namespace margelo::nitro::nitrostate
@@ -0,0 +1,363 @@
+#include "WriteAheadLog.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utility>
+
+namespace margelo::nitro::nitrostate {
+
+namespace {
+
+constexpr char kMagic[4] = {'N', 'S', 'W', 'L'};
+constexpr uint32_t kFormatVersion = 1;
+constexpr size_t kHeaderSize = sizeof(kMagic) + sizeof(uint32_t);
+// Payload size and checksum in front of every record
+constexpr size_t kRecordHeaderSize = 2 * sizeof(uint32_t);
+
+enum Kind : uint8_t {
+    kPut = 0,
+    kRemove = 1,
+};
+
+// A record located in a log buffer
+struct RawRecord {
+    size_t offset;
+    size_t size;
+    uint64_t commit;
+    uint8_t kind;
+    size_t keyOffset;
+    size_t keySize;
+    size_t valueOffset;
+    size_t valueSize;
+};
+
+void writeU32(uint8_t* out, uint32_t value) {
+    std::memcpy(out, &value, sizeof(value));
+}
+
+uint32_t readU32(const uint8_t* data) {
+    uint32_t value;
+    std::memcpy(&value, data, sizeof(value));
+    return value;
+}
+
+uint32_t checksum(const uint8_t* data, size_t size) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < size; ++i) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+[[noreturn]] void fail(const std::string& message, const std::string& path) {
+    throw std::runtime_error(message + " '" + path + "': " + std::strerror(errno));
+}
+
+ValueCodec::Bytes header() {
+    ValueCodec::Bytes bytes(kHeaderSize);
+    std::memcpy(bytes.data(), kMagic, sizeof(kMagic));
+    writeU32(bytes.data() + sizeof(kMagic), kFormatVersion);
+    return bytes;
+}
+
+/**
+ * Whole file at `path`; empty if there is none
+ */
+ValueCodec::Bytes readFile(const std::string& path) {
+    ValueCodec::Bytes bytes;
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (errno == ENOENT) return bytes;
+        fail("Cannot open log", path);
+    }
+
+    struct stat info {};
+    if (::fstat(fd, &info) != 0) {
+        ::close(fd);
+        fail("Cannot stat log", path);
+    }
+    bytes.resize(static_cast<size_t>(info.st_size));
+
+    size_t offset = 0;
+    while (offset < bytes.size()) {
+        ssize_t result = ::read(fd, bytes.data() + offset, bytes.size() - offset);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            ::close(fd);
+            fail("Cannot read log", path);
+        }
+        if (result == 0) break;
+        offset += static_cast<size_t>(result);
+    }
+    ::close(fd);
+    bytes.resize(offset);
+    return bytes;
+}
+
+void writeAll(int fd, const uint8_t* data, size_t size, const std::string& path) {
+    size_t written = 0;
+    while (written < size) {
+        ssize_t result = ::write(fd, data + written, size - written);
+        if (result < 0) {
+            if (errno == EINTR) continue;
+            fail("Cannot write log", path);
+        }
+        written += static_cast<size_t>(result);
+    }
+}
+
+/**
+ * Locate the intact records of a log. Stops at the first torn or corrupt
+ * record, which can only be the tail a crash left behind.
+ * @param end Receives the offset just past the last intact record
+ */
+std::vector<RawRecord> scan(const uint8_t* data, size_t size, const std::string& path, size_t& end) {
+    std::vector<RawRecord> records;
+    end = 0;
+    // Empty, or cut short while the header was written
+    if (size < kHeaderSize) return records;
+    if (std::memcmp(data, kMagic, sizeof(kMagic)) != 0 ||
+        readU32(data + sizeof(kMagic)) != kFormatVersion) {
+        throw std::runtime_error("Log '" + path + "' has an unknown format");
+    }
+
+    size_t offset = kHeaderSize;
+    while (size - offset >= kRecordHeaderSize) {
+        uint32_t payloadSize = readU32(data + offset);
+        const uint8_t* payload = data + offset + kRecordHeaderSize;
+        if (payloadSize > size - offset - kRecordHeaderSize ||
+            checksum(payload, payloadSize) != readU32(data + offset + sizeof(uint32_t))) {
+            break;
+        }
+
+        // A valid checksum over a malformed payload means a bug, not a crash
+        size_t cursor = 0;
+        RawRecord record{};
+        try {
+            record.commit = ValueCodec::readVarint(payload, payloadSize, cursor);
+            if (cursor >= payloadSize) throw std::runtime_error("Record out of bounds");
+            record.kind = payload[cursor++];
+            uint64_t keySize = ValueCodec::readVarint(payload, payloadSize, cursor);
+            if (keySize > payloadSize - cursor) throw std::runtime_error("Record out of bounds");
+            record.keySize = static_cast<size_t>(keySize);
+        } catch (const std::runtime_error&) {
+            throw std::runtime_error("Log '" + path + "' is corrupt");
+        }
+        size_t base = offset + kRecordHeaderSize;
+        record.offset = offset;
+        record.size = kRecordHeaderSize + payloadSize;
+        record.keyOffset = base + cursor;
+        record.valueOffset = record.keyOffset + record.keySize;
+        record.valueSize = payloadSize - cursor - record.keySize;
+        records.push_back(record);
+        offset += record.size;
+    }
+    end = offset;
+    return records;
+}
+
+} // namespace
+
+WriteAheadLog::WriteAheadLog(std::string path, size_t storeSize, Compactor compactor)
+    : path_(std::move(path)), compactor_(std::move(compactor)), storeSize_(storeSize) {
+    auto bytes = readFile(path_);
+    size_t end = 0;
+    scan(bytes.data(), bytes.size(), path_, end);
+
+    fd_ = ::open(path_.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd_ < 0) fail("Cannot open log", path_);
+    if (end == 0) {
+        // New log; also replaces a file cut short before its header
+        auto start = header();
+        if (::ftruncate(fd_, 0) != 0) fail("Cannot truncate log", path_);
+        writeAll(fd_, start.data(), start.size(), path_);
+        end = start.size();
+    } else if (end < bytes.size() && ::ftruncate(fd_, static_cast<off_t>(end)) != 0) {
+        fail("Cannot truncate log", path_);
+    }
+    logSize_ = end;
+
+    thread_ = std::thread(&WriteAheadLog::run, this);
+}
+
+WriteAheadLog::~WriteAheadLog() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    wakeup_.notify_all();
+    thread_.join();
+    ::close(fd_);
+}
+
+std::vector<WriteAheadLog::Record> WriteAheadLog::read(const std::string& path) {
+    auto bytes = std::make_shared<const ValueCodec::Bytes>(readFile(path));
+    size_t end = 0;
+    auto raw = scan(bytes->data(), bytes->size(), path, end);
+
+    std::vector<Record> records;
+    records.reserve(raw.size());
+    for (const auto& record : raw) {
+        Record entry;
+        entry.key.assign(reinterpret_cast<const char*>(bytes->data() + record.keyOffset), record.keySize);
+        entry.commit = record.commit;
+        if (record.kind == kPut) {
+            // Values stay encoded in the log buffer until first read
+            entry.value = StoredValue{bytes, bytes->data() + record.valueOffset, record.valueSize};
+        } else if (record.kind != kRemove) {
+            throw std::runtime_error("Log '" + path + "' is corrupt");
+        }
+        records.push_back(std::move(entry));
+    }
+    return records;
+}
+
+void WriteAheadLog::put(const std::string& key, uint64_t commit, std::shared_ptr<AnyMap> value) {
+    enqueue(key, commit, std::move(value));
+}
+
+void WriteAheadLog::remove(const std::string& key, uint64_t commit) {
+    enqueue(key, commit, nullptr);
+}
+
+void WriteAheadLog::enqueue(const std::string& key, uint64_t commit, std::shared_ptr<AnyMap> value) {
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        enqueued_++;
+        auto [it, inserted] = pendingIndex_.try_emplace(key, pending_.size());
+        if (inserted) {
+            pending_.push_back({key, commit, std::move(value)});
+        } else if (pending_[it->second].commit <= commit) {
+            // Only the newest write of a group needs to reach the disk
+            pending_[it->second].commit = commit;
+            pending_[it->second].value = std::move(value);
+        }
+        wake = pending_.size() == 1;
+    }
+    if (wake) wakeup_.notify_one();
+}
+
+void WriteAheadLog::sync() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    uint64_t target = enqueued_;
+    waiting_++;
+    wakeup_.notify_one();
+    synced_.wait(lock, [&] { return durable_ >= target || error_ != nullptr; });
+    waiting_--;
+    if (error_) {
+        std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+}
+
+void WriteAheadLog::compact() {
+    sync();
+    std::lock_guard<std::mutex> fileLock(fileMutex_);
+    compactLocked();
+}
+
+void WriteAheadLog::run() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        wakeup_.wait(lock, [&] { return stopping_ || !pending_.empty(); });
+        if (!stopping_ && waiting_ == 0) {
+            // Let a burst of writes land before paying for the fsync
+            wakeup_.wait_for(lock, kGroupWindow, [&] { return stopping_ || waiting_ > 0; });
+        }
+
+        std::vector<Pending> group;
+        std::swap(group, pending_);
+        pendingIndex_.clear();
+        uint64_t sequence = enqueued_;
+        bool stopping = stopping_;
+        lock.unlock();
+
+        std::exception_ptr error;
+        try {
+            std::lock_guard<std::mutex> fileLock(fileMutex_);
+            append(group);
+            if (!stopping && logSize_ > std::max(kMinCompactSize, storeSize_)) {
+                compactLocked();
+            }
+        } catch (...) {
+            error = std::current_exception();
+        }
+        // Values are released outside the lock
+        group.clear();
+
+        lock.lock();
+        durable_ = sequence;
+        if (error && !error_) error_ = error;
+        synced_.notify_all();
+        if (stopping && pending_.empty()) return;
+    }
+}
+
+void WriteAheadLog::append(const std::vector<Pending>& records) {
+    if (records.empty()) return;
+
+    buffer_.clear();
+    ValueCodec::Bytes payload;
+    for (const auto& record : records) {
+        payload.clear();
+        ValueCodec::writeVarint(payload, record.commit);
+        payload.push_back(record.value ? kPut : kRemove);
+        ValueCodec::writeVarint(payload, record.key.size());
+        payload.insert(payload.end(), record.key.begin(), record.key.end());
+        if (record.value) {
+            ValueCodec::encode(*record.value, payload);
+        }
+
+        uint8_t prefix[kRecordHeaderSize];
+        writeU32(prefix, static_cast<uint32_t>(payload.size()));
+        writeU32(prefix + sizeof(uint32_t), checksum(payload.data(), payload.size()));
+        buffer_.insert(buffer_.end(), prefix, prefix + kRecordHeaderSize);
+        buffer_.insert(buffer_.end(), payload.begin(), payload.end());
+    }
+
+    writeAll(fd_, buffer_.data(), buffer_.size(), path_);
+    if (::fsync(fd_) != 0) fail("Cannot sync log", path_);
+    logSize_ += buffer_.size();
+}
+
+void WriteAheadLog::compactLocked() {
+    auto compaction = compactor_();
+    storeSize_ = compaction.size;
+
+    // Keep only the records the store file does not cover yet: writes
+    // that committed while it was being written
+    auto bytes = readFile(path_);
+    size_t end = 0;
+    auto records = scan(bytes.data(), bytes.size(), path_, end);
+    auto kept = header();
+    for (const auto& record : records) {
+        if (record.commit > compaction.commit) {
+            kept.insert(kept.end(), bytes.begin() + record.offset, bytes.begin() + record.offset + record.size);
+        }
+    }
+
+    std::string temporary = path_ + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) fail("Cannot create log", temporary);
+    try {
+        writeAll(fd, kept.data(), kept.size(), temporary);
+        if (::fsync(fd) != 0) fail("Cannot sync log", temporary);
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+    if (::rename(temporary.c_str(), path_.c_str()) != 0) {
+        ::close(fd);
+        fail("Cannot replace log", path_);
+    }
+
+    ::close(fd_);
+    fd_ = fd;
+    logSize_ = kept.size();
+}
+
+} // namespace margelo::nitro::nitrostate
@@ -0,0 +1,152 @@
+#pragma once
+
+#include <NitroModules/AnyMap.hpp>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "AtomStore.hpp"
+#include "ValueCodec.hpp"
+
+namespace margelo::nitro::nitrostate {
+
+using namespace margelo::nitro;
+
+/**
+ * WriteAheadLog - Append-only log of writes to persisted atoms
+ *
+ * Layout: "NSWL" and format version (u32 little-endian each), then per
+ * record its payload size and FNV-1a checksum (u32 each) and the payload:
+ * a varint commit, a kind byte, a varint key length, the key and, for
+ * puts, the ValueCodec encoding of the value.
+ *
+ * Writers only queue records. A background thread encodes them, appends
+ * them in groups with one fsync per group and compacts the log into the
+ * store file once it outgrows it. Several queued writes to the same key
+ * are coalesced into the newest one.
+ *
+ * Every record carries the commit it was written at. Recovery applies a
+ * record on top of the store only if it is newer than the store's commit
+ * and than any other record for its key, so replay is correct however
+ * records were ordered in the file.
+ */
+class WriteAheadLog {
+public:
+    struct Record {
+        std::string key;
+        uint64_t commit = 0;
+        // Empty for deletions
+        std::optional<StoredValue> value;
+    };
+
+    struct Compaction {
+        // Commit the store file was written at
+        uint64_t commit = 0;
+        // Size of the store file in bytes
+        size_t size = 0;
+    };
+
+    /**
+     * Writes the store file; called on the log thread or from compact()
+     */
+    using Compactor = std::function<Compaction()>;
+
+    /**
+     * Open the log at `path` for appending, creating it if needed. A torn
+     * record at the end, left by a crash mid-append, is cut off.
+     * @param storeSize Size of the current store file, to pace compaction
+     */
+    WriteAheadLog(std::string path, size_t storeSize, Compactor compactor);
+
+    /**
+     * Write and sync everything still queued, then stop the log thread
+     */
+    ~WriteAheadLog();
+
+    // Non-copyable
+    WriteAheadLog(const WriteAheadLog&) = delete;
+    WriteAheadLog& operator=(const WriteAheadLog&) = delete;
+
+    /**
+     * Every intact record in the log at `path`, in file order
+     */
+    static std::vector<Record> read(const std::string& path);
+
+    /**
+     * Queue the value of `key` as of `commit`
+     */
+    void put(const std::string& key, uint64_t commit, std::shared_ptr<AnyMap> value);
+
+    /**
+     * Queue the deletion of `key` at `commit`
+     */
+    void remove(const std::string& key, uint64_t commit);
+
+    /**
+     * Write the store file now and drop the records it covers
+     */
+    void compact();
+
+    /**
+     * Block until every record queued so far is on disk
+     */
+    void sync();
+
+private:
+    struct Pending {
+        std::string key;
+        uint64_t commit;
+        std::shared_ptr<AnyMap> value;
+    };
+
+    void enqueue(const std::string& key, uint64_t commit, std::shared_ptr<AnyMap> value);
+    void run();
+
+    // Must be called with fileMutex_ held
+    void append(const std::vector<Pending>& records);
+    void compactLocked();
+
+    // Delay before a group is written, so bursts share one fsync
+    static constexpr std::chrono::milliseconds kGroupWindow{5};
+    // The log is compacted once it is larger than this and the store file
+    static constexpr size_t kMinCompactSize = size_t{1} << 20;
+
+    std::string path_;
+    Compactor compactor_;
+
+    // Guards the queue, the sequence numbers and the error
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    std::condition_variable synced_;
+    std::vector<Pending> pending_;
+    std::unordered_map<std::string, size_t> pendingIndex_;
+    // Records queued so far and records on disk, as sequence numbers
+    uint64_t enqueued_ = 0;
+    uint64_t durable_ = 0;
+    // sync() callers waiting; they skip the group window
+    size_t waiting_ = 0;
+    // First failure of the log thread, reported by sync()
+    std::exception_ptr error_;
+    bool stopping_ = false;
+
+    // Guards the file; held while appending, syncing and compacting
+    std::mutex fileMutex_;
+    int fd_ = -1;
+    size_t logSize_ = 0;
+    size_t storeSize_ = 0;
+    ValueCodec::Bytes buffer_;
+
+    // Declared last so it starts after everything it uses
+    std::thread thread_;
+};
+
+} // namespace margelo::nitro::nitrostate
@@ -1,5 +1,6 @@
 import type { AnyMap } from 'react-native-nitro-modules';
 import { getNitroState } from './instance';
+import { retainAtom, retainComputed } from './lifetime';
 import type {
   Atom,
   ReadonlyAtom,
@@ -52,56 +53,117 @@ export function atom<T extends AnyMap>(
   if (typeof initialValueOrRead === 'function') {
     const readFn = initialValueOrRead as (get: Getter) => T;
 
-    // Track dependencies during first read
-    const dependencies: string[] = [];
-
-    const getter: Getter = <U extends AnyMap>(
-      depAtom: Atom<U> | ReadonlyAtom<U>
-    ): U => {
-      if (!dependencies.includes(depAtom.key)) {
-        dependencies.push(depAtom.key);
-      }
-      return nitroState.getAtomValue(depAtom.key) as U;
+    // No dependencies up front: each run reports what it reads, and the
+    // native side keeps the set up to date as branches change. Works for
+    // both primitive and computed dependencies
+    const compute = (run: number) => {
+      const getter: Getter = (depAtom) => {
+        nitroState.trackRead(key, run, depAtom.key);
+        return depAtom.get();
+      };
+      return readFn(getter);
     };
 
-    // Initial computation to discover dependencies
-    const compute = () => readFn(getter);
-
-    // Create computed in C++
-    nitroState.createComputed(key, dependencies, compute);
+    if (options?.placeholder !== undefined) {
+      nitroState.createAsyncComputed(key, [], compute, options.placeholder);
+    } else {
+      nitroState.createComputed(key, [], compute);
+    }
 
     const readonlyAtom: ReadonlyAtom<T> = {
       key,
       get: () => nitroState.getComputedValue(key) as T,
+      subscribe: (callback: () => void) =>
+        nitroState.subscribeComputed(key, callback),
       __atom: true as const,
       __readonly: true as const,
     };
+    retainComputed(readonlyAtom, key);
 
     return readonlyAtom;
   }
 
-  // Primitive atom
-  nitroState.createAtom(key, initialValueOrRead);
+  // Primitive atom - hot paths address it by handle instead of key
+  let handle: number;
+  if (options?.persist) {
+    if (options.debugLabel === undefined) {
+      throw new Error('Persisted atoms need a debugLabel to be stored under');
+    }
+    // Already loaded by openStore(): keep the stored value
+    handle = nitroState.hasAtom(key)
+      ? nitroState.getAtomHandle(key)
+      : nitroState.createAtomHandle(key, initialValueOrRead);
+    nitroState.persistAtom(key);
+  } else {
+    handle = nitroState.createAtomHandle(key, initialValueOrRead);
+  }
+  if (options?.equality !== undefined && options.equality !== 'identity') {
+    nitroState.setAtomEquality(key, options.equality);
+  }
+
+  const result = primitiveAtom<T>(key, handle);
+  // Fresh and persisted atoms are never reclaimed before this point
+  retainAtom(result, handle);
+  return result;
+}
+
+/**
+ * Wrap an existing native atom. Hot paths address it by handle.
+ * Callers retain the handle for the returned object (see lifetime.ts).
+ */
+export function primitiveAtom<T extends AnyMap>(
+  key: string,
+  handle: number
+): Atom<T> {
+  const nitroState = getNitroState();
 
   const set: SetterFn<T> = (valueOrUpdater) => {
     if (typeof valueOrUpdater === 'function') {
       const updater = valueOrUpdater as (prev: T) => T;
-      const currentValue = nitroState.getAtomValue(key) as T;
-      const newValue = updater(currentValue);
-      nitroState.setAtomValue(key, newValue);
+      // Retry if another writer (e.g. a native thread) lands in between
+      for (;;) {
+        const version = nitroState.getAtomVersionByHandle(handle);
+        const currentValue = nitroState.getAtomValueByHandle(handle) as T;
+        const newValue = updater(currentValue);
+        if (nitroState.compareAndSetByHandle(handle, version, newValue)) {
+          return;
+        }
+      }
     } else {
-      nitroState.setAtomValue(key, valueOrUpdater);
+      nitroState.setAtomValueByHandle(handle, valueOrUpdater);
     }
   };
 
-  const primitiveAtom: Atom<T> = {
+  return {
     key,
-    get: () => nitroState.getAtomValue(key) as T,
+    get: () => nitroState.getAtomValueByHandle(handle) as T,
     set,
     subscribe: (callback: () => void) =>
-      nitroState.subscribeAtom(key, callback),
+      nitroState.subscribeAtomByHandle(handle, callback),
+    getIn: <V>(path: string[]) =>
+      nitroState.getIn(key, path).value as V | undefined,
+    setIn: (path: string[], value: unknown) =>
+      nitroState.setIn(key, path, { value: value as AnyMap[string] }),
+    subscribePath: (path: string[], callback: () => void) =>
+      nitroState.subscribePath(key, path, callback),
+    merge: (partial: Partial<T>) =>
+      nitroState.mergeAtom(key, partial as AnyMap),
+    increment: (path: string[], delta = 1) =>
+      nitroState.increment(key, path, delta),
+    push: (path: string[], ...items: unknown[]) =>
+      nitroState.push(key, path, { value: items as AnyMap[string] }),
+    splice: (
+      path: string[],
+      start: number,
+      deleteCount = Infinity,
+      ...items: unknown[]
+    ) =>
+      nitroState.splice(key, path, start, deleteCount, {
+        value: items as AnyMap[string],
+      }).value as unknown[],
+    version: () => nitroState.getAtomVersionByHandle(handle),
+    compareAndSet: (expectedVersion: number, value: T) =>
+      nitroState.compareAndSetByHandle(handle, expectedVersion, value),
     __atom: true as const,
   };
-
-  return primitiveAtom;
 }
@@ -1,4 +1,6 @@
+import type { AnyMap } from 'react-native-nitro-modules';
 import { getNitroState } from './instance';
+import type { Atom } from '../types';
 
 /**
  * Batch multiple atom updates
@@ -25,3 +27,33 @@ export function batch(callback: () => void): void {
     nitroState.endBatch();
   }
 }
+
+/**
+ * Read many atoms in a single native call
+ *
+ * @example
+ * ```ts
+ * const [user, settings] = getMany([userAtom, settingsAtom]);
+ * ```
+ */
+export function getMany<T extends AnyMap>(atoms: Atom<T>[]): T[] {
+  return getNitroState().getMany(atoms.map((atom) => atom.key)) as T[];
+}
+
+/**
+ * Write many atoms in a single native call
+ *
+ * Subscribers are notified once, after every write, as in `batch`.
+ * Cheaper than setting each atom when hydrating hundreds of atoms at once.
+ *
+ * @example
+ * ```ts
+ * setMany(rows.map((row) => [rowAtom(row.id), row]));
+ * ```
+ */
+export function setMany<T extends AnyMap>(entries: [Atom<T>, T][]): void {
+  getNitroState().setMany(
+    entries.map(([atom]) => atom.key),
+    entries.map(([, value]) => value)
+  );
+}
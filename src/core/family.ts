@@ -0,0 +1,65 @@
+import type { AnyMap } from 'react-native-nitro-modules';
+import { getNitroState } from './instance';
+import { primitiveAtom } from './atom';
+import { retainAtom } from './lifetime';
+import type { Atom } from '../types';
+
+/**
+ * Options for an atom family
+ */
+export interface AtomFamilyOptions {
+  /** Members to keep before idle ones are evicted; 0 for no limit. Defaults to 10000. */
+  maxMembers?: number;
+
+  /** Approximate bytes the members' values may hold; 0 (default) for no limit */
+  maxBytes?: number;
+}
+
+/**
+ * One atom per parameter, created on demand
+ */
+export type AtomFamily<T extends AnyMap> = (param: string | number) => Atom<T>;
+
+/**
+ * Create a family of atoms keyed by a parameter (one per message, row, ...)
+ *
+ * Members are created natively on first use with `defaultValue`. Once the
+ * family exceeds its budget, the least recently used members that nothing
+ * subscribes to are evicted, so memory stays bounded however many
+ * parameters are seen. An evicted member starts over from `defaultValue`;
+ * call the family again instead of holding on to members you do not
+ * subscribe to.
+ *
+ * @example
+ * ```ts
+ * const messageAtom = atomFamily('message', { text: '', read: false });
+ * messageAtom(message.id).set(message);
+ * ```
+ */
+export function atomFamily<T extends AnyMap>(
+  name: string,
+  defaultValue: T,
+  options?: AtomFamilyOptions
+): AtomFamily<T> {
+  const nitroState = getNitroState();
+  nitroState.createFamily(name, defaultValue);
+  if (options?.maxMembers !== undefined || options?.maxBytes !== undefined) {
+    nitroState.setFamilyBudget(
+      name,
+      options.maxMembers ?? 10000,
+      options.maxBytes ?? 0
+    );
+  }
+
+  return (param) => {
+    const key = String(param);
+    // A member may be reclaimed between lookup and retain; look it up again
+    for (;;) {
+      const handle = nitroState.familyGet(name, key);
+      const member = primitiveAtom<T>(`${name}:${key}`, handle);
+      if (retainAtom(member, handle)) {
+        return member;
+      }
+    }
+  };
+}
@@ -1,3 +1,17 @@
 export { atom } from './atom';
-export { batch } from './batch';
+export { atomFamily } from './family';
+export { selector, select } from './selector';
+export type { SelectorExpression, SelectorInput } from './selector';
+export type { AtomFamily, AtomFamilyOptions } from './family';
+export { batch, getMany, setMany } from './batch';
+export { transaction } from './transaction';
+export { acquireSnapshot } from './snapshot';
+export { openStore, saveStore } from './persistence';
+export { exportAtom, importAtom } from './serialization';
+export { collectGarbage, startGarbageCollection } from './lifetime';
+export type { Snapshot } from './snapshot';
+export type { Transaction, TransactionOptions } from './transaction';
+export { startScheduler, stopScheduler, flush } from './scheduler';
+export { createChangeTracker } from './versions';
+export type { ChangeTracker } from './versions';
 export { getNitroState, resetNitroState } from './instance';
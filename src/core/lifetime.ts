@@ -0,0 +1,70 @@
+import { getNitroState } from './instance';
+
+// Releases the native reference once JS drops the object holding it.
+// Runtimes without FinalizationRegistry retain nothing, so their atoms
+// live until deleted, as before.
+const registry =
+  typeof FinalizationRegistry === 'undefined'
+    ? undefined
+    : new FinalizationRegistry<() => void>((release) => release());
+
+/**
+ * Keep the native atom behind `handle` alive while `owner` is reachable
+ * @returns false if the atom was already reclaimed
+ */
+export function retainAtom(owner: object, handle: number): boolean {
+  if (registry === undefined) {
+    return true;
+  }
+  const nitroState = getNitroState();
+  if (!nitroState.retainAtom(handle)) {
+    return false;
+  }
+  registry.register(owner, () => nitroState.releaseAtom(handle));
+  return true;
+}
+
+/**
+ * Keep the native computed `key` alive while `owner` is reachable
+ */
+export function retainComputed(owner: object, key: string): void {
+  if (registry === undefined) {
+    return;
+  }
+  const nitroState = getNitroState();
+  if (nitroState.retainComputed(key)) {
+    registry.register(owner, () => nitroState.releaseComputed(key));
+  }
+}
+
+/**
+ * Reclaim atoms and computeds nothing refers to anymore
+ *
+ * An atom is reclaimed once every atom object for it was garbage collected
+ * by JS and nothing subscribes to it or reads it in a computed. Persisted
+ * atoms are never reclaimed. The sweep is incremental; each call spends
+ * about `sliceMs` and resumes where the last one stopped.
+ *
+ * @returns Number of atoms and computeds reclaimed
+ */
+export function collectGarbage(sliceMs = 2): number {
+  return getNitroState().collectGarbage(sliceMs);
+}
+
+/**
+ * Run `collectGarbage` in small slices on a timer
+ *
+ * @returns A function that stops collecting
+ *
+ * @example
+ * ```ts
+ * const stop = startGarbageCollection();
+ * ```
+ */
+export function startGarbageCollection(
+  intervalMs = 1000,
+  sliceMs = 2
+): () => void {
+  const timer = setInterval(() => collectGarbage(sliceMs), intervalMs);
+  return () => clearInterval(timer);
+}
@@ -0,0 +1,31 @@
+import { getNitroState } from './instance';
+
+/**
+ * Open the persistent atom store
+ *
+ * Call once at startup, before creating persisted atoms. Stored atoms
+ * are registered immediately but decoded lazily on first read, so
+ * startup cost does not grow with the size of the persisted state.
+ * Writes to persisted atoms are then appended to a write-ahead log next
+ * to the store file and synced in the background; nothing needs to be
+ * saved by hand.
+ *
+ * @param path Absolute path of the store file
+ * @returns Keys of the atoms that were loaded
+ *
+ * @example
+ * ```ts
+ * openStore(`${DocumentDirectoryPath}/state.bin`);
+ * const cartAtom = atom({ items: [] }, { debugLabel: 'cart', persist: true });
+ * ```
+ */
+export function openStore(path: string): string[] {
+  return getNitroState().openStore(path);
+}
+
+/**
+ * Compact the write-ahead log into the store file now
+ */
+export function saveStore(): void {
+  getNitroState().saveStore();
+}
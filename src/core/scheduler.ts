@@ -0,0 +1,58 @@
+import { getNitroState } from './instance';
+
+let frameRequest: number | null = null;
+
+function cancelFrameLoop(): void {
+  if (frameRequest !== null) {
+    cancelAnimationFrame(frameRequest);
+    frameRequest = null;
+  }
+}
+
+/**
+ * Coalesce subscriber notifications
+ *
+ * Writes stop notifying synchronously; each changed atom notifies at most
+ * once per tick instead, and subscribers read its latest value.
+ *
+ * @param interval `'frame'` to flush on every animation frame, or a tick
+ * length in milliseconds driven by a native timer
+ *
+ * @example
+ * ```ts
+ * startScheduler('frame');
+ * // 120 Hz sensor writes now re-render at most once per frame
+ * sensorAtom.set(reading);
+ * ```
+ */
+export function startScheduler(interval: 'frame' | number = 'frame'): void {
+  const nitroState = getNitroState();
+  cancelFrameLoop();
+
+  if (interval !== 'frame') {
+    nitroState.startScheduler(interval);
+    return;
+  }
+
+  nitroState.startScheduler(0);
+  const tick = () => {
+    nitroState.flush();
+    frameRequest = requestAnimationFrame(tick);
+  };
+  frameRequest = requestAnimationFrame(tick);
+}
+
+/**
+ * Deliver pending notifications and go back to synchronous notification
+ */
+export function stopScheduler(): void {
+  cancelFrameLoop();
+  getNitroState().stopScheduler();
+}
+
+/**
+ * Deliver all pending notifications now
+ */
+export function flush(): void {
+  getNitroState().flush();
+}
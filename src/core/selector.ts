@@ -0,0 +1,137 @@
+import type { AnyMap } from 'react-native-nitro-modules';
+import { getNitroState } from './instance';
+import { retainComputed } from './lifetime';
+import type { Atom, ReadonlyAtom } from '../types';
+
+/**
+ * An expression evaluated natively. Build them with `select`.
+ */
+export type SelectorExpression = { op: string } & AnyMap;
+
+/**
+ * An expression, or a string, number, boolean or null used as a constant
+ */
+export type SelectorInput = SelectorExpression | string | number | boolean | null;
+
+type Path = (string | number)[];
+
+function input(value: SelectorInput): SelectorExpression {
+  return value !== null && typeof value === 'object'
+    ? value
+    : { op: 'const', value };
+}
+
+function binary(op: string) {
+  return (a: SelectorInput, b: SelectorInput): SelectorExpression => ({
+    op,
+    args: [input(a), input(b)],
+  });
+}
+
+/**
+ * Expression builders for `selector`
+ *
+ * Missing values read as null. Arithmetic on anything but numbers gives
+ * null (`add` also joins two strings); ordering compares two numbers or
+ * two strings and is false otherwise.
+ */
+export const select = {
+  /** Value at `path` in an atom or computed */
+  get: <T extends AnyMap>(
+    source: Atom<T> | ReadonlyAtom<T>,
+    path: Path = []
+  ): SelectorExpression => ({ op: 'get', source: source.key, path }),
+
+  /** A constant, for objects and arrays */
+  constant: (value: AnyMap[string]): SelectorExpression => ({
+    op: 'const',
+    value,
+  }),
+
+  /** Value at `path` inside the result of `of` */
+  field: (of: SelectorExpression, path: Path): SelectorExpression => ({
+    op: 'field',
+    of,
+    path,
+  }),
+
+  add: binary('add'),
+  sub: binary('sub'),
+  mul: binary('mul'),
+  div: binary('div'),
+  mod: binary('mod'),
+
+  /** Structural equality */
+  eq: binary('eq'),
+  ne: binary('ne'),
+  lt: binary('lt'),
+  le: binary('le'),
+  gt: binary('gt'),
+  ge: binary('ge'),
+
+  and: (...args: SelectorInput[]): SelectorExpression => ({
+    op: 'and',
+    args: args.map(input),
+  }),
+  or: (...args: SelectorInput[]): SelectorExpression => ({
+    op: 'or',
+    args: args.map(input),
+  }),
+  not: (of: SelectorInput): SelectorExpression => ({ op: 'not', of: input(of) }),
+
+  /** Length of an array or string */
+  length: (of: SelectorExpression): SelectorExpression => ({
+    op: 'length',
+    of,
+  }),
+
+  /** Items of the array `of` whose value at `path` equals `equals` */
+  filter: (
+    of: SelectorExpression,
+    path: Path,
+    equals: SelectorInput
+  ): SelectorExpression => ({ op: 'filter', of, path, equals: input(equals) }),
+};
+
+// Counter for generating unique selector keys
+let selectorCounter = 0;
+
+/**
+ * Create a derived atom evaluated entirely in native code
+ *
+ * Each field of the value is computed from an expression over other atoms.
+ * The expressions are compiled once; recomputing never calls into JS, so
+ * it needs no thread hop or Promise. Use `atom(get => ...)` for anything
+ * the expressions cannot describe.
+ *
+ * @example
+ * ```ts
+ * const profileAtom = selector({
+ *   name: select.get(userAtom, ['name']),
+ *   adult: select.ge(select.get(userAtom, ['age']), 18),
+ *   unread: select.length(
+ *     select.filter(select.get(inboxAtom, ['messages']), ['read'], false)
+ *   ),
+ * });
+ * ```
+ */
+export function selector<T extends AnyMap>(
+  fields: { [K in keyof T]: SelectorExpression },
+  options?: { debugLabel?: string }
+): ReadonlyAtom<T> {
+  const key = options?.debugLabel ?? `selector_${++selectorCounter}`;
+  const nitroState = getNitroState();
+  nitroState.createSelector(key, fields as AnyMap);
+
+  const readonlyAtom: ReadonlyAtom<T> = {
+    key,
+    get: () => nitroState.getComputedValue(key) as T,
+    subscribe: (callback: () => void) =>
+      nitroState.subscribeComputed(key, callback),
+    __atom: true as const,
+    __readonly: true as const,
+  };
+  retainComputed(readonlyAtom, key);
+
+  return readonlyAtom;
+}
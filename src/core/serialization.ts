@@ -0,0 +1,29 @@
+import type { AnyMap } from 'react-native-nitro-modules';
+import { getNitroState } from './instance';
+import type { Atom } from '../types';
+
+/**
+ * Encode an atom's value natively, without `JSON.stringify`
+ *
+ * The bytes can be stored, hashed or sent to another runtime and read
+ * back with `importAtom`.
+ *
+ * @example
+ * ```ts
+ * const bytes = exportAtom(cartAtom);
+ * importAtom(cartBackupAtom, bytes);
+ * ```
+ */
+export function exportAtom<T extends AnyMap>(atom: Atom<T>): ArrayBuffer {
+  return getNitroState().exportAtom(atom.key);
+}
+
+/**
+ * Set an atom from bytes produced by `exportAtom`
+ */
+export function importAtom<T extends AnyMap>(
+  atom: Atom<T>,
+  data: ArrayBuffer
+): void {
+  getNitroState().importAtom(atom.key, data);
+}
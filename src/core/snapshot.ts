@@ -0,0 +1,42 @@
+import type { AnyMap } from 'react-native-nitro-modules';
+import { getNitroState } from './instance';
+import type { Atom } from '../types';
+
+/**
+ * A consistent view of all atoms at one commit version
+ */
+export interface Snapshot {
+  /** Read an atom as it was when the snapshot was taken */
+  get<T extends AnyMap>(atom: Atom<T>): T;
+
+  /** Free the old values held for this snapshot. Reads throw afterwards. */
+  release(): void;
+}
+
+/**
+ * Take a snapshot of every atom without blocking writers
+ *
+ * Reads through the snapshot never mix values from before and after a
+ * write, even while other threads keep writing. Release it when done;
+ * superseded values are kept in memory until then.
+ *
+ * @example
+ * ```ts
+ * const snapshot = acquireSnapshot();
+ * try {
+ *   report({ cart: snapshot.get(cartAtom), user: snapshot.get(userAtom) });
+ * } finally {
+ *   snapshot.release();
+ * }
+ * ```
+ */
+export function acquireSnapshot(): Snapshot {
+  const nitroState = getNitroState();
+  const id = nitroState.acquireSnapshot();
+
+  return {
+    get: <T extends AnyMap>(atom: Atom<T>) =>
+      nitroState.getAtomValueAt(id, atom.key) as T,
+    release: () => nitroState.releaseSnapshot(id),
+  };
+}
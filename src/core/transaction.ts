@@ -0,0 +1,82 @@
+import type { AnyMap } from 'react-native-nitro-modules';
+import { getNitroState } from './instance';
+import type { Atom } from '../types';
+
+/**
+ * Reads and writes scoped to one transaction
+ */
+export interface Transaction {
+  /** Read an atom as of the transaction's snapshot, including its own writes */
+  get<T extends AnyMap>(atom: Atom<T>): T;
+
+  /** Buffer a write; nobody else sees it before commit */
+  set<T extends AnyMap>(
+    atom: Atom<T>,
+    valueOrUpdater: T | ((prev: T) => T)
+  ): void;
+}
+
+export interface TransactionOptions {
+  /** Attempts after a conflict before giving up. Defaults to 10. */
+  maxRetries?: number;
+}
+
+/**
+ * Update several atoms atomically
+ *
+ * Other readers see either none or all of the writes, and subscribers are
+ * notified once after the commit. If another writer touches one of the
+ * atoms first, the callback is run again on fresh values, so it must not
+ * have side effects. A throw discards every write.
+ *
+ * @example
+ * ```ts
+ * transaction((tx) => {
+ *   tx.set(cartAtom, { items: [] });
+ *   tx.set(ordersAtom, (orders) => ({ ...orders, [id]: tx.get(cartAtom) }));
+ * });
+ * ```
+ */
+export function transaction<R>(
+  callback: (tx: Transaction) => R,
+  options?: TransactionOptions
+): R {
+  const nitroState = getNitroState();
+  const maxRetries = options?.maxRetries ?? 10;
+
+  for (let attempt = 0; ; attempt++) {
+    const id = nitroState.beginTransaction();
+    const tx: Transaction = {
+      get: <T extends AnyMap>(atom: Atom<T>) =>
+        nitroState.transactionGet(id, atom.key) as T,
+      set: <T extends AnyMap>(
+        atom: Atom<T>,
+        valueOrUpdater: T | ((prev: T) => T)
+      ) => {
+        let value = valueOrUpdater as T;
+        if (typeof valueOrUpdater === 'function') {
+          const updater = valueOrUpdater as (prev: T) => T;
+          value = updater(nitroState.transactionGet(id, atom.key) as T);
+        }
+        nitroState.transactionSet(id, atom.key, value);
+      },
+    };
+
+    let result: R;
+    try {
+      result = callback(tx);
+    } catch (error) {
+      nitroState.abortTransaction(id);
+      throw error;
+    }
+
+    if (nitroState.commitTransaction(id)) {
+      return result;
+    }
+    if (attempt >= maxRetries) {
+      throw new Error(
+        `Transaction still conflicting after ${maxRetries} retries`
+      );
+    }
+  }
+}
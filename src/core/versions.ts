@@ -0,0 +1,34 @@
+import { getNitroState } from './instance';
+
+/**
+ * Tracks which atoms changed between calls without reading any values
+ */
+export interface ChangeTracker {
+  /** Keys of atoms written since the previous call (or since creation) */
+  changed(): string[];
+}
+
+/**
+ * Create a change tracker
+ *
+ * @example
+ * ```ts
+ * const tracker = createChangeTracker();
+ * // ...later, e.g. before re-rendering a list
+ * const dirtyKeys = tracker.changed();
+ * ```
+ */
+export function createChangeTracker(): ChangeTracker {
+  const nitroState = getNitroState();
+  let since = nitroState.getCommitVersion();
+
+  return {
+    changed: () => {
+      // Read the version first so no commit falls between the two calls
+      const now = nitroState.getCommitVersion();
+      const keys = nitroState.getChangedSince(since);
+      since = now;
+      return keys;
+    },
+  };
+}
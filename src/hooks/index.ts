@@ -1 +1 @@
-export { useAtom, useAtomValue, useSetAtom } from './useAtom';
+export { useAtom, useAtomValue, useAtomPath, useSetAtom } from './useAtom';
@@ -56,20 +56,51 @@ export function useAtomValue<T extends AnyMap>(
     // Sync initial value
     setValue(atomRef.current.get());
 
-    // Subscribe to changes (only for mutable atoms)
-    if ('subscribe' in atomRef.current) {
-      const unsubscribe = (atomRef.current as Atom<T>).subscribe(() => {
-        setValue(atomRef.current.get());
-      });
-      return unsubscribe;
-    }
-
-    return undefined;
+    // Subscribe to changes (computeds notify on invalidation)
+    const unsubscribe = atomRef.current.subscribe(() => {
+      setValue(atomRef.current.get());
+    });
+
+    return unsubscribe;
   }, [atom.key]);
 
   return value;
 }
 
+/**
+ * useAtomPath - Subscribe to one nested value of an atom
+ *
+ * Re-renders only when the value at `path` changes, not on writes to
+ * other fields of the atom.
+ *
+ * @example
+ * ```tsx
+ * const theme = useAtomPath<string>(settingsAtom, ['appearance', 'theme']);
+ * ```
+ */
+export function useAtomPath<V = unknown>(
+  atom: Atom<AnyMap>,
+  path: string[]
+): V | undefined {
+  const [value, setValue] = useState<V | undefined>(() => atom.getIn<V>(path));
+  const atomRef = useRef(atom);
+  atomRef.current = atom;
+  const pathKey = JSON.stringify(path);
+
+  useEffect(() => {
+    const currentPath = JSON.parse(pathKey) as string[];
+    setValue(atomRef.current.getIn<V>(currentPath));
+
+    const unsubscribe = atomRef.current.subscribePath(currentPath, () => {
+      setValue(atomRef.current.getIn<V>(currentPath));
+    });
+
+    return unsubscribe;
+  }, [atom.key, pathKey]);
+
+  return value;
+}
+
 /**
  * useSetAtom - Get only the setter for an atom (no subscription)
  *
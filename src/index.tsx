@@ -1,8 +1,30 @@
 // Core API
-export { atom, batch, getNitroState, resetNitroState } from './core';
+export {
+  atom,
+  atomFamily,
+  selector,
+  select,
+  batch,
+  getMany,
+  setMany,
+  transaction,
+  acquireSnapshot,
+  openStore,
+  saveStore,
+  exportAtom,
+  importAtom,
+  collectGarbage,
+  startGarbageCollection,
+  startScheduler,
+  stopScheduler,
+  flush,
+  createChangeTracker,
+  getNitroState,
+  resetNitroState,
+} from './core';
 
 // React Hooks
-export { useAtom, useAtomValue, useSetAtom } from './hooks';
+export { useAtom, useAtomValue, useAtomPath, useSetAtom } from './hooks';
 
 // Types
 export type {
@@ -11,6 +33,18 @@ export type {
   SetterFn,
   Getter,
   AtomOptions,
+  EqualityMode,
 } from './types';
 
+export type {
+  AtomFamily,
+  AtomFamilyOptions,
+  ChangeTracker,
+  SelectorExpression,
+  SelectorInput,
+  Snapshot,
+  Transaction,
+  TransactionOptions,
+} from './core';
+
 export { isAtom, isReadonlyAtom } from './types';
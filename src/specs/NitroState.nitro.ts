@@ -1,5 +1,14 @@
 import type { AnyMap, HybridObject } from 'react-native-nitro-modules';
 
+/**
+ * How an atom decides whether a write actually changed its value.
+ * - `identity`: every write counts as a change
+ * - `shallow`: equal top-level keys and primitive values
+ * - `deep`: full structural comparison
+ * - `hash`: compare 64-bit structural fingerprints
+ */
+export type EqualityMode = 'identity' | 'shallow' | 'deep' | 'hash';
+
 /**
  * NitroState - C++ backed fine-grained state management
  *
@@ -15,6 +24,17 @@ export interface NitroState
    */
   createAtom(key: string, initialValue: AnyMap): void;
 
+  /**
+   * Create a new atom and return its dense numeric handle.
+   * Handle-based calls skip the key lookup on every access.
+   */
+  createAtomHandle(key: string, initialValue: AnyMap): number;
+
+  /**
+   * Resolve the handle of an existing atom
+   */
+  getAtomHandle(key: string): number;
+
   /**
    * Get current atom value
    */
@@ -36,22 +56,214 @@ export interface NitroState
    */
   deleteAtom(key: string): void;
 
+  /**
+   * Set the equality policy of an atom.
+   * Writes judged equal to the current value are dropped without notifying.
+   */
+  setAtomEquality(key: string, mode: EqualityMode): void;
+
+  // ----- Bulk Operations -----
+
+  /**
+   * Get the values of many atoms in one call, in the order of `keys`
+   */
+  getMany(keys: string[]): AnyMap[];
+
+  /**
+   * Set many atoms in one call: `values[i]` is written to `keys[i]`.
+   * Throws before writing anything if a key does not exist. Subscribers
+   * are notified once, after every write, like in a batch.
+   */
+  setMany(keys: string[], values: AnyMap[]): void;
+
+  // ----- Handle-based Atom Operations -----
+
+  /**
+   * Get current atom value by handle
+   */
+  getAtomValueByHandle(handle: number): AnyMap;
+
+  /**
+   * Set atom value by handle
+   */
+  setAtomValueByHandle(handle: number, value: AnyMap): void;
+
+  /**
+   * Subscribe to atom changes by handle
+   * @returns Unsubscribe function
+   */
+  subscribeAtomByHandle(handle: number, callback: () => void): () => void;
+
+  // ----- Nested Values -----
+
+  /**
+   * Write `value.value` at `path` inside the atom's value.
+   * After setAtomValue() the object is converted into a persistent trie once,
+   * one level at a time as writes reach it, so each later write copies
+   * O(log n) nodes instead of the whole object. Reading the whole value
+   * back with getAtomValue() still builds a plain copy once per change.
+   * Numeric path segments index into arrays; an index equal to the length
+   * appends, and one beyond it throws.
+   */
+  setIn(key: string, path: string[], value: AnyMap): void;
+
+  /**
+   * Read the value at `path`, returned as `{ value }` (empty if missing).
+   * Does not copy the rest of the atom across the bridge.
+   */
+  getIn(key: string, path: string[]): AnyMap;
+
+  /**
+   * Subscribe to the value at `path` only.
+   * Fires when that value or anything beneath it changes; writes to other
+   * fields of the atom do not call it.
+   * @returns Unsubscribe function
+   */
+  subscribePath(
+    key: string,
+    path: string[],
+    callback: () => void
+  ): () => void;
+
+  // ----- Patches -----
+  // Applied under the atom's lock; only the patch crosses the bridge.
+
+  /**
+   * Shallow-merge the top-level keys of `partial` into the atom's value
+   */
+  mergeAtom(key: string, partial: AnyMap): void;
+
+  /**
+   * Add `delta` to the number at `path` (a missing number counts as 0)
+   * @returns The new number
+   */
+  increment(key: string, path: string[], delta: number): number;
+
+  /**
+   * Append `items.value` to the array at `path` (created if missing).
+   * Only the items cross the bridge, but the array is copied natively:
+   * O(length) per call.
+   * @returns The new length
+   */
+  push(key: string, path: string[], items: AnyMap): number;
+
+  /**
+   * `Array.prototype.splice` on the array at `path`, inserting `items.value`.
+   * O(length) per call, like push.
+   * @returns The removed items as `{ value }`
+   */
+  splice(
+    key: string,
+    path: string[],
+    start: number,
+    deleteCount: number,
+    items: AnyMap
+  ): AnyMap;
+
+  // ----- Versions -----
+
+  /**
+   * Commit version of the atom's last write (0 if never written).
+   * Cheap to call: no value crosses the bridge.
+   */
+  getAtomVersion(key: string): number;
+
+  /**
+   * Commit version of the atom's last write, by handle
+   */
+  getAtomVersionByHandle(handle: number): number;
+
+  /**
+   * Set the atom's value only if its last write is still `expectedVersion`
+   * (as read from `getAtomVersion`). Lets a read-modify-write detect that
+   * another writer slipped in between and retry instead of losing an update.
+   * @returns false on a version conflict
+   */
+  compareAndSet(key: string, expectedVersion: number, value: AnyMap): boolean;
+
+  /**
+   * Compare-and-set by handle
+   */
+  compareAndSetByHandle(
+    handle: number,
+    expectedVersion: number,
+    value: AnyMap
+  ): boolean;
+
+  /**
+   * Latest commit version; every write up to it is visible
+   */
+  getCommitVersion(): number;
+
+  /**
+   * Keys of atoms written after `version`.
+   * Read `getCommitVersion()` before calling and pass that next time.
+   */
+  getChangedSince(version: number): string[];
+
   // ----- Computed Operations -----
 
   /**
-   * Create a computed value from dependencies
+   * Create a computed value from dependencies.
+   * Dependencies may be atom keys or keys of other computeds. They are
+   * only the initial set: every run records the atoms and computeds
+   * `compute` reads and they become the new set once its value lands, so
+   * sources left behind by a branch stop invalidating it.
+   * `compute` runs on the JS thread, not inside the native call that
+   * needs the value, so it reports each read with `trackRead(key, run, …)`.
    */
   createComputed(
     key: string,
     dependencies: string[],
-    compute: () => AnyMap
+    compute: (run: number) => AnyMap
   ): void;
 
+  /**
+   * Create a non-blocking computed value.
+   * Reads return the last computed value (or `placeholder` before the
+   * first one lands) immediately and schedule a recompute when stale.
+   * Subscribers are notified when a new value lands.
+   */
+  createAsyncComputed(
+    key: string,
+    dependencies: string[],
+    compute: (run: number) => AnyMap,
+    placeholder: AnyMap
+  ): void;
+
+  /**
+   * Create a computed evaluated natively, without calling into JS.
+   * `spec` maps each field of the value to an expression object, e.g.
+   * `{ name: { op: 'get', source: 'user', path: ['name'] } }`.
+   * Ops: get, const, field, add, sub, mul, div, mod, eq, ne, lt, le, gt,
+   * ge, and, or, not, length and filter (see `selector` in the JS API).
+   * Sources must exist; they become the selector's dependencies.
+   */
+  createSelector(key: string, spec: AnyMap): void;
+
+  /**
+   * Record that run `run` of computed `computed` read the atom or computed
+   * `key`. Reads reported after the run's value landed are ignored.
+   */
+  trackRead(computed: string, run: number, key: string): void;
+
   /**
    * Get computed value
    */
   getComputedValue(key: string): AnyMap;
 
+  /**
+   * Check if a computed has no value yet or is recomputing
+   */
+  isComputedPending(key: string): boolean;
+
+  /**
+   * Subscribe to invalidation of a computed value.
+   * Fires once per upstream change, after the whole graph is invalidated.
+   * @returns Unsubscribe function
+   */
+  subscribeComputed(key: string, callback: () => void): () => void;
+
   /**
    * Delete a computed value
    */
@@ -60,7 +272,8 @@ export interface NitroState
   // ----- Batch Operations -----
 
   /**
-   * Start a batch operation (defers notifications)
+   * Start a batch operation (defers notifications of writes made on the
+   * calling thread; writes from native threads are not held back)
    */
   startBatch(): void;
 
@@ -69,6 +282,174 @@ export interface NitroState
    */
   endBatch(): void;
 
+  // ----- Persistence -----
+
+  /**
+   * Memory-map the store file at `path`, replay its write-ahead log
+   * (`path` + `.wal`) on top and register every atom found. Values are
+   * decoded on first read, so this only costs a pass over the keys.
+   * Atoms that already exist keep their value. From here on every write
+   * to a persisted atom is appended to the log by a background thread.
+   * Only one store can be open.
+   * @returns Keys of the atoms that were loaded
+   */
+  openStore(path: string): string[];
+
+  /**
+   * Persist an atom: its current value and every later write are logged
+   */
+  persistAtom(key: string): void;
+
+  /**
+   * Compact the log into the store file now, after syncing it. The log
+   * compacts itself in the background, so this is only needed to bound
+   * startup work or before handing the files to someone else.
+   */
+  saveStore(): void;
+
+  // ----- Families -----
+
+  /**
+   * Create a family of atoms keyed by a parameter. Members start out as
+   * `defaultValue` and are registered as `<name>:<param>`.
+   */
+  createFamily(name: string, defaultValue: AnyMap): void;
+
+  /**
+   * Handle of the member for `param`, created on first use. Creating a
+   * member may evict the least recently used members that nothing
+   * subscribes to or derives from, until the family fits its budget.
+   */
+  familyGet(name: string, param: string): number;
+
+  /**
+   * Limit how many members a family keeps and roughly how many bytes
+   * their values may hold; 0 means no limit. Defaults to 10000 members.
+   */
+  setFamilyBudget(name: string, maxMembers: number, maxBytes: number): void;
+
+  // ----- Serialization -----
+
+  /**
+   * Encode an atom's value in the native binary format (tagged values,
+   * varints, interned strings) without going through JSON
+   */
+  exportAtom(key: string): ArrayBuffer;
+
+  /**
+   * Set an atom from bytes produced by `exportAtom`, creating it if it
+   * does not exist. Subscribers are notified like for any other write.
+   */
+  importAtom(key: string, data: ArrayBuffer): void;
+
+  // ----- Lifetime -----
+
+  /**
+   * Count a JS reference to an atom. Atoms that were never retained live
+   * until deleted; retained ones are reclaimed by `collectGarbage` once
+   * every reference is released and nothing subscribes to or reads them.
+   * Persisted atoms are never reclaimed.
+   * @returns false if the atom was already reclaimed
+   */
+  retainAtom(handle: number): boolean;
+
+  /**
+   * Drop a reference counted by `retainAtom`
+   */
+  releaseAtom(handle: number): void;
+
+  /**
+   * Count a JS reference to a computed, like `retainAtom`
+   * @returns false if the computed does not exist (anymore)
+   */
+  retainComputed(key: string): boolean;
+
+  /**
+   * Drop a reference counted by `retainComputed`
+   */
+  releaseComputed(key: string): void;
+
+  /**
+   * Sweep for unreachable atoms and computeds for about `sliceMs`.
+   * The sweep is incremental: each call resumes where the last one stopped.
+   * @returns Number of atoms and computeds reclaimed
+   */
+  collectGarbage(sliceMs: number): number;
+
+  // ----- Snapshots -----
+
+  /**
+   * Pin a consistent view of every atom at the latest commit version.
+   * Writers keep going; the values the snapshot can see are kept alive
+   * until `releaseSnapshot`.
+   * @returns Snapshot id
+   */
+  acquireSnapshot(): number;
+
+  /**
+   * Read an atom as of a snapshot. Atoms created after the snapshot read
+   * as their initial value.
+   */
+  getAtomValueAt(snapshot: number, key: string): AnyMap;
+
+  /**
+   * Release a snapshot so the old values it pinned can be freed
+   */
+  releaseSnapshot(snapshot: number): void;
+
+  // ----- Transactions -----
+
+  /**
+   * Open a transaction reading at a snapshot pinned at the current commit
+   * version. Its writes stay private until `commitTransaction`; committing
+   * or aborting releases the snapshot.
+   * @returns Transaction id
+   */
+  beginTransaction(): number;
+
+  /**
+   * Read an atom as of the transaction's snapshot (sees its own writes)
+   */
+  transactionGet(transaction: number, key: string): AnyMap;
+
+  /**
+   * Buffer a write inside a transaction
+   */
+  transactionSet(transaction: number, key: string, value: AnyMap): void;
+
+  /**
+   * Publish every write of the transaction under one commit version and
+   * notify once. Fails without publishing anything if an atom the
+   * transaction read or wrote was changed by someone else since it began.
+   * The transaction is closed either way.
+   * @returns false on conflict
+   */
+  commitTransaction(transaction: number): boolean;
+
+  /**
+   * Discard a transaction and its writes
+   */
+  abortTransaction(transaction: number): void;
+
+  // ----- Scheduling -----
+
+  /**
+   * Coalesce notifications instead of delivering them on every write.
+   * Each atom notifies at most once per flush, and subscribers read the latest value.
+   * @param intervalMs Flush from a native timer every `intervalMs`; 0 to only flush on `flush()`
+   */
+  startScheduler(intervalMs: number): void;
+
+  /**
+   * Deliver anything still queued and go back to synchronous notification
+   */
+  stopScheduler(): void;
+
+  /**
+   * Deliver all queued notifications now
+   */
+  flush(): void;
+
   // ----- Utility -----
 
   /**
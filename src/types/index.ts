@@ -1,7 +1,11 @@
 import type { AnyMap } from 'react-native-nitro-modules';
+import type { EqualityMode } from '../specs/NitroState.nitro';
+
+export type { EqualityMode };
 
 /**
- * Setter function type - accepts value or updater function
+ * Setter function type - accepts value or updater function.
+ * An updater is re-run on the latest value if another write lands first.
  */
 export type SetterFn<T extends AnyMap> = (
   valueOrUpdater: T | ((prev: T) => T)
@@ -30,6 +34,38 @@ export interface Atom<T extends AnyMap> {
   /** Subscribe to changes, returns unsubscribe function */
   subscribe(callback: () => void): () => void;
 
+  /** Read a nested value without copying the whole atom */
+  getIn<V = unknown>(path: string[]): V | undefined;
+
+  /** Write a nested value, copying only the path to it */
+  setIn(path: string[], value: unknown): void;
+
+  /** Subscribe to changes of one nested value, returns unsubscribe function */
+  subscribePath(path: string[], callback: () => void): () => void;
+
+  /** Shallow-merge top-level keys without sending the whole value */
+  merge(partial: Partial<T>): void;
+
+  /** Atomically add `delta` to the number at `path`, returns the new number */
+  increment(path: string[], delta?: number): number;
+
+  /** Append to the array at `path`, returns its new length */
+  push(path: string[], ...items: unknown[]): number;
+
+  /** Splice the array at `path` like `Array.prototype.splice` */
+  splice(
+    path: string[],
+    start: number,
+    deleteCount?: number,
+    ...items: unknown[]
+  ): unknown[];
+
+  /** Commit version of the last write; re-read the value only when it moves */
+  version(): number;
+
+  /** Set only if `version()` still equals `expectedVersion`, false otherwise */
+  compareAndSet(expectedVersion: number, value: T): boolean;
+
   /** Type marker */
   readonly __atom: true;
 }
@@ -44,6 +80,9 @@ export interface ReadonlyAtom<T extends AnyMap> {
   /** Get current computed value */
   get(): T;
 
+  /** Subscribe to invalidation, returns unsubscribe function */
+  subscribe(callback: () => void): () => void;
+
   /** Type marker */
   readonly __atom: true;
   readonly __readonly: true;
@@ -56,8 +95,28 @@ export interface AtomOptions<T extends AnyMap> {
   /** Custom equality function */
   equals?: (a: T, b: T) => boolean;
 
+  /**
+   * Native equality policy. Writes equal to the current value are
+   * dropped in C++ without notifying subscribers. Defaults to `identity`.
+   */
+  equality?: EqualityMode;
+
   /** Debug label */
   debugLabel?: string;
+
+  /**
+   * Keep the atom in the persistent store (see `openStore`). Every write
+   * is logged natively. Requires a `debugLabel`, which is the key it is
+   * stored under. A stored value takes precedence over the initial value.
+   */
+  persist?: boolean;
+
+  /**
+   * Value a derived atom returns until its first computation lands.
+   * Setting it makes the derived atom non-blocking: reads never wait
+   * for the compute function, and subscribers fire when a new value lands.
+   */
+  placeholder?: T;
 }
 
 /**